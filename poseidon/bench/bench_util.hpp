@@ -0,0 +1,53 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_BENCH_BENCH_UTIL_HPP_
+#define POSEIDON_BENCH_BENCH_UTIL_HPP_
+
+// 各个微基准共用的命令行解析、初始化和计时。
+// 所有微基准的第一个参数都是含有 main.conf 的目录，与 poseidon 的参数相同，其余参数都是可选的无符号整数。
+
+#include "../src/precompiled.hpp"
+#include "../src/singletons/main_config.hpp"
+#include "../src/log.hpp"
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace Poseidon {
+namespace Bench {
+
+// 缺少目录时打印用法并返回 false，否则加载 main.conf 并初始化日志。`usage` 描述其余的参数。
+inline bool initialize(int argc, char **argv, const char *usage){
+	if(argc < 2){
+		::fprintf(stderr, "Usage: %s <directory> %s\n", argv[0], usage);
+		return false;
+	}
+	Main_config::set_run_path(argv[1]);
+	Main_config::reload();
+	Logger::initialize_mask_from_config();
+	return true;
+}
+inline void finalize(){
+	Logger::finalize_mask();
+}
+
+// 返回第 `index` 个参数，没有给出时返回 `def`。
+inline unsigned long get_argument(int argc, char **argv, int index, unsigned long def){
+	if(argc <= index){
+		return def;
+	}
+	return ::strtoul(argv[index], NULLPTR, 0);
+}
+
+// 整个进程（包括后台线程）消耗的 CPU 时间，以毫秒计。
+inline double get_process_cpu_time(){
+	::timespec ts;
+	::clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return static_cast<double>(ts.tv_sec) * 1e3 + static_cast<double>(ts.tv_nsec) / 1e6;
+}
+
+}
+}
+
+#endif
@@ -0,0 +1,87 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+// 测量 Job_dispatcher 中纤程让出（yield）的开销。
+// 若干个任务同时执行，每个任务不带 promise 地反复调用 `Job_dispatcher::yield()`，调度线程不断切换回去。
+// 一次让出包含切换出去、调度和切换回来。上下文切换的实现取决于 configure 时是否指定了 --disable-asm-context。
+// 用法：fiber_yield_bench <目录> [每个任务的让出次数] [任务数]
+// 目录中须有 main.conf，与 poseidon 的参数相同。
+
+#include "../src/precompiled.hpp"
+#include "bench_util.hpp"
+#include "../src/singletons/job_dispatcher.hpp"
+#include "../src/job_base.hpp"
+#include "../src/promise.hpp"
+#include "../src/log.hpp"
+#include "../src/time.hpp"
+#include "../src/atomic.hpp"
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace Poseidon;
+
+namespace {
+	volatile int g_sig_recv = 0;
+	volatile std::size_t g_jobs_pending = 0;
+
+	class Yield_job : public Job_base {
+	private:
+		const unsigned long m_count;
+
+	public:
+		explicit Yield_job(unsigned long count)
+			: m_count(count)
+		{
+			//
+		}
+
+	public:
+		boost::weak_ptr<const void> get_category() const OVERRIDE {
+			return VAL_INIT;
+		}
+		void perform() OVERRIDE {
+			for(unsigned long i = 0; i < m_count; ++i){
+				Job_dispatcher::yield(VAL_INIT, false);
+			}
+			if(atomic_sub(g_jobs_pending, 1, memory_order_acq_rel) == 0){
+				atomic_store(g_sig_recv, SIGTERM, memory_order_release);
+			}
+		}
+	};
+}
+
+int main(int argc, char **argv){
+	if(!Bench::initialize(argc, argv, "[yields per job] [jobs]")){
+		return EXIT_FAILURE;
+	}
+	const AUTO(yield_count, Bench::get_argument(argc, argv, 2, 1000000ul));
+	const AUTO(job_count, Bench::get_argument(argc, argv, 3, 1ul));
+
+	Job_dispatcher::start();
+
+#if defined(POSEIDON_ENABLE_ASM_CONTEXT) && (defined(__x86_64__) || defined(__aarch64__))
+	::printf("context   asm\n");
+#else
+	::printf("context   ucontext\n");
+#endif
+	::printf("jobs      %12lu\n", job_count);
+	::printf("yields    %12lu per job\n", yield_count);
+
+	atomic_store(g_jobs_pending, job_count, memory_order_release);
+	const double t0 = get_hi_res_mono_clock();
+	for(unsigned long i = 0; i < job_count; ++i){
+		Job_dispatcher::enqueue(boost::make_shared<Yield_job>(yield_count), VAL_INIT);
+	}
+	Job_dispatcher::do_modal(g_sig_recv);
+	const double t = get_hi_res_mono_clock() - t0;
+
+	const double total = static_cast<double>(yield_count) * static_cast<double>(job_count);
+	::printf("elapsed   %12.3f ms\n", t);
+	::printf("rate      %12.3f Myields/s\n", total / t / 1e3);
+	::printf("cost      %12.1f ns/yield\n", t * 1e6 / total);
+
+	Job_dispatcher::stop();
+	Bench::finalize();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,110 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+// 测量从多个线程调用 `Job_dispatcher::enqueue()` 的吞吐量。
+// 每个生产者线程提交若干个空任务，任务的类别从一组共享的类别中随机挑选，同一类别的任务依然按顺序执行。
+// 调度线程的数量取自 main.conf 中的 job_dispatcher_thread_count，主线程也是其中之一。
+// 用法：job_enqueue_bench <目录> [生产者线程数] [每个线程的任务数] [类别数]
+// 目录中须有 main.conf，与 poseidon 的参数相同。
+
+#include "../src/precompiled.hpp"
+#include "bench_util.hpp"
+#include "../src/singletons/job_dispatcher.hpp"
+#include "../src/job_base.hpp"
+#include "../src/thread.hpp"
+#include "../src/log.hpp"
+#include "../src/time.hpp"
+#include "../src/random.hpp"
+#include "../src/atomic.hpp"
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace Poseidon;
+
+namespace {
+	volatile int g_sig_recv = 0;
+	volatile unsigned long g_jobs_pending = 0;
+	// 在 `g_sig_recv` 之前写入，因此 `do_modal()` 返回之后可以读取。
+	double g_drain_end = 0;
+
+	class Empty_job : public Job_base {
+	private:
+		const boost::weak_ptr<const void> m_category;
+
+	public:
+		explicit Empty_job(boost::weak_ptr<const void> category)
+			: m_category(STD_MOVE(category))
+		{
+			//
+		}
+
+	public:
+		boost::weak_ptr<const void> get_category() const OVERRIDE {
+			return m_category;
+		}
+		void perform() OVERRIDE {
+			if(atomic_sub(g_jobs_pending, 1, memory_order_acq_rel) == 0){
+				g_drain_end = get_hi_res_mono_clock();
+				atomic_store(g_sig_recv, SIGTERM, memory_order_release);
+			}
+		}
+	};
+
+	boost::container::vector<boost::shared_ptr<const int> > g_categories;
+
+	void producer_proc(double &elapsed, unsigned long job_count){
+		const double t0 = get_hi_res_mono_clock();
+		for(unsigned long i = 0; i < job_count; ++i){
+			const AUTO_REF(category, g_categories.at(random_uint32() % g_categories.size()));
+			Job_dispatcher::enqueue(boost::make_shared<Empty_job>(category), VAL_INIT);
+		}
+		elapsed = get_hi_res_mono_clock() - t0;
+	}
+}
+
+int main(int argc, char **argv){
+	if(!Bench::initialize(argc, argv, "[producer threads] [jobs per thread] [categories]")){
+		return EXIT_FAILURE;
+	}
+	const AUTO(producer_count, Bench::get_argument(argc, argv, 2, 8ul));
+	const AUTO(jobs_per_producer, Bench::get_argument(argc, argv, 3, 100000ul));
+	const AUTO(category_count, Bench::get_argument(argc, argv, 4, 1000ul));
+
+	Job_dispatcher::start();
+
+	::printf("dispatchers %10lu\n", Main_config::get<unsigned long>("job_dispatcher_thread_count", 1));
+	::printf("producers   %10lu\n", producer_count);
+	::printf("jobs        %10lu per producer\n", jobs_per_producer);
+	::printf("categories  %10lu\n", category_count);
+
+	g_categories.resize(category_count);
+	for(std::size_t i = 0; i < g_categories.size(); ++i){
+		g_categories.at(i) = boost::make_shared<int>();
+	}
+	const double total = static_cast<double>(producer_count) * static_cast<double>(jobs_per_producer);
+	atomic_store(g_jobs_pending, producer_count * jobs_per_producer, memory_order_release);
+
+	const double t0 = get_hi_res_mono_clock();
+	boost::container::vector<Thread> producers(producer_count);
+	boost::container::vector<double> enqueue_times(producer_count);
+	for(std::size_t i = 0; i < producers.size(); ++i){
+		Thread(boost::bind(&producer_proc, boost::ref(enqueue_times.at(i)), jobs_per_producer), Rcnts::view("   B"), Rcnts::view("Producer")).swap(producers.at(i));
+	}
+	Job_dispatcher::do_modal(g_sig_recv);
+	double t_enqueue = 0;
+	for(std::size_t i = 0; i < producers.size(); ++i){
+		producers.at(i).join();
+		t_enqueue += enqueue_times.at(i);
+	}
+	t_enqueue /= static_cast<double>(producer_count);
+	const double t_drain = g_drain_end - t0;
+
+	::printf("enqueue     %10.3f ms per producer  %8.1f ns/job  %8.3f Mjobs/s\n", t_enqueue, t_enqueue * 1e6 / static_cast<double>(jobs_per_producer), total / t_enqueue / 1e3);
+	::printf("drain       %10.3f ms               %8.1f ns/job  %8.3f Mjobs/s\n", t_drain, t_drain * 1e6 / total, total / t_drain / 1e3);
+
+	Job_dispatcher::stop();
+	g_categories.clear();
+	Bench::finalize();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,148 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+// 测量 Mysql_daemon 保存对象的吞吐量，按表统计每秒写入的行数。
+// 对象由 object_generator.inl 生成，经由 `Mysql_daemon::enqueue_for_saving()` 写入 main.conf 中配置的服务器。
+// 每张表先建表并清空，然后一次提交若干个对象，等待全部写入完成；最后把各张表的对象交错提交一轮，
+// 观察多张表同时写入时的吞吐量。
+// 会建立并清空名为 poseidon_bench_* 的表，请不要对生产环境的 schema 运行。
+// 用法：mysql_save_bench <目录> [每张表的行数]
+// 目录中须有 main.conf，与 poseidon 的参数相同。
+
+#include "../src/precompiled.hpp"
+#include "bench_util.hpp"
+#include "../src/singletons/mysql_daemon.hpp"
+#include "../src/mysql/object_base.hpp"
+#include "../src/mysql/connection.hpp"
+#include "../src/promise.hpp"
+#include "../src/uuid.hpp"
+#include "../src/log.hpp"
+#include "../src/time.hpp"
+#include "../src/random.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MYSQL_OBJECT_EMIT_EXTERNAL_DEFINITIONS
+
+#define OBJECT_NAME     Bench_narrow
+#define OBJECT_TABLE    "poseidon_bench_narrow"
+#define OBJECT_FIELDS	\
+	FIELD_SIGNED(id)	\
+	FIELD_UNSIGNED(counter)
+#include "../src/mysql/object_generator.inl"
+#undef OBJECT_TABLE
+
+#define OBJECT_NAME     Bench_wide
+#define OBJECT_TABLE    "poseidon_bench_wide"
+#define OBJECT_FIELDS	\
+	FIELD_SIGNED(id)	\
+	FIELD_STRING(name)	\
+	FIELD_DATETIME(created)	\
+	FIELD_UUID(uuid)	\
+	FIELD_BOOLEAN(flag)	\
+	FIELD_DOUBLE(score)	\
+	FIELD_UNSIGNED(counter)	\
+	FIELD_STRING(note)
+#include "../src/mysql/object_generator.inl"
+#undef OBJECT_TABLE
+
+using namespace Poseidon;
+
+namespace {
+	typedef boost::container::vector<boost::shared_ptr<const Mysql::Object_base> > Object_vector;
+
+	const char *const g_create_statements[] = {
+		"CREATE TABLE IF NOT EXISTS `poseidon_bench_narrow` ("
+		"  `id` BIGINT NOT NULL,"
+		"  `counter` BIGINT UNSIGNED NOT NULL,"
+		"  PRIMARY KEY (`id`)"
+		") ENGINE = InnoDB",
+		"CREATE TABLE IF NOT EXISTS `poseidon_bench_wide` ("
+		"  `id` BIGINT NOT NULL,"
+		"  `name` VARCHAR(255) NOT NULL,"
+		"  `created` DATETIME NOT NULL,"
+		"  `uuid` CHAR(36) NOT NULL,"
+		"  `flag` BOOLEAN NOT NULL,"
+		"  `score` DOUBLE NOT NULL,"
+		"  `counter` BIGINT UNSIGNED NOT NULL,"
+		"  `note` VARCHAR(1024) NOT NULL,"
+		"  PRIMARY KEY (`id`)"
+		") ENGINE = InnoDB",
+	};
+
+	boost::shared_ptr<const Mysql::Object_base> make_narrow_object(boost::int64_t id){
+		return boost::make_shared<Bench_narrow>(id, random_uint64());
+	}
+	boost::shared_ptr<const Mysql::Object_base> make_wide_object(boost::int64_t id){
+		char name[64];
+		std::size_t len = (unsigned)::snprintf(name, sizeof(name), "player '%lld'", static_cast<long long>(id));
+		// 混入需要转义的字符。
+		std::string note(64 + random_uint32() % 192, 0);
+		for(std::size_t i = 0; i < note.size(); ++i){
+			note.at(i) = "abcdefghijklmnopqrstuvwxyz0123456789 '\"\\"[random_uint32() % 40];
+		}
+		return boost::make_shared<Bench_wide>(id, std::string(name, len), get_utc_time(), Uuid::random(),
+			random_uint32() % 2 != 0, random_double(), random_uint64(), STD_MOVE(note));
+	}
+
+	void reset_tables(){
+		const AUTO(conn, Mysql_daemon::create_connection());
+		for(std::size_t i = 0; i < COUNT_OF(g_create_statements); ++i){
+			conn->execute_sql(g_create_statements[i]);
+			conn->discard_result();
+		}
+		conn->execute_sql("TRUNCATE TABLE `poseidon_bench_narrow`");
+		conn->discard_result();
+		conn->execute_sql("TRUNCATE TABLE `poseidon_bench_wide`");
+		conn->discard_result();
+	}
+
+	void save_objects(const char *name, const Object_vector &objects){
+		boost::container::vector<boost::shared_ptr<const Promise> > promises;
+		promises.reserve(objects.size());
+		const double t0 = get_hi_res_mono_clock();
+		for(AUTO(it, objects.begin()); it != objects.end(); ++it){
+			promises.push_back(Mysql_daemon::enqueue_for_saving(*it, true, false));
+		}
+		Mysql_daemon::wait_for_all_async_operations();
+		const double t = get_hi_res_mono_clock() - t0;
+
+		unsigned long failed = 0;
+		for(AUTO(it, promises.begin()); it != promises.end(); ++it){
+			failed += !(*it)->is_satisfied() || (*it)->would_throw();
+		}
+		::printf("%-24s %10lu rows  %10.3f ms  %12.1f rows/s  %8lu failed\n",
+			name, static_cast<unsigned long>(objects.size()), t, static_cast<double>(objects.size()) * 1e3 / t, failed);
+	}
+}
+
+int main(int argc, char **argv){
+	if(!Bench::initialize(argc, argv, "[rows per table]")){
+		return EXIT_FAILURE;
+	}
+	const AUTO(row_count, Bench::get_argument(argc, argv, 2, 100000ul));
+
+	Mysql_daemon::start();
+
+	reset_tables();
+
+	Object_vector narrow, wide, mixed;
+	for(unsigned long i = 0; i < row_count; ++i){
+		const AUTO(id, static_cast<boost::int64_t>(i));
+		narrow.push_back(make_narrow_object(id));
+		wide.push_back(make_wide_object(id));
+	}
+	// 交错提交的对象使用另外的主键，不会覆盖上面写入的行。
+	for(unsigned long i = 0; i < row_count; ++i){
+		const AUTO(id, static_cast<boost::int64_t>(row_count + i));
+		mixed.push_back(make_narrow_object(id));
+		mixed.push_back(make_wide_object(id));
+	}
+	save_objects("poseidon_bench_narrow", narrow);
+	save_objects("poseidon_bench_wide", wide);
+	save_objects("(interleaved)", mixed);
+
+	Mysql_daemon::stop();
+	Bench::finalize();
+	return EXIT_SUCCESS;
+}
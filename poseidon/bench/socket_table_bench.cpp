@@ -0,0 +1,116 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+// 测量 Epoll_daemon 在大量套接字时处理每个事件的开销。
+// 创建若干个 UDP 套接字加入 epoll，每毫秒随机挑选一些套接字调用 `Epoll_daemon::mark_socket_writable()`，
+// 由 epoll 线程查找套接字、排入可写队列并调用 `poll_write()`。
+// 结果分为本线程标记一个套接字的时间和整个进程（包括 epoll 线程的清扫）处理一个事件的 CPU 时间。
+// epoll 为每个套接字另外复制一个描述符，因此套接字数不能超过 RLIMIT_NOFILE 硬限制的一半。
+// 用法：socket_table_bench <目录> [套接字数] [每毫秒事件数] [毫秒数]
+// 目录中须有 main.conf，与 poseidon 的参数相同。
+
+#include "../src/precompiled.hpp"
+#include "bench_util.hpp"
+#include "../src/singletons/epoll_daemon.hpp"
+#include "../src/socket_base.hpp"
+#include "../src/system_exception.hpp"
+#include "../src/log.hpp"
+#include "../src/time.hpp"
+#include "../src/random.hpp"
+#include "../src/atomic.hpp"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace Poseidon;
+
+namespace {
+	volatile unsigned long g_writes = 0;
+
+	class Bench_socket : public Socket_base {
+	public:
+		explicit Bench_socket(Move<Unique_file> socket)
+			: Socket_base(STD_MOVE(socket))
+		{
+			//
+		}
+
+	public:
+		int poll_write(Mutex::Unique_lock &/*write_lock*/, unsigned char */*hint_buffer*/, std::size_t /*hint_capacity*/, bool /*writable*/) OVERRIDE {
+			atomic_add(g_writes, 1, memory_order_relaxed);
+			return EWOULDBLOCK;
+		}
+	};
+}
+
+int main(int argc, char **argv){
+	if(!Bench::initialize(argc, argv, "[sockets] [events per ms] [duration in ms]")){
+		return EXIT_FAILURE;
+	}
+	const AUTO(socket_count, Bench::get_argument(argc, argv, 2, 1000ul));
+	const AUTO(events_per_ms, Bench::get_argument(argc, argv, 3, 1000ul));
+	const AUTO(duration, Bench::get_argument(argc, argv, 4, 3000ul));
+
+	// 标准输入输出、日志文件和 epoll 本身另外需要一些描述符。
+	::rlimit limit;
+	if((::getrlimit(RLIMIT_NOFILE, &limit) == 0) && (limit.rlim_cur < limit.rlim_max)){
+		limit.rlim_cur = limit.rlim_max;
+		::setrlimit(RLIMIT_NOFILE, &limit);
+	}
+	if((::getrlimit(RLIMIT_NOFILE, &limit) == 0) && (limit.rlim_cur < socket_count * 2 + 64)){
+		::fprintf(stderr, "%s: %lu sockets need more descriptors than RLIMIT_NOFILE (%lu) allows\n", argv[0], socket_count, static_cast<unsigned long>(limit.rlim_cur));
+		Bench::finalize();
+		return EXIT_FAILURE;
+	}
+
+	Epoll_daemon::start();
+
+	::printf("sockets %lu, events per ms %lu, duration %lu ms\n", socket_count, events_per_ms, duration);
+
+	boost::container::vector<boost::shared_ptr<Bench_socket> > sockets(socket_count);
+	for(std::size_t i = 0; i < sockets.size(); ++i){
+		Unique_file udp;
+		POSEIDON_THROW_UNLESS(udp.reset(::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, IPPROTO_UDP)), System_exception);
+		AUTO_REF(socket, sockets.at(i));
+		socket = boost::make_shared<Bench_socket>(STD_MOVE(udp));
+		Epoll_daemon::add_socket(socket);
+	}
+	// 新加入的套接字都会被调用一次 `poll_write()`，等待它们处理完毕。
+	while(atomic_load(g_writes, memory_order_relaxed) < socket_count){
+		::usleep(1000);
+	}
+	atomic_store(g_writes, 0ul, memory_order_relaxed);
+
+	double t_mark = 0;
+	const double cpu0 = Bench::get_process_cpu_time();
+	const double t0 = get_hi_res_mono_clock();
+	for(unsigned long ms = 1; ms <= duration; ++ms){
+		const double t1 = get_hi_res_mono_clock();
+		for(unsigned long k = 0; k < events_per_ms; ++k){
+			Epoll_daemon::mark_socket_writable(sockets.at(random_uint32() % socket_count).get());
+		}
+		const double t2 = get_hi_res_mono_clock();
+		t_mark += t2 - t1;
+		// 剩下的时间让给 epoll 线程。
+		const double t_next = t0 + static_cast<double>(ms);
+		if(t2 < t_next){
+			::usleep(static_cast<unsigned>((t_next - t2) * 1e3));
+		}
+	}
+	const double wall = get_hi_res_mono_clock() - t0;
+	const double cpu = Bench::get_process_cpu_time() - cpu0;
+
+	const double events = static_cast<double>(duration) * static_cast<double>(events_per_ms);
+	::printf("mark     %12.1f ns/event\n", t_mark * 1e6 / events);
+	::printf("cpu      %12.1f ns/event  (%.1f ms in %.1f ms)\n", cpu * 1e6 / events, cpu, wall);
+	::printf("writes   %12lu\n", atomic_load(g_writes, memory_order_relaxed));
+
+	Epoll_daemon::stop();
+	sockets.clear();
+	Bench::finalize();
+	return EXIT_SUCCESS;
+}
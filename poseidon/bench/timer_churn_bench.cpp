@@ -0,0 +1,95 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+// 测量 Timer_daemon 在大量连接不断重置超时时的开销。
+// 每个连接有一个低级计时器作为空闲超时。每毫秒随机挑选一些连接收到数据并重置超时，同时关闭并重新建立一些连接；
+// 另有一部分连接从不活动，它们的计时器按周期触发。
+// 计时器线程和本线程的 CPU 时间一并计入，因此结果包含了计时器线程维护计时器队列的开销。
+// 用法：timer_churn_bench <目录> [连接数] [每毫秒重置次数] [毫秒数]
+// 目录中须有 main.conf，与 poseidon 的参数相同。
+
+#include "../src/precompiled.hpp"
+#include "bench_util.hpp"
+#include "../src/singletons/timer_daemon.hpp"
+#include "../src/log.hpp"
+#include "../src/time.hpp"
+#include "../src/random.hpp"
+#include "../src/atomic.hpp"
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace Poseidon;
+
+namespace {
+	CONSTEXPR const boost::uint64_t g_idle_timeout = 2000;
+	CONSTEXPR const unsigned g_churn_per_ms = 10;
+	// 这个比例的连接从不活动，只会超时。
+	CONSTEXPR const unsigned g_idle_percent = 5;
+
+	volatile unsigned long g_fired = 0;
+
+	void timer_proc(const boost::shared_ptr<Timer> &/*timer*/, boost::uint64_t /*now*/, boost::uint64_t /*period*/){
+		atomic_add(g_fired, 1, memory_order_relaxed);
+	}
+}
+
+int main(int argc, char **argv){
+	if(!Bench::initialize(argc, argv, "[connections] [resets per ms] [duration in ms]")){
+		return EXIT_FAILURE;
+	}
+	const AUTO(connection_count, Bench::get_argument(argc, argv, 2, 100000ul));
+	const AUTO(resets_per_ms, Bench::get_argument(argc, argv, 3, 1000ul));
+	const AUTO(duration, Bench::get_argument(argc, argv, 4, 10000ul));
+
+	Timer_daemon::start();
+
+	::printf("connections %lu, resets per ms %lu, churn per ms %u, idle timeout %lu ms, duration %lu ms\n",
+		connection_count, resets_per_ms, g_churn_per_ms, static_cast<unsigned long>(g_idle_timeout), duration);
+
+	boost::container::vector<boost::shared_ptr<Timer> > connections(connection_count);
+	const std::size_t active_count = connection_count - connection_count * g_idle_percent / 100;
+	double t0 = get_hi_res_mono_clock();
+	for(std::size_t i = 0; i < connections.size(); ++i){
+		const boost::uint64_t period = (i < active_count) ? 0 : g_idle_timeout;
+		connections.at(i) = Timer_daemon::register_low_level_timer(g_idle_timeout, period, &timer_proc);
+	}
+	const double t_create = get_hi_res_mono_clock() - t0;
+
+	double t_reset = 0, t_churn = 0;
+	const double cpu0 = Bench::get_process_cpu_time();
+	t0 = get_hi_res_mono_clock();
+	for(unsigned long ms = 1; ms <= duration; ++ms){
+		double t1 = get_hi_res_mono_clock();
+		for(unsigned long k = 0; k < resets_per_ms; ++k){
+			Timer_daemon::set_time(connections.at(random_uint32() % active_count), g_idle_timeout);
+		}
+		double t2 = get_hi_res_mono_clock();
+		t_reset += t2 - t1;
+		for(unsigned k = 0; k < g_churn_per_ms; ++k){
+			AUTO_REF(connection, connections.at(random_uint32() % active_count));
+			connection.reset();
+			connection = Timer_daemon::register_low_level_timer(g_idle_timeout, 0, &timer_proc);
+		}
+		t1 = get_hi_res_mono_clock();
+		t_churn += t1 - t2;
+		// 模拟时钟跟随真实时钟，剩下的时间让给计时器线程。
+		const double t_next = t0 + static_cast<double>(ms);
+		if(t1 < t_next){
+			::usleep(static_cast<unsigned>((t_next - t1) * 1e3));
+		}
+	}
+	const double wall = get_hi_res_mono_clock() - t0;
+	const double cpu = Bench::get_process_cpu_time() - cpu0;
+
+	::printf("create   %12.1f ns/op\n", t_create * 1e6 / static_cast<double>(connection_count));
+	::printf("set_time %12.1f ns/op\n", t_reset * 1e6 / (static_cast<double>(duration) * static_cast<double>(resets_per_ms)));
+	::printf("churn    %12.1f ns/op\n", t_churn * 1e6 / (static_cast<double>(duration) * g_churn_per_ms));
+	::printf("fired    %12lu\n", atomic_load(g_fired, memory_order_relaxed));
+	::printf("cpu      %12.1f ms in %.1f ms (%.1f%%)\n", cpu, wall, cpu * 100 / wall);
+
+	connections.clear();
+	Timer_daemon::stop();
+	Bench::finalize();
+	return EXIT_SUCCESS;
+}
@@ -112,7 +112,7 @@ protected:
 		POSEIDON_LOG_DEBUG("Dispatching message: message_id = ", m_message_id, ", payload_len = ", m_payload.size());
 		session->on_sync_data_message(m_message_id, STD_MOVE(m_payload));
 
-		const AUTO(keep_alive_timeout, Main_config::get<boost::uint64_t>("cbpp_keep_alive_timeout", 30000));
+		const AUTO(keep_alive_timeout, Main_config::get_snapshot().cbpp_keep_alive_timeout);
 		session->set_timeout(keep_alive_timeout);
 	}
 };
@@ -137,14 +137,14 @@ protected:
 		POSEIDON_LOG_DEBUG("Dispatching control message: status_code = ", m_status_code, ", param = ", m_param);
 		session->on_sync_control_message(m_status_code, STD_MOVE(m_param));
 
-		const AUTO(keep_alive_timeout, Main_config::get<boost::uint64_t>("cbpp_keep_alive_timeout", 30000));
+		const AUTO(keep_alive_timeout, Main_config::get_snapshot().cbpp_keep_alive_timeout);
 		session->set_timeout(keep_alive_timeout);
 	}
 };
 
 Session::Session(Move<Unique_file> socket)
 	: Low_level_session(STD_MOVE(socket))
-	, m_max_request_length(Main_config::get<boost::uint64_t>("cbpp_max_request_length", 16384))
+	, m_max_request_length(Main_config::get_snapshot().cbpp_max_request_length)
 	, m_size_total(0), m_message_id(0), m_payload()
 {
 	//
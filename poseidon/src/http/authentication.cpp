@@ -393,7 +393,7 @@ std::pair<Authentication_result, const char *> check_authentication_digest(const
 		POSEIDON_LOG_DEBUG("Server ID mismatch: ", std::hex, std::setfill('0'), std::setw(8), nonce->server_id);
 		return std::make_pair(auth_password_incorrect, NULLPTR);
 	}
-	const AUTO(nonce_expiry_time, Main_config::get<boost::uint64_t>("http_digest_nonce_expiry_time", 60000));
+	const AUTO(nonce_expiry_time, Main_config::get_snapshot().http_digest_nonce_expiry_time);
 	if(nonce->timestamp < saturated_sub(get_utc_time(), nonce_expiry_time)){
 		POSEIDON_LOG_DEBUG("Nonce expired: ", nonce->timestamp);
 		return std::make_pair(auth_request_expired, NULLPTR);
@@ -75,7 +75,7 @@ void Low_level_client::on_receive(Stream_buffer data){
 void Low_level_client::on_shutdown_timer(boost::uint64_t now){
 	POSEIDON_PROFILE_ME;
 
-	// timer 线程读取需要锁。
+	// 清扫和读取数据都在同一个 epoll 线程中进行，加锁只是因为 `get_upgraded_client()` 也可能被其他线程调用。
 	const AUTO(upgraded_client, get_upgraded_client());
 	if(upgraded_client){
 		upgraded_client->on_shutdown_timer(now);
@@ -72,7 +72,7 @@ void Low_level_session::on_receive(Stream_buffer data){
 void Low_level_session::on_shutdown_timer(boost::uint64_t now){
 	POSEIDON_PROFILE_ME;
 
-	// timer 线程读取需要锁。
+	// 清扫和读取数据都在同一个 epoll 线程中进行，加锁只是因为 `get_upgraded_session()` 也可能被其他线程调用。
 	const AUTO(upgraded_session, get_upgraded_session());
 	if(upgraded_session){
 		upgraded_session->on_shutdown_timer(now);
@@ -41,7 +41,7 @@ protected:
 	void on_close(int err_code) OVERRIDE;
 	void on_receive(Stream_buffer data) OVERRIDE;
 
-	// 注意，只能在 timer 线程中调用这些函数。
+	// 注意，只能在 epoll 线程中调用这些函数。
 	void on_shutdown_timer(boost::uint64_t now) OVERRIDE;
 
 	// Server_reader
@@ -55,7 +55,7 @@ bool Server_reader::put_encoded_data(Stream_buffer encoded, bool dont_parse_get_
 			}
 			if(lf_offset < 0){
 				// 没找到换行符。
-				const AUTO(max_line_length, Main_config::get<std::size_t>("http_max_header_line_length", 8192));
+				const AUTO(max_line_length, Main_config::get_snapshot().http_max_header_line_length);
 				POSEIDON_THROW_UNLESS(m_queue.size() <= max_line_length, Exception, status_bad_request); // XXX 用一个别的状态码？
 				break;
 			}
@@ -130,7 +130,7 @@ bool Server_reader::put_encoded_data(Stream_buffer encoded, bool dont_parse_get_
 		case state_headers:
 			if(!expected.empty()){
 				const AUTO(headers, m_request_headers.headers.size());
-				const AUTO(max_headers, Main_config::get<std::size_t>("http_max_headers_per_request", 64));
+				const AUTO(max_headers, Main_config::get_snapshot().http_max_headers_per_request);
 				POSEIDON_THROW_UNLESS(headers <= max_headers, Exception, status_bad_request); // XXX 用一个别的状态码？
 
 				std::string line = expected.dump_string();
@@ -114,7 +114,7 @@ protected:
 		session->on_sync_request(STD_MOVE(m_request_headers), STD_MOVE(m_entity));
 
 		if(m_keep_alive){
-			const AUTO(keep_alive_timeout, Main_config::get<boost::uint64_t>("http_keep_alive_timeout", 5000));
+			const AUTO(keep_alive_timeout, Main_config::get_snapshot().http_keep_alive_timeout);
 			session->set_timeout(keep_alive_timeout);
 		} else {
 			session->shutdown_write();
@@ -124,7 +124,7 @@ protected:
 
 Session::Session(Move<Unique_file> socket)
 	: Low_level_session(STD_MOVE(socket))
-	, m_max_request_length(Main_config::get<boost::uint64_t>("http_max_request_length", 16384))
+	, m_max_request_length(Main_config::get_snapshot().http_max_request_length)
 	, m_size_total(0), m_request_headers()
 {
 	//
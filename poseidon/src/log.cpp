@@ -6,6 +6,7 @@
 #include "atomic.hpp"
 #include "time.hpp"
 #include "singletons/main_config.hpp"
+#include "singletons/log_daemon.hpp"
 #include "flags.hpp"
 #include <unistd.h>
 #include <sys/syscall.h>
@@ -75,6 +76,183 @@ namespace {
 
 	volatile boost::uint64_t g_mask = -1ull;
 	__thread char t_tag[5] = "----";
+
+	// 把十进制数写到 `buf` 中，返回写入的字符数。`buf` 至少要容纳 20 个字符。
+	std::size_t format_decimal(char *buf, unsigned long long val){
+		char temp[24];
+		char *const end = temp + sizeof(temp);
+		char *begin = end;
+		do {
+			*--begin = static_cast<char>('0' + val % 10);
+			val /= 10;
+		} while(val != 0);
+		const AUTO(len, static_cast<std::size_t>(end - begin));
+		std::memcpy(buf, begin, len);
+		return len;
+	}
+	// 同上，不足 `width` 位时在左侧用 `fill` 填充。
+	std::size_t format_decimal_padded(char *buf, unsigned long long val, std::size_t width, char fill){
+		char temp[24];
+		const std::size_t digits = format_decimal(temp, val);
+		std::size_t len = 0;
+		while(len + digits < width){
+			buf[len++] = fill;
+		}
+		std::memcpy(buf + len, temp, digits);
+		return len + digits;
+	}
+	bool is_plain_decimal(const std::ostream &os){
+		return ((os.flags() & (std::ios_base::basefield | std::ios_base::showpos)) == std::ios_base::dec) && (os.width() == 0);
+	}
+
+	// 打开二进制日志文件之后，DEBUG 和 TRACE 级别的日志只写入这个文件，参数不经过格式化。
+	bool is_binary_only(boost::uint64_t mask){
+		return (mask & (Logger::special_major | Logger::level_info | Logger::level_warning | Logger::level_error | Logger::level_fatal)) == 0;
+	}
+	void put_binary_string(Stream_buffer &args, Stream_buffer &text){
+		const AUTO(len32, static_cast<boost::uint32_t>(text.size()));
+		args.put(Log_daemon::binary_arg_string);
+		args.put(&len32, sizeof(len32));
+		args.splice(text);
+	}
+
+	// 标准输出和标准错误是否为终端，只检查一次。零表示尚未检查。
+	volatile int g_is_terminal[3] = { };
+
+	bool is_terminal(int fd){
+		AUTO_REF(status, g_is_terminal[fd]);
+		int value = atomic_load(status, memory_order_relaxed);
+		if(value == 0){
+			value = ::isatty(fd) ? 1 : -1;
+			atomic_store(status, value, memory_order_relaxed);
+		}
+		return value > 0;
+	}
+
+	// 每个线程缓存的日志行前缀。日期和时间精确到秒，秒数改变时才重新格式化。
+	// 线程标签、线程号和级别名（包括颜色）在线程标签改变之前不会变化。
+	struct Date_time_cache {
+		boost::uint64_t second;
+		char str[32]; // 形如 "2018-01-01 00:00:00."。
+		std::size_t len;
+	};
+	struct Line_prefix {
+		char head[16]; // 时间戳之前的部分。
+		std::size_t head_len;
+		char middle[112]; // 时间戳之后、日志内容之前的部分。
+		std::size_t middle_len; // 为零表示尚未生成。
+	};
+	__thread Date_time_cache t_date_time = { };
+	__thread Line_prefix t_prefixes[2][g_levels.static_size] = { };
+	__thread unsigned long t_tid = 0;
+
+	// `fork()` 之后子进程的线程号改变了。
+	void reset_thread_cache(){
+		t_tid = 0;
+		std::memset(t_prefixes, 0, sizeof(t_prefixes));
+	}
+	::pthread_once_t g_atfork_once = PTHREAD_ONCE_INIT;
+	void register_atfork(){
+		::pthread_atfork(NULLPTR, NULLPTR, &reset_thread_cache);
+	}
+
+	unsigned long get_thread_id(){
+		if(t_tid == 0){
+			::pthread_once(&g_atfork_once, &register_atfork);
+			t_tid = static_cast<unsigned long>(::syscall(SYS_gettid));
+		}
+		return t_tid;
+	}
+
+	const Date_time_cache & get_date_time(boost::uint64_t second){
+		AUTO_REF(cache, t_date_time);
+		if((cache.len == 0) || (cache.second != second)){
+			cache.len = format_time(cache.str, sizeof(cache.str), second * 1000, false);
+			cache.str[cache.len++] = '.';
+			cache.second = second;
+		}
+		return cache;
+	}
+
+	const Line_prefix & get_line_prefix(unsigned level, bool output_color){
+		AUTO_REF(prefix, t_prefixes[output_color][level]);
+		if(prefix.middle_len != 0){
+			return prefix;
+		}
+		const Level_element *const lc = g_levels.data() + level;
+		int flags;
+		char *str;
+		std::size_t len;
+		// Begin the timestamp in brightred (when outputting to stderr) or green (when outputting to stdout).
+		str = prefix.head;
+		len = 0;
+		if(output_color){
+			flags = lc->to_stderr ? (cfg_red | cfl_bright) : cfg_green;
+			len += begin_color(str + len, flags);
+		}
+		prefix.head_len = len;
+		// End the timestamp.
+		str = prefix.middle;
+		len = 0;
+		if(output_color){
+			len += end_color(str + len);
+		}
+		str[len++] = ' ';
+		// Append the thread tag in reverse brightyellow (when outputting to stderr) or cyan (when outputting to stdout).
+		if(output_color){
+			flags = lc->to_stderr ? (cfg_yellow | cfl_bright) : cfg_cyan;
+			flags ^= cfl_reverse;
+			len += begin_color(str + len, flags);
+		}
+		std::memcpy(str + len, t_tag, sizeof(t_tag) - 1);
+		len += sizeof(t_tag) - 1;
+		if(output_color){
+			len += end_color(str + len);
+		}
+		str[len++] = ' ';
+		// Append the thread id in brightyellow (when outputting to stderr) or cyan (when outputting to stdout).
+		if(output_color){
+			flags = lc->to_stderr ? (cfg_yellow | cfl_bright) : cfg_cyan;
+			len += begin_color(str + len, flags);
+		}
+		len += format_decimal_padded(str + len, get_thread_id(), 5, ' ');
+		if(output_color){
+			len += end_color(str + len);
+		}
+		str[len++] = ' ';
+		// Append the level name in reverse color.
+		if(output_color){
+			flags = lc->color | cfl_reverse;
+			len += begin_color(str + len, flags);
+		}
+		const std::size_t name_len = std::strlen(lc->name);
+		std::memcpy(str + len, lc->name, name_len);
+		len += name_len;
+		if(output_color){
+			len += end_color(str + len);
+		}
+		str[len++] = ' ';
+		// Begin the log data.
+		if(output_color){
+			flags = lc->color;
+			len += begin_color(str + len, flags);
+		}
+		prefix.middle_len = len;
+		return prefix;
+	}
+
+	struct Line_suffix {
+		char middle[32];
+		std::size_t middle_len;
+		char tail[8];
+		std::size_t tail_len;
+	};
+	// 日志内容之后、文件名之前的部分，以及行尾，文件名和行号为蓝色。
+	// 这些是常量初始化的，因此在其他静态对象的构造函数中写日志也是安全的。
+	CONSTEXPR const Line_suffix g_suffixes[2] = {
+		{ " ### ", 5, "\n", 1 },
+		{ "\x1B[m \x1B[34m### ", 13, "\x1B[m\n", 4 },
+	};
 }
 
 boost::uint64_t Logger::get_mask() NOEXCEPT {
@@ -131,10 +309,13 @@ const char * Logger::get_thread_tag() NOEXCEPT {
 }
 void Logger::set_thread_tag(const char *tag) NOEXCEPT {
 	::snprintf(t_tag, sizeof(t_tag), "%-*s", (int)(sizeof(t_tag) - 1), tag);
+	// 缓存的前缀包含线程标签，需要重新生成。
+	std::memset(t_prefixes, 0, sizeof(t_prefixes));
 }
 
 Logger::Logger(boost::uint64_t mask, const char *file, std::size_t line) NOEXCEPT
 	: m_mask(mask), m_file(file), m_line(line)
+	, m_binary(is_binary_only(mask) && Log_daemon::is_binary_log_enabled())
 {
 	m_stream <<std::boolalpha;
 }
@@ -142,160 +323,162 @@ Logger::~Logger() NOEXCEPT
 try {
 	const unsigned level = static_cast<unsigned>(__builtin_ctzll(m_mask | level_trace));
 	const Level_element *const lc = g_levels.data() + level;
+	const boost::uint64_t now = get_local_time();
+	if(m_binary){
+		Log_daemon::write_binary(level, m_file, m_line, now, get_thread_id(), t_tag, m_args);
+		return;
+	}
+	if(Log_daemon::is_binary_log_enabled()){
+		// 二进制日志文件中保存所有级别的日志，这里的日志内容已经格式化为文本了。
+		Stream_buffer args, text(m_stream.get_buffer());
+		put_binary_string(args, text);
+		Log_daemon::write_binary(level, m_file, m_line, now, get_thread_id(), t_tag, args);
+	}
 	const int output_fd = lc->to_stderr ? STDERR_FILENO : STDOUT_FILENO;
-	const bool output_color = ::isatty(output_fd);
+	const bool output_color = is_terminal(output_fd);
 
 	Stream_buffer buf;
-	int flags;
-	char str[256];
+	char str[64];
 	std::size_t len;
-	// Append the timestamp in brightred (when outputting to stderr) or green (when outputting to stdout).
-	if(output_color){
-		flags = lc->to_stderr ? (cfg_red | cfl_bright) : cfg_green;
-		len = begin_color(str, flags);
-		buf.put(str, len);
-	}
-	len = format_time(str, sizeof(str), get_local_time(), true);
-	buf.put(str, len);
-	if(output_color){
-		len = end_color(str);
-		buf.put(str, len);
-	}
-	buf.put(' ');
-	// Append the thread tag in reverse brightyellow (when outputting to stderr) or cyan (when outputting to stdout).
-	if(output_color){
-		flags = lc->to_stderr ? (cfg_yellow | cfl_bright) : cfg_cyan;
-		flags ^= cfl_reverse;
-		len = begin_color(str, flags);
-		buf.put(str, len);
-	}
-	buf.put(t_tag, sizeof(t_tag) - 1);
-	if(output_color){
-		len = end_color(str);
-		buf.put(str, len);
-	}
-	buf.put(' ');
-	// Append the thread id in brightyellow (when outputting to stderr) or cyan (when outputting to stdout).
-	if(output_color){
-		flags = lc->to_stderr ? (cfg_yellow | cfl_bright) : cfg_cyan;
-		len = begin_color(str, flags);
-		buf.put(str, len);
-	}
-	len = (unsigned)std::sprintf(str, "%5lu", (unsigned long)::syscall(SYS_gettid));
+	// Append the timestamp, then the cached thread tag, thread id and level name.
+	const AUTO_REF(prefix, get_line_prefix(level, output_color));
+	buf.put(prefix.head, prefix.head_len);
+	const AUTO_REF(date_time, get_date_time(now / 1000));
+	buf.put(date_time.str, date_time.len);
+	len = format_decimal_padded(str, now % 1000, 3, '0');
 	buf.put(str, len);
-	if(output_color){
-		len = end_color(str);
-		buf.put(str, len);
-	}
-	buf.put(' ');
-	// Append the level name in reverse color.
-	if(output_color){
-		flags = lc->color | cfl_reverse;
-		len = begin_color(str, flags);
-		buf.put(str, len);
-	}
-	buf.put(lc->name);
-	if(output_color){
-		len = end_color(str);
-		buf.put(str, len);
-	}
-	buf.put(' ');
+	buf.put(prefix.middle, prefix.middle_len);
 	// Append the log data.
-	if(output_color){
-		flags = lc->color;
-		len = begin_color(str, flags);
-		buf.put(str, len);
-	}
 	buf.splice(m_stream.get_buffer());
-	if(output_color){
-		len = end_color(str);
-		buf.put(str, len);
-	}
-	buf.put(' ');
-	// Append the file name and line number in blue.
-	if(output_color){
-		flags = cfg_blue;
-		len = begin_color(str, flags);
-		buf.put(str, len);
-	}
-	buf.put("### ");
+	// Append the file name and line number, then end this line of log.
+	const AUTO_REF(suffix, g_suffixes[output_color]);
+	buf.put(suffix.middle, suffix.middle_len);
 	buf.put(m_file);
-	len = (unsigned)std::sprintf(str, ":%lu", (unsigned long)m_line);
+	str[0] = ':';
+	len = 1 + format_decimal(str + 1, m_line);
 	buf.put(str, len);
-	// Restore the color and end this line of log.
-	if(output_color){
-		len = end_color(str);
-		buf.put(str, len);
-	}
-	buf.put('\n');
+	buf.put(suffix.tail, suffix.tail_len);
 
-	static ::pthread_mutex_t s_mutex = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
-	int err_code = ::pthread_mutex_lock(&s_mutex);
-	(void)err_code;
-	assert(err_code == 0);
-	for(;;){
-		len = buf.peek(str, sizeof(str));
-		if(len == 0){
-			break;
-		}
-		::ssize_t written = ::write(output_fd, str, len);
-		if(written <= 0){
-			break;
-		}
-		buf.discard(static_cast<std::size_t>(written));
-	}
-	err_code = ::pthread_mutex_unlock(&s_mutex);
-	assert(err_code == 0);
+	// FATAL 和 ERROR 级别的日志之后进程可能很快就崩溃了，因此连同积压的日志一起同步写出；WARN 及以上级别的日志不会被丢弃。
+	Log_daemon::write(output_fd, buf, !lc->to_stderr, level <= 1);
 } catch(...){
 	return;
 }
 
+void Logger::flush_text_argument(){
+	AUTO_REF(text, m_stream.get_buffer());
+	if(text.empty()){
+		return;
+	}
+	put_binary_string(m_args, text);
+	text.clear();
+}
+
 void Logger::put(bool val){
+	if(m_binary){
+		m_args.put(Log_daemon::binary_arg_bool);
+		m_args.put(val);
+		return;
+	}
 	m_stream <<val;
 }
 void Logger::put(char val){
+	if(m_binary){
+		m_args.put(Log_daemon::binary_arg_char);
+		m_args.put(static_cast<unsigned char>(val));
+		return;
+	}
 	m_stream <<val;
 }
 void Logger::put(signed char val){
-	m_stream <<static_cast<int>(val);
+	put(static_cast<long long>(val));
 }
 void Logger::put(unsigned char val){
-	m_stream <<static_cast<unsigned>(val);
+	put(static_cast<unsigned long long>(val));
 }
 void Logger::put(short val){
-	m_stream <<static_cast<int>(val);
+	put(static_cast<long long>(val));
 }
 void Logger::put(unsigned short val){
-	m_stream <<static_cast<unsigned>(val);
+	put(static_cast<unsigned long long>(val));
 }
 void Logger::put(int val){
-	m_stream <<val;
+	put(static_cast<long long>(val));
 }
 void Logger::put(unsigned val){
-	m_stream <<val;
+	put(static_cast<unsigned long long>(val));
 }
 void Logger::put(long val){
-	m_stream <<val;
+	put(static_cast<long long>(val));
 }
 void Logger::put(unsigned long val){
-	m_stream <<val;
+	put(static_cast<unsigned long long>(val));
 }
 void Logger::put(long long val){
-	m_stream <<val;
+	if(!is_plain_decimal(m_stream)){
+		m_stream <<val;
+		if(m_binary){
+			flush_text_argument();
+		}
+		return;
+	}
+	if(m_binary){
+		const AUTO(val64, static_cast<boost::int64_t>(val));
+		m_args.put(Log_daemon::binary_arg_signed);
+		m_args.put(&val64, sizeof(val64));
+		return;
+	}
+	char str[32];
+	std::size_t len = 0;
+	if(val < 0){
+		str[len++] = '-';
+	}
+	// 对于最小的负数，取反之后的无符号数依然是正确的。
+	const AUTO(abs, (val < 0) ? (0 - static_cast<unsigned long long>(val)) : static_cast<unsigned long long>(val));
+	len += format_decimal(str + len, abs);
+	m_stream.write(str, static_cast<std::streamsize>(len));
 }
 void Logger::put(unsigned long long val){
-	m_stream <<val;
+	if(!is_plain_decimal(m_stream)){
+		m_stream <<val;
+		if(m_binary){
+			flush_text_argument();
+		}
+		return;
+	}
+	if(m_binary){
+		const AUTO(val64, static_cast<boost::uint64_t>(val));
+		m_args.put(Log_daemon::binary_arg_unsigned);
+		m_args.put(&val64, sizeof(val64));
+		return;
+	}
+	char str[32];
+	const std::size_t len = format_decimal(str, val);
+	m_stream.write(str, static_cast<std::streamsize>(len));
 }
 void Logger::put(const char *val){
+	if(m_binary){
+		const AUTO(len32, static_cast<boost::uint32_t>(val ? std::strlen(val) : 0));
+		m_args.put(Log_daemon::binary_arg_string);
+		m_args.put(&len32, sizeof(len32));
+		m_args.put(val, len32);
+		return;
+	}
 	m_stream <<val;
 }
 void Logger::put(const signed char *val){
-	m_stream <<static_cast<const void *>(val);
+	put(static_cast<const void *>(val));
 }
 void Logger::put(const unsigned char *val){
-	m_stream <<static_cast<const void *>(val);
+	put(static_cast<const void *>(val));
 }
 void Logger::put(const void *val){
+	if(m_binary){
+		const AUTO(val64, static_cast<boost::uint64_t>(reinterpret_cast<std::size_t>(val)));
+		m_args.put(Log_daemon::binary_arg_pointer);
+		m_args.put(&val64, sizeof(val64));
+		return;
+	}
 	m_stream <<val;
 }
 
@@ -43,8 +43,11 @@ private:
 	const boost::uint64_t m_mask;
 	const char *const m_file;
 	const std::size_t m_line;
+	// 为 true 时参数按类型原样保存在 `m_args` 中，由 `Log_daemon` 写入二进制日志文件，不经过格式化。
+	const bool m_binary;
 
 	Buffer_ostream m_stream;
+	Stream_buffer m_args;
 
 public:
 	Logger(boost::uint64_t mask, const char *file, std::size_t line) NOEXCEPT;
@@ -72,8 +75,14 @@ private:
 	template<typename T>
 	void put(const T &val){
 		m_stream <<val;
+		if(m_binary){
+			flush_text_argument();
+		}
 	}
 
+	// 二进制模式下，把 `m_stream` 中已经格式化的文本作为一个字符串参数移入 `m_args`。
+	void flush_text_argument();
+
 public:
 	template<typename T>
 	Logger & operator,(const T &val) NOEXCEPT
@@ -13,6 +13,7 @@
 #include "singletons/module_depository.hpp"
 #include "singletons/event_dispatcher.hpp"
 #include "singletons/filesystem_daemon.hpp"
+#include "singletons/log_daemon.hpp"
 #include "singletons/profile_depository.hpp"
 #include "singletons/simple_http_client_daemon.hpp"
 #ifdef POSEIDON_ENABLE_MYSQL
@@ -32,6 +33,7 @@
 #include "checked_arithmetic.hpp"
 #include "system_http_servlet_base.hpp"
 #include "json.hpp"
+#include "stream_buffer.hpp"
 #include <signal.h>
 #include <unistd.h>
 #include <stdio.h>
@@ -143,6 +145,8 @@ namespace {
 			resp.set(Rcnts::view("mask_old"), mask_old.to_string());
 			// .mask_new = current log mask
 			resp.set(Rcnts::view("mask_new"), mask_new.to_string());
+			// .dropped_lines = number of lines of logs discarded because buffers were full
+			resp.set(Rcnts::view("dropped_lines"), Log_daemon::get_dropped_line_count());
 		}
 	};
 
@@ -178,6 +182,72 @@ namespace {
 		}
 	};
 
+	struct System_http_servlet_stream_buffer : public System_http_servlet_base {
+		const char * get_uri() const FINAL {
+			return "/poseidon/stream_buffer";
+		}
+		void handle_get(Json_object &resp) const FINAL {
+			resp.set(Rcnts::view("description"), "Retreive statistics about the chunk pool used by stream buffers in this process.");
+			static const char *const s_param_info[][2] = {
+				{ NULLPTR }
+			};
+			resp.set(Rcnts::view("parameters"), make_help(s_param_info));
+		}
+		void handle_post(Json_object &resp, Json_object /*req*/) const FINAL {
+			// .pool = statistics of each size class.
+			boost::container::vector<Stream_buffer::Pool_snapshot_element> snapshot;
+			Stream_buffer::snapshot_pool(snapshot);
+			Json_array arr;
+			for(AUTO(it, snapshot.begin()); it != snapshot.end(); ++it){
+				const AUTO_REF(elem, *it);
+				Json_object obj;
+				obj.set(Rcnts::view("chunk_capacity"), elem.chunk_capacity);
+				obj.set(Rcnts::view("oversized"), elem.oversized);
+				obj.set(Rcnts::view("thread_cache_hits"), elem.thread_cache_hits);
+				obj.set(Rcnts::view("depot_hits"), elem.depot_hits);
+				obj.set(Rcnts::view("heap_allocations"), elem.heap_allocations);
+				obj.set(Rcnts::view("heap_deallocations"), elem.heap_deallocations);
+				obj.set(Rcnts::view("depot_count"), elem.depot_count);
+				arr.push_back(STD_MOVE_IDN(obj));
+			}
+			resp.set(Rcnts::view("pool"), STD_MOVE_IDN(arr));
+		}
+	};
+
+	struct System_http_servlet_fiber_stacks : public System_http_servlet_base {
+		const char * get_uri() const FINAL {
+			return "/poseidon/fiber_stacks";
+		}
+		void handle_get(Json_object &resp) const FINAL {
+			resp.set(Rcnts::view("description"), "Retreive statistics about fiber stacks of each job dispatcher thread in this process.");
+			static const char *const s_param_info[][2] = {
+				{ NULLPTR }
+			};
+			resp.set(Rcnts::view("parameters"), make_help(s_param_info));
+		}
+		void handle_post(Json_object &resp, Json_object /*req*/) const FINAL {
+			// .pools = stack pools of all job dispatcher threads.
+			boost::container::vector<Job_dispatcher::Stack_pool_snapshot_element> snapshot;
+			Job_dispatcher::snapshot_stack_pools(snapshot);
+			Json_array arr;
+			for(AUTO(it, snapshot.begin()); it != snapshot.end(); ++it){
+				const AUTO_REF(elem, *it);
+				Json_object obj;
+				obj.set(Rcnts::view("thread_index"), elem.thread_index);
+				obj.set(Rcnts::view("stack_size"), elem.stack_size);
+				obj.set(Rcnts::view("stacks_in_use"), elem.stacks_in_use);
+				obj.set(Rcnts::view("stacks_pooled"), elem.stacks_pooled);
+				obj.set(Rcnts::view("stacks_mapped"), elem.stacks_mapped);
+				obj.set(Rcnts::view("stacks_unmapped"), elem.stacks_unmapped);
+				obj.set(Rcnts::view("pool_hits"), elem.pool_hits);
+				obj.set(Rcnts::view("stacks_trimmed"), elem.stacks_trimmed);
+				obj.set(Rcnts::view("address_space"), elem.address_space);
+				arr.push_back(STD_MOVE_IDN(obj));
+			}
+			resp.set(Rcnts::view("pools"), STD_MOVE_IDN(arr));
+		}
+	};
+
 	struct System_http_servlet_profiler : public System_http_servlet_base {
 		const char * get_uri() const FINAL {
 			return "/poseidon/profiler";
@@ -186,6 +256,8 @@ namespace {
 			resp.set(Rcnts::view("description"), "View profiling information that has been collected within this process.");
 			static const char *const s_param_info[][2] = {
 				{ "clear", "If set to `true`, all data will be purged." },
+				{ "reset_latency", "If set to `true`, latency histograms will be purged and a new window will be started.\n"
+				                   "Other counters are not affected." },
 				{ NULLPTR }
 			};
 			resp.set(Rcnts::view("parameters"), make_help(s_param_info));
@@ -202,10 +274,28 @@ namespace {
 				}
 			}
 
+			bool reset_latency = false;
+			if(req.has("reset_latency")){
+				try {
+					reset_latency = req.get("reset_latency").get<bool>();
+				} catch(std::exception &e){
+					POSEIDON_LOG_WARNING("std::exception thrown: ", e.what());
+					resp.set(Rcnts::view("error"), "Invalid parameter `reset_latency`: It shall be a `Boolean`.");
+					return;
+				}
+			}
+
 			if(clear){
 				Profile_depository::clear();
 			}
+			if(reset_latency){
+				Profile_depository::reset_latency_window();
+			}
 
+			// .sample_interval = number of calls represented by each timed call.
+			resp.set(Rcnts::view("sample_interval"), Profile_depository::get_sample_interval());
+			// .latency_window = milliseconds since the latency window was started.
+			resp.set(Rcnts::view("latency_window"), get_hi_res_mono_clock() - Profile_depository::get_latency_window_start());
 			// .profile = all profile data.
 			boost::container::vector<Profile_depository::Snapshot_element> snapshot;
 			Profile_depository::snapshot(snapshot);
@@ -219,6 +309,12 @@ namespace {
 				obj.set(Rcnts::view("samples"), elem.samples);
 				obj.set(Rcnts::view("total"), elem.total);
 				obj.set(Rcnts::view("exclusive"), elem.exclusive);
+				obj.set(Rcnts::view("latency_samples"), elem.latency_samples);
+				obj.set(Rcnts::view("latency_p50"), elem.latency_p50);
+				obj.set(Rcnts::view("latency_p90"), elem.latency_p90);
+				obj.set(Rcnts::view("latency_p99"), elem.latency_p99);
+				obj.set(Rcnts::view("latency_p999"), elem.latency_p999);
+				obj.set(Rcnts::view("latency_max"), elem.latency_max);
 				arr.push_back(STD_MOVE_IDN(obj));
 			}
 			resp.set(Rcnts::view("profile"), STD_MOVE_IDN(arr));
@@ -419,9 +515,11 @@ int main(int argc, char **argv, char **/*envp*/){
 			Main_config::set_run_path(new_wd);
 		}
 		Main_config::reload();
+		Stream_buffer::initialize_pool_from_config();
 
 #define START(x_)   const Raii_singleton_runner<x_> POSEIDON_UNIQUE_NAME
 
+		START(Log_daemon);
 		START(Profile_depository);
 #ifdef POSEIDON_ENABLE_MAGIC
 		START(Magic_daemon);
@@ -449,6 +547,8 @@ int main(int argc, char **argv, char **/*envp*/){
 		system_http_servlets.push_back(System_http_server::register_servlet(boost::make_shared<System_http_servlet_help>()));
 		system_http_servlets.push_back(System_http_server::register_servlet(boost::make_shared<System_http_servlet_logger>()));
 		system_http_servlets.push_back(System_http_server::register_servlet(boost::make_shared<System_http_servlet_network>()));
+		system_http_servlets.push_back(System_http_server::register_servlet(boost::make_shared<System_http_servlet_stream_buffer>()));
+		system_http_servlets.push_back(System_http_server::register_servlet(boost::make_shared<System_http_servlet_fiber_stacks>()));
 		system_http_servlets.push_back(System_http_server::register_servlet(boost::make_shared<System_http_servlet_profiler>()));
 		system_http_servlets.push_back(System_http_server::register_servlet(boost::make_shared<System_http_servlet_modules>()));
 
@@ -33,6 +33,21 @@ namespace {
 		}
 	};
 
+	struct Statement_closer {
+		CONSTEXPR ::MYSQL_STMT * operator()() const NOEXCEPT {
+			return NULLPTR;
+		}
+		void operator()(::MYSQL_STMT *stmt) const NOEXCEPT {
+			::mysql_stmt_close(stmt);
+		}
+	};
+
+	struct Prepared_statement : NONCOPYABLE {
+		std::string sql;
+		Unique_handle<Statement_closer> stmt;
+		boost::container::vector< ::MYSQL_BIND> binds;
+	};
+
 	struct Field_comparator {
 		bool operator()(const char *lhs, const char *rhs) const NOEXCEPT {
 			return std::strcmp(lhs, rhs) < 0;
@@ -50,6 +65,9 @@ namespace {
 		::MYSQL_ROW m_row;
 		unsigned long *m_lengths;
 
+		boost::container::flat_map<const void *, boost::shared_ptr<Prepared_statement> > m_statements;
+		mutable boost::container::flat_map<const void *, boost::container::vector<std::size_t> > m_columns;
+
 	public:
 		Delegated_connection(const char *server_addr, boost::uint16_t server_port, const char *user_name, const char *password, const char *schema, bool use_ssl, const char *charset)
 			: m_schema(schema)
@@ -70,24 +88,23 @@ namespace {
 		}
 
 	private:
-		bool find_field_and_check(const char *&data, std::size_t &size, const char *name) const {
+		bool find_field_and_check(const char *&data, std::size_t &size, std::size_t index) const {
 			POSEIDON_PROFILE_ME;
 
 			if(!m_row){
 				POSEIDON_LOG_WARNING("No more results available.");
 				return false;
 			}
-			const AUTO(it, m_fields.find(name));
-			if(it == m_fields.end()){
-				POSEIDON_LOG_WARNING("Field not found: name = ", name);
+			if(index >= m_fields.size()){
+				// 按名字查找时已经有警告了。
 				return false;
 			}
-			data = m_row[it->second];
+			data = m_row[index];
 			if(!data){
-				POSEIDON_LOG_DEBUG("Field is `null`: name = ", name);
+				POSEIDON_LOG_DEBUG("Field is `null`: index = ", index);
 				return false;
 			}
-			size = m_lengths[it->second];
+			size = m_lengths[index];
 			return true;
 		}
 
@@ -118,10 +135,69 @@ namespace {
 
 			m_result.reset();
 			m_fields.clear();
+			m_columns.clear();
 			m_row = NULLPTR;
 			m_lengths = NULLPTR;
 		}
 
+		void execute_prepared(const std::string &sql, const Param_vector &params) OVERRIDE {
+			POSEIDON_PROFILE_ME;
+
+			discard_result();
+
+			boost::shared_ptr<Prepared_statement> statement;
+			const AUTO(it, m_statements.find(sql.data()));
+			if((it != m_statements.end()) && (it->second->sql == sql)){
+				statement = it->second;
+			} else {
+				POSEIDON_LOG_DEBUG("Preparing MySQL statement: ", sql);
+				statement = boost::make_shared<Prepared_statement>();
+				statement->sql = sql;
+				POSEIDON_THROW_UNLESS(statement->stmt.reset(::mysql_stmt_init(m_mysql.get())), Exception, m_schema, ::mysql_errno(m_mysql.get()), Rcnts(::mysql_error(m_mysql.get())));
+				POSEIDON_THROW_UNLESS(::mysql_stmt_prepare(statement->stmt.get(), sql.data(), sql.size()) == 0, Exception, m_schema, ::mysql_stmt_errno(statement->stmt.get()), Rcnts(::mysql_stmt_error(statement->stmt.get())));
+				statement->binds.resize(::mysql_stmt_param_count(statement->stmt.get()));
+				m_statements[sql.data()] = statement;
+			}
+			POSEIDON_THROW_UNLESS(statement->binds.size() == params.size(), Basic_exception, Rcnts::view("Number of parameters mismatch"));
+
+			for(std::size_t i = 0; i < params.size(); ++i){
+				const AUTO_REF(param, params.at(i));
+				AUTO_REF(bind, statement->binds.at(i));
+				std::memset(&bind, 0, sizeof(bind));
+				switch(param.type){
+				case Param::type_null:
+					bind.buffer_type = MYSQL_TYPE_NULL;
+					break;
+				case Param::type_signed:
+				case Param::type_unsigned:
+					bind.buffer_type = MYSQL_TYPE_LONGLONG;
+					bind.buffer = const_cast<boost::uint64_t *>(&(param.integer));
+					bind.is_unsigned = (param.type == Param::type_unsigned);
+					break;
+				case Param::type_double:
+					bind.buffer_type = MYSQL_TYPE_DOUBLE;
+					bind.buffer = const_cast<double *>(&(param.number));
+					break;
+				case Param::type_string:
+				case Param::type_blob:
+					bind.buffer_type = (param.type == Param::type_blob) ? MYSQL_TYPE_BLOB : MYSQL_TYPE_STRING;
+					bind.buffer = const_cast<char *>(param.bytes.data());
+					bind.buffer_length = param.bytes.size();
+					break;
+				default:
+					POSEIDON_THROW(Basic_exception, Rcnts::view("Unknown parameter type"));
+				}
+			}
+			POSEIDON_LOG_DEBUG("Executing prepared statement: ", sql);
+			if((::mysql_stmt_bind_param(statement->stmt.get(), statement->binds.data()) != 0) || (::mysql_stmt_execute(statement->stmt.get()) != 0)){
+				const AUTO(err_code, ::mysql_stmt_errno(statement->stmt.get()));
+				Rcnts err_msg(::mysql_stmt_error(statement->stmt.get()));
+				// 连接重建之后语句句柄失效，丢弃之后重新准备。
+				m_statements.erase(sql.data());
+				POSEIDON_THROW(Exception, m_schema, err_code, STD_MOVE(err_msg));
+			}
+		}
+
 		boost::uint64_t get_insert_id() const OVERRIDE {
 			return ::mysql_insert_id(m_mysql.get());
 		}
@@ -144,105 +220,130 @@ namespace {
 			return true;
 		}
 
-		bool get_boolean(const char *name) const OVERRIDE {
+		std::size_t get_column_index(const char *name) const OVERRIDE {
+			POSEIDON_PROFILE_ME;
+
+			const AUTO(it, m_fields.find(name));
+			if(it == m_fields.end()){
+				POSEIDON_LOG_WARNING("Field not found: name = ", name);
+				return npos;
+			}
+			return it->second;
+		}
+		const std::size_t * resolve_columns(const void *key, const char *const *names, std::size_t count) const OVERRIDE {
+			POSEIDON_PROFILE_ME;
+
+			AUTO(it, m_columns.find(key));
+			if(it == m_columns.end()){
+				boost::container::vector<std::size_t> indices;
+				indices.reserve(count);
+				for(std::size_t i = 0; i < count; ++i){
+					indices.push_back(get_column_index(names[i]));
+				}
+				it = m_columns.emplace(key, STD_MOVE(indices)).first;
+			}
+			return it->second.data();
+		}
+
+		bool get_boolean(std::size_t index) const OVERRIDE {
 			POSEIDON_PROFILE_ME;
-			POSEIDON_LOG_TRACE("Getting field as `boolean`: ", name);
+			POSEIDON_LOG_TRACE("Getting field as `boolean`: index = ", index);
 
 			bool value = false;
 			const char *data;
 			std::size_t size;
-			if(find_field_and_check(data, size, name)){
+			if(find_field_and_check(data, size, index)){
 				value = (size != 0) && (std::strcmp(data, "0") != 0);
 			}
 			return value;
 		}
-		boost::int64_t get_signed(const char *name) const OVERRIDE {
+		boost::int64_t get_signed(std::size_t index) const OVERRIDE {
 			POSEIDON_PROFILE_ME;
-			POSEIDON_LOG_TRACE("Getting field as `signed`: ", name);
+			POSEIDON_LOG_TRACE("Getting field as `signed`: index = ", index);
 
 			boost::int64_t value = 0;
 			const char *data;
 			std::size_t size;
-			if(find_field_and_check(data, size, name)){
+			if(find_field_and_check(data, size, index)){
 				char *eptr;
 				value = ::strtoll(data, &eptr, 0);
 				POSEIDON_THROW_UNLESS(*eptr == 0, Basic_exception, Rcnts::view("Could not convert field data to `long long`"));
 			}
 			return value;
 		}
-		boost::uint64_t get_unsigned(const char *name) const OVERRIDE {
+		boost::uint64_t get_unsigned(std::size_t index) const OVERRIDE {
 			POSEIDON_PROFILE_ME;
-			POSEIDON_LOG_TRACE("Getting field as `unsigned`: ", name);
+			POSEIDON_LOG_TRACE("Getting field as `unsigned`: index = ", index);
 
 			boost::uint64_t value = 0;
 			const char *data;
 			std::size_t size;
-			if(find_field_and_check(data, size, name)){
+			if(find_field_and_check(data, size, index)){
 				char *eptr;
 				value = ::strtoull(data, &eptr, 0);
 				POSEIDON_THROW_UNLESS(*eptr == 0, Basic_exception, Rcnts::view("Could not convert field data to `unsigned long long`"));
 			}
 			return value;
 		}
-		double get_double(const char *name) const OVERRIDE {
+		double get_double(std::size_t index) const OVERRIDE {
 			POSEIDON_PROFILE_ME;
-			POSEIDON_LOG_TRACE("Getting field as `double`: ", name);
+			POSEIDON_LOG_TRACE("Getting field as `double`: index = ", index);
 
 			double value = 0;
 			const char *data;
 			std::size_t size;
-			if(find_field_and_check(data, size, name)){
+			if(find_field_and_check(data, size, index)){
 				char *eptr;
 				value = ::strtod(data, &eptr);
 				POSEIDON_THROW_UNLESS(*eptr == 0, Basic_exception, Rcnts::view("Could not convert field data to `double`"));
 			}
 			return value;
 		}
-		std::string get_string(const char *name) const OVERRIDE {
+		std::string get_string(std::size_t index) const OVERRIDE {
 			POSEIDON_PROFILE_ME;
-			POSEIDON_LOG_TRACE("Getting field as `string`: ", name);
+			POSEIDON_LOG_TRACE("Getting field as `string`: index = ", index);
 
 			std::string value;
 			const char *data;
 			std::size_t size;
-			if(find_field_and_check(data, size, name)){
+			if(find_field_and_check(data, size, index)){
 				value.assign(data, size);
 			}
 			return value;
 		}
-		boost::uint64_t get_datetime(const char *name) const OVERRIDE {
+		boost::uint64_t get_datetime(std::size_t index) const OVERRIDE {
 			POSEIDON_PROFILE_ME;
-			POSEIDON_LOG_TRACE("Getting field as `datetime`: ", name);
+			POSEIDON_LOG_TRACE("Getting field as `datetime`: index = ", index);
 
 			boost::uint64_t value = 0;
 			const char *data;
 			std::size_t size;
-			if(find_field_and_check(data, size, name)){
+			if(find_field_and_check(data, size, index)){
 				value = scan_time(data);
 			}
 			return value;
 		}
-		Uuid get_uuid(const char *name) const OVERRIDE {
+		Uuid get_uuid(std::size_t index) const OVERRIDE {
 			POSEIDON_PROFILE_ME;
-			POSEIDON_LOG_TRACE("Getting field as `uuid`: ", name);
+			POSEIDON_LOG_TRACE("Getting field as `uuid`: index = ", index);
 
 			Uuid value;
 			const char *data;
 			std::size_t size;
-			if(find_field_and_check(data, size, name)){
+			if(find_field_and_check(data, size, index)){
 				POSEIDON_THROW_UNLESS(size == 36, Basic_exception, Rcnts::view("Invalid UUID string length"));
 				value.from_string(*reinterpret_cast<const char (*)[36]>(data));
 			}
 			return value;
 		}
-		Stream_buffer get_blob(const char *name) const OVERRIDE {
+		Stream_buffer get_blob(std::size_t index) const OVERRIDE {
 			POSEIDON_PROFILE_ME;
-			POSEIDON_LOG_TRACE("Getting field as `blob`: ", name);
+			POSEIDON_LOG_TRACE("Getting field as `blob`: index = ", index);
 
 			Stream_buffer value;
 			const char *data;
 			std::size_t size;
-			if(find_field_and_check(data, size, name)){
+			if(find_field_and_check(data, size, index)){
 				value.put(data, size);
 			}
 			return value;
@@ -7,16 +7,38 @@
 #include "../cxx_ver.hpp"
 #include "../cxx_util.hpp"
 #include "../uuid.hpp"
-#include "../fwd.hpp"
+#include "../stream_buffer.hpp"
 #include <string>
 #include <cstring>
 #include <boost/cstdint.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/container/vector.hpp>
 
 namespace Poseidon {
 namespace Mysql {
 
 class Connection : NONCOPYABLE {
+public:
+	// 预处理语句的参数。`integer` 用于有符号和无符号整数，`bytes` 用于字符串和二进制数据。
+	struct Param {
+		enum Type {
+			type_null,
+			type_signed,
+			type_unsigned,
+			type_double,
+			type_string,
+			type_blob
+		};
+
+		Type type;
+		boost::uint64_t integer;
+		double number;
+		std::string bytes;
+	};
+	typedef boost::container::vector<Param> Param_vector;
+
+	static const std::size_t npos = static_cast<std::size_t>(-1);
+
 public:
 	static boost::shared_ptr<Connection> create(const char *server_addr, boost::uint16_t server_port, const char *user_name, const char *password, const char *schema, bool use_ssl, const char *charset);
 
@@ -26,18 +48,53 @@ public:
 public:
 	virtual void execute_sql_explicit(const char *sql, std::size_t len) = 0;
 	virtual void discard_result() NOEXCEPT = 0;
+	// 以二进制协议执行不返回结果集的预处理语句，参数依次绑定到语句中的 `?` 上。
+	// 语句按 `sql` 的地址缓存在连接中（命中时再比较内容），因此 `sql` 应当长期存在，例如每个类一份的静态字符串。
+	// 出错时丢弃，下次使用时重新准备。
+	virtual void execute_prepared(const std::string &sql, const Param_vector &params) = 0;
 
 	virtual boost::uint64_t get_insert_id() const = 0;
 	virtual bool fetch_row() = 0;
 
-	virtual bool get_boolean(const char *name) const = 0;
-	virtual boost::int64_t get_signed(const char *name) const = 0;
-	virtual boost::uint64_t get_unsigned(const char *name) const = 0;
-	virtual double get_double(const char *name) const = 0;
-	virtual std::string get_string(const char *name) const = 0;
-	virtual boost::uint64_t get_datetime(const char *name) const = 0;
-	virtual Uuid get_uuid(const char *name) const = 0;
-	virtual Stream_buffer get_blob(const char *name) const = 0;
+	// 返回当前结果集中列的序号，没有这一列时返回 `npos`。
+	virtual std::size_t get_column_index(const char *name) const = 0;
+	// 一次解析多个列名，返回的序号数组按 `key` 缓存，直到执行下一条语句为止。
+	// `key` 通常是调用者保存列名的静态数组的地址。
+	virtual const std::size_t * resolve_columns(const void *key, const char *const *names, std::size_t count) const = 0;
+
+	virtual bool get_boolean(std::size_t index) const = 0;
+	virtual boost::int64_t get_signed(std::size_t index) const = 0;
+	virtual boost::uint64_t get_unsigned(std::size_t index) const = 0;
+	virtual double get_double(std::size_t index) const = 0;
+	virtual std::string get_string(std::size_t index) const = 0;
+	virtual boost::uint64_t get_datetime(std::size_t index) const = 0;
+	virtual Uuid get_uuid(std::size_t index) const = 0;
+	virtual Stream_buffer get_blob(std::size_t index) const = 0;
+
+	bool get_boolean(const char *name) const {
+		return get_boolean(get_column_index(name));
+	}
+	boost::int64_t get_signed(const char *name) const {
+		return get_signed(get_column_index(name));
+	}
+	boost::uint64_t get_unsigned(const char *name) const {
+		return get_unsigned(get_column_index(name));
+	}
+	double get_double(const char *name) const {
+		return get_double(get_column_index(name));
+	}
+	std::string get_string(const char *name) const {
+		return get_string(get_column_index(name));
+	}
+	boost::uint64_t get_datetime(const char *name) const {
+		return get_datetime(get_column_index(name));
+	}
+	Uuid get_uuid(const char *name) const {
+		return get_uuid(get_column_index(name));
+	}
+	Stream_buffer get_blob(const char *name) const {
+		return get_blob(get_column_index(name));
+	}
 
 	void execute_sql(const char *sql, std::size_t len){
 		execute_sql_explicit(sql, len);
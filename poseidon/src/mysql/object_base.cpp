@@ -7,6 +7,7 @@
 #include "../singletons/mysql_daemon.hpp"
 #include "../atomic.hpp"
 #include "../log.hpp"
+#include "../time.hpp"
 
 namespace Poseidon {
 namespace Mysql {
@@ -23,6 +24,87 @@ Object_base::~Object_base(){
 	//
 }
 
+void Object_base::push_sql_param(Connection::Param_vector &params, bool value){
+	params.emplace_back();
+	AUTO_REF(param, params.back());
+	param.type = Connection::Param::type_signed;
+	param.integer = value;
+}
+void Object_base::push_sql_param(Connection::Param_vector &params, boost::int64_t value){
+	params.emplace_back();
+	AUTO_REF(param, params.back());
+	param.type = Connection::Param::type_signed;
+	param.integer = static_cast<boost::uint64_t>(value);
+}
+void Object_base::push_sql_param(Connection::Param_vector &params, boost::uint64_t value){
+	params.emplace_back();
+	AUTO_REF(param, params.back());
+	param.type = Connection::Param::type_unsigned;
+	param.integer = value;
+}
+void Object_base::push_sql_param(Connection::Param_vector &params, double value){
+	params.emplace_back();
+	AUTO_REF(param, params.back());
+	param.type = Connection::Param::type_double;
+	param.number = value;
+}
+void Object_base::push_sql_param(Connection::Param_vector &params, const std::string &value){
+	params.emplace_back();
+	AUTO_REF(param, params.back());
+	param.type = Connection::Param::type_string;
+	param.bytes = value;
+}
+void Object_base::push_sql_param(Connection::Param_vector &params, const Uuid &value){
+	params.emplace_back();
+	AUTO_REF(param, params.back());
+	param.type = Connection::Param::type_string;
+	param.bytes = value.to_string();
+}
+void Object_base::push_sql_param(Connection::Param_vector &params, const std::basic_string<unsigned char> &value){
+	params.emplace_back();
+	AUTO_REF(param, params.back());
+	param.type = Connection::Param::type_blob;
+	param.bytes.assign(value.begin(), value.end());
+}
+void Object_base::push_sql_datetime_param(Connection::Param_vector &params, boost::uint64_t value){
+	char str[256];
+	const std::size_t len = format_time(str, sizeof(str), value, true);
+	params.emplace_back();
+	AUTO_REF(param, params.back());
+	param.type = Connection::Param::type_string;
+	param.bytes.assign(str, len);
+}
+
+std::string Object_base::build_sql_columns(const char *const *names, std::size_t count){
+	std::string columns;
+	for(std::size_t i = 0; i < count; ++i){
+		if(i != 0){
+			columns += ", ";
+		}
+		columns += '`';
+		columns += names[i];
+		columns += '`';
+	}
+	return columns;
+}
+std::string Object_base::build_sql_prepared_statement(bool to_replace, const char *table, const std::string &columns, std::size_t count){
+	std::string sql;
+	sql += to_replace ? "REPLACE" : "INSERT";
+	sql += " INTO `";
+	sql += table;
+	sql += "` (";
+	sql += columns;
+	sql += ") VALUES (";
+	for(std::size_t i = 0; i < count; ++i){
+		if(i != 0){
+			sql += ", ";
+		}
+		sql += '?';
+	}
+	sql += ')';
+	return sql;
+}
+
 bool Object_base::is_auto_saving_enabled() const NOEXCEPT {
 	return atomic_load(m_auto_saves, memory_order_consume);
 }
@@ -37,6 +37,19 @@ private:
 	mutable volatile bool m_auto_saves;
 	mutable void *volatile m_combined_write_stamp;
 
+protected:
+	static void push_sql_param(Connection::Param_vector &params, bool value);
+	static void push_sql_param(Connection::Param_vector &params, boost::int64_t value);
+	static void push_sql_param(Connection::Param_vector &params, boost::uint64_t value);
+	static void push_sql_param(Connection::Param_vector &params, double value);
+	static void push_sql_param(Connection::Param_vector &params, const std::string &value);
+	static void push_sql_param(Connection::Param_vector &params, const Uuid &value);
+	static void push_sql_param(Connection::Param_vector &params, const std::basic_string<unsigned char> &value);
+	static void push_sql_datetime_param(Connection::Param_vector &params, boost::uint64_t value);
+
+	static std::string build_sql_columns(const char *const *names, std::size_t count);
+	static std::string build_sql_prepared_statement(bool to_replace, const char *table, const std::string &columns, std::size_t count);
+
 protected:
 	mutable Recursive_mutex m_mutex;
 
@@ -61,6 +74,13 @@ public:
 
 	virtual const char * get_table() const = 0;
 	virtual void generate_sql(std::ostream &os) const = 0;
+	// 以 ", " 分隔的列名，每个类只生成一次。
+	virtual const std::string & get_sql_columns() const = 0;
+	// 用于多行 INSERT/REPLACE。输出的值与 `get_sql_columns()` 中的列一一对应，每一项之后都跟着 ", "。
+	virtual void generate_sql_values(std::ostream &os) const = 0;
+	// 写入这个对象的预处理语句，每个类只生成一次。参数与 `get_sql_columns()` 中的列一一对应。
+	virtual const std::string & get_sql_prepared_statement(bool to_replace) const = 0;
+	virtual void generate_sql_params(Connection::Param_vector &params) const = 0;
 	virtual void fetch(const boost::shared_ptr<const Connection> &conn) = 0;
 };
 
@@ -89,6 +89,10 @@ public:
 public:
 	const char *get_table() const OVERRIDE;
 	void generate_sql(::std::ostream &os_) const OVERRIDE;
+	const ::std::string &get_sql_columns() const OVERRIDE;
+	void generate_sql_values(::std::ostream &os_) const OVERRIDE;
+	const ::std::string &get_sql_prepared_statement(bool to_replace_) const OVERRIDE;
+	void generate_sql_params(::Poseidon::Mysql::Connection::Param_vector &params_) const OVERRIDE;
 	void fetch(const ::boost::shared_ptr<const ::Poseidon::Mysql::Connection> &conn_) OVERRIDE;
 };
 
@@ -216,9 +220,128 @@ void OBJECT_NAME::generate_sql(::std::ostream &os_) const {
 
 	OBJECT_FIELDS
 }
+const ::std::string &OBJECT_NAME::get_sql_columns() const {
+#undef FIELD_BOOLEAN
+#undef FIELD_SIGNED
+#undef FIELD_UNSIGNED
+#undef FIELD_DOUBLE
+#undef FIELD_STRING
+#undef FIELD_DATETIME
+#undef FIELD_UUID
+#undef FIELD_BLOB
+
+#define FIELD_BOOLEAN(id_)                POSEIDON_STRINGIFY(id_),
+#define FIELD_SIGNED(id_)                 POSEIDON_STRINGIFY(id_),
+#define FIELD_UNSIGNED(id_)               POSEIDON_STRINGIFY(id_),
+#define FIELD_DOUBLE(id_)                 POSEIDON_STRINGIFY(id_),
+#define FIELD_STRING(id_)                 POSEIDON_STRINGIFY(id_),
+#define FIELD_DATETIME(id_)               POSEIDON_STRINGIFY(id_),
+#define FIELD_UUID(id_)                   POSEIDON_STRINGIFY(id_),
+#define FIELD_BLOB(id_)                   POSEIDON_STRINGIFY(id_),
+
+	static const char *const s_names_[] = { OBJECT_FIELDS NULLPTR };
+	static const ::std::string s_columns_(build_sql_columns(s_names_, sizeof(s_names_) / sizeof(*s_names_) - 1));
+	return s_columns_;
+}
+void OBJECT_NAME::generate_sql_values(::std::ostream &os_) const {
+	POSEIDON_PROFILE_ME;
+
+	const ::Poseidon::Recursive_mutex::Unique_lock lock_(m_mutex);
+
+#undef FIELD_BOOLEAN
+#undef FIELD_SIGNED
+#undef FIELD_UNSIGNED
+#undef FIELD_DOUBLE
+#undef FIELD_STRING
+#undef FIELD_DATETIME
+#undef FIELD_UUID
+#undef FIELD_BLOB
+
+#define FIELD_BOOLEAN(id_)                os_ <<id_.get() <<", ";
+#define FIELD_SIGNED(id_)                 os_ <<id_.get() <<", ";
+#define FIELD_UNSIGNED(id_)               os_ <<id_.get() <<", ";
+#define FIELD_DOUBLE(id_)                 os_ <<id_.get() <<", ";
+#define FIELD_STRING(id_)                 os_ << ::Poseidon::Mysql::String_escaper(id_.get()) <<", ";
+#define FIELD_DATETIME(id_)               os_ << ::Poseidon::Mysql::Date_time_formatter(id_.get()) <<", ";
+#define FIELD_UUID(id_)                   os_ << ::Poseidon::Mysql::Uuid_formatter(id_.get()) <<", ";
+#define FIELD_BLOB(id_)                   os_ << ::Poseidon::Mysql::String_escaper(id_.get()) <<", ";
+
+	OBJECT_FIELDS
+}
+const ::std::string &OBJECT_NAME::get_sql_prepared_statement(bool to_replace_) const {
+#undef FIELD_BOOLEAN
+#undef FIELD_SIGNED
+#undef FIELD_UNSIGNED
+#undef FIELD_DOUBLE
+#undef FIELD_STRING
+#undef FIELD_DATETIME
+#undef FIELD_UUID
+#undef FIELD_BLOB
+
+#define FIELD_BOOLEAN(id_)                + 1
+#define FIELD_SIGNED(id_)                 + 1
+#define FIELD_UNSIGNED(id_)               + 1
+#define FIELD_DOUBLE(id_)                 + 1
+#define FIELD_STRING(id_)                 + 1
+#define FIELD_DATETIME(id_)               + 1
+#define FIELD_UUID(id_)                   + 1
+#define FIELD_BLOB(id_)                   + 1
+
+	static const ::std::string s_replace_(build_sql_prepared_statement(true, OBJECT_TABLE, get_sql_columns(), 0 OBJECT_FIELDS));
+	static const ::std::string s_insert_(build_sql_prepared_statement(false, OBJECT_TABLE, get_sql_columns(), 0 OBJECT_FIELDS));
+	return to_replace_ ? s_replace_ : s_insert_;
+}
+void OBJECT_NAME::generate_sql_params(::Poseidon::Mysql::Connection::Param_vector &params_) const {
+	POSEIDON_PROFILE_ME;
+
+	const ::Poseidon::Recursive_mutex::Unique_lock lock_(m_mutex);
+
+#undef FIELD_BOOLEAN
+#undef FIELD_SIGNED
+#undef FIELD_UNSIGNED
+#undef FIELD_DOUBLE
+#undef FIELD_STRING
+#undef FIELD_DATETIME
+#undef FIELD_UUID
+#undef FIELD_BLOB
+
+#define FIELD_BOOLEAN(id_)                push_sql_param(params_, id_.unlocked_get());
+#define FIELD_SIGNED(id_)                 push_sql_param(params_, id_.unlocked_get());
+#define FIELD_UNSIGNED(id_)               push_sql_param(params_, id_.unlocked_get());
+#define FIELD_DOUBLE(id_)                 push_sql_param(params_, id_.unlocked_get());
+#define FIELD_STRING(id_)                 push_sql_param(params_, id_.unlocked_get());
+#define FIELD_DATETIME(id_)               push_sql_datetime_param(params_, id_.unlocked_get());
+#define FIELD_UUID(id_)                   push_sql_param(params_, id_.unlocked_get());
+#define FIELD_BLOB(id_)                   push_sql_param(params_, id_.unlocked_get());
+
+	OBJECT_FIELDS
+}
 void OBJECT_NAME::fetch(const ::boost::shared_ptr<const ::Poseidon::Mysql::Connection> &conn_){
 	POSEIDON_PROFILE_ME;
 
+#undef FIELD_BOOLEAN
+#undef FIELD_SIGNED
+#undef FIELD_UNSIGNED
+#undef FIELD_DOUBLE
+#undef FIELD_STRING
+#undef FIELD_DATETIME
+#undef FIELD_UUID
+#undef FIELD_BLOB
+
+#define FIELD_BOOLEAN(id_)                POSEIDON_STRINGIFY(id_),
+#define FIELD_SIGNED(id_)                 POSEIDON_STRINGIFY(id_),
+#define FIELD_UNSIGNED(id_)               POSEIDON_STRINGIFY(id_),
+#define FIELD_DOUBLE(id_)                 POSEIDON_STRINGIFY(id_),
+#define FIELD_STRING(id_)                 POSEIDON_STRINGIFY(id_),
+#define FIELD_DATETIME(id_)               POSEIDON_STRINGIFY(id_),
+#define FIELD_UUID(id_)                   POSEIDON_STRINGIFY(id_),
+#define FIELD_BLOB(id_)                   POSEIDON_STRINGIFY(id_),
+
+	// 列名在每个结果集中只解析一次。
+	static const char *const s_columns_[] = { OBJECT_FIELDS NULLPTR };
+	const ::std::size_t *const indices_ = conn_->resolve_columns(s_columns_, s_columns_, sizeof(s_columns_) / sizeof(*s_columns_) - 1);
+	::std::size_t index_ = 0;
+
 	const ::Poseidon::Recursive_mutex::Unique_lock lock_(m_mutex);
 
 #undef FIELD_BOOLEAN
@@ -230,16 +353,17 @@ void OBJECT_NAME::fetch(const ::boost::shared_ptr<const ::Poseidon::Mysql::Conne
 #undef FIELD_UUID
 #undef FIELD_BLOB
 
-#define FIELD_BOOLEAN(id_)                id_.set(conn_->get_boolean  ( POSEIDON_STRINGIFY(id_) ), false);
-#define FIELD_SIGNED(id_)                 id_.set(conn_->get_signed   ( POSEIDON_STRINGIFY(id_) ), false);
-#define FIELD_UNSIGNED(id_)               id_.set(conn_->get_unsigned ( POSEIDON_STRINGIFY(id_) ), false);
-#define FIELD_DOUBLE(id_)                 id_.set(conn_->get_double   ( POSEIDON_STRINGIFY(id_) ), false);
-#define FIELD_STRING(id_)                 id_.set(conn_->get_string   ( POSEIDON_STRINGIFY(id_) ), false);
-#define FIELD_DATETIME(id_)               id_.set(conn_->get_datetime ( POSEIDON_STRINGIFY(id_) ), false);
-#define FIELD_UUID(id_)                   id_.set(conn_->get_uuid     ( POSEIDON_STRINGIFY(id_) ), false);
-#define FIELD_BLOB(id_)                   id_.set(conn_->get_blob     ( POSEIDON_STRINGIFY(id_) ), false);
+#define FIELD_BOOLEAN(id_)                id_.set(conn_->get_boolean  ( indices_[index_++] ), false);
+#define FIELD_SIGNED(id_)                 id_.set(conn_->get_signed   ( indices_[index_++] ), false);
+#define FIELD_UNSIGNED(id_)               id_.set(conn_->get_unsigned ( indices_[index_++] ), false);
+#define FIELD_DOUBLE(id_)                 id_.set(conn_->get_double   ( indices_[index_++] ), false);
+#define FIELD_STRING(id_)                 id_.set(conn_->get_string   ( indices_[index_++] ), false);
+#define FIELD_DATETIME(id_)               id_.set(conn_->get_datetime ( indices_[index_++] ), false);
+#define FIELD_UUID(id_)                   id_.set(conn_->get_uuid     ( indices_[index_++] ), false);
+#define FIELD_BLOB(id_)                   id_.set(conn_->get_blob     ( indices_[index_++] ), false);
 
 	OBJECT_FIELDS
+	(void)index_;
 }
 
 #pragma GCC diagnostic pop
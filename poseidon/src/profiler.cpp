@@ -6,76 +6,345 @@
 #include "singletons/profile_depository.hpp"
 #include "time.hpp"
 #include "log.hpp"
+#include "atomic.hpp"
+#include <pthread.h>
 
 namespace Poseidon {
 
 namespace {
 	__thread Profiler *t_top = 0; // XXX: NULLPTR
+
+	// 抽样计时的间隔在 [1, 2 * interval - 1] 之间随机选取，平均为 `interval`。
+	// 固定的间隔会与循环里的调用序列同步，使某些调用点总是（或从不）被计时。
+	__thread unsigned long t_sample_countdown = 0;
+	__thread boost::uint32_t t_sample_seed = 0;
+
+	unsigned long generate_sample_countdown(unsigned long interval) NOEXCEPT {
+		boost::uint32_t seed = t_sample_seed;
+		if(seed == 0){
+			seed = static_cast<boost::uint32_t>(reinterpret_cast<std::size_t>(&t_sample_seed) >> 4) | 1;
+		}
+		// 这是 xorshift32。
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		t_sample_seed = seed;
+		return seed % (interval * 2 - 1) + 1;
+	}
+
+	// 每个线程积攒的计数，以调用点的地址为键，用线性探测的开放寻址散列表保存。
+	// 计数每隔一段时间才并入 Profile_depository，因此热点路径上既不加锁也不比较字符串。
+	// 表只由所属线程读写。所有的表链接在一起，取快照时逐个设置合并请求，由所属线程在下一次退出抽中的作用域时合并。
+	CONSTEXPR const std::size_t g_table_capacity = 1024;
+	CONSTEXPR const std::size_t g_table_max_size = g_table_capacity / 4 * 3;
+	CONSTEXPR const double g_flush_interval = 1000;
+
+	struct Thread_counters {
+		const Profiler::Call_site *site;
+		unsigned long long samples;
+		double total;
+		double exclusive;
+		// 延迟直方图在第一次用到时才分配。
+		boost::uint32_t *latency_counts;
+		unsigned long latency_samples;
+		double latency_max;
+	};
+	struct Thread_table {
+		// 由 `g_tables_mutex` 保护。
+		Thread_table *prev;
+		Thread_table *next;
+		// 其他线程通过它请求合并。
+		volatile bool flush_requested;
+
+		std::size_t size;
+		unsigned long generation;
+		unsigned long latency_generation;
+		double next_flush_time;
+		Thread_counters entries[g_table_capacity];
+	};
+
+	// 分配失败时为空指针，这时直接调用 `Profile_depository::accumulate()`。
+	__thread Thread_table *t_table = 0; // XXX: NULLPTR
+	__thread bool t_table_initialized = false;
+
+	// 所有线程的表，由 `g_tables_mutex` 保护。表在从链表中摘除之后才会被释放。
+	::pthread_mutex_t g_tables_mutex = PTHREAD_MUTEX_INITIALIZER;
+	Thread_table *g_tables = 0; // XXX: NULLPTR
+
+	class Table_lock : NONCOPYABLE {
+	private:
+		::pthread_mutex_t *const m_mutex;
+
+	public:
+		explicit Table_lock(::pthread_mutex_t *mutex) NOEXCEPT
+			: m_mutex(mutex)
+		{
+			int err_code = ::pthread_mutex_lock(m_mutex);
+			(void)err_code;
+			assert(err_code == 0);
+		}
+		~Table_lock() NOEXCEPT {
+			int err_code = ::pthread_mutex_unlock(m_mutex);
+			(void)err_code;
+			assert(err_code == 0);
+		}
+	};
+
+	// 只能由表所属的线程调用。
+	void flush_thread_table(Thread_table *table, double now) NOEXCEPT {
+		atomic_store(table->flush_requested, false, memory_order_relaxed);
+		// 在上一次合并之后计数被清零过，积攒的计数作废。
+		const AUTO(generation, Profile_depository::get_generation());
+		const bool stale = table->generation != generation;
+		// 延迟窗口被重置过，积攒的延迟可能属于已经结束的窗口，同样作废。
+		const AUTO(latency_generation, Profile_depository::get_latency_generation());
+		const bool latency_stale = stale || (table->latency_generation != latency_generation);
+		for(std::size_t i = 0; i < g_table_capacity; ++i){
+			AUTO_REF(counters, table->entries[i]);
+			if(!counters.site){
+				continue;
+			}
+			if(!stale && ((counters.samples != 0) || (counters.total != 0))){
+				Profile_depository::accumulate(counters.site->file, counters.site->line, counters.site->func, counters.samples, counters.total, counters.exclusive);
+			}
+			counters.samples = 0;
+			counters.total = 0;
+			counters.exclusive = 0;
+			if(counters.latency_samples != 0){
+				if(!latency_stale){
+					Profile_depository::accumulate_latency(counters.site->file, counters.site->line, counters.site->func, counters.latency_counts, counters.latency_max);
+				}
+				std::fill_n(counters.latency_counts, static_cast<std::size_t>(Profile_depository::latency_bucket_count), 0);
+				counters.latency_samples = 0;
+				counters.latency_max = 0;
+			}
+		}
+		table->generation = generation;
+		table->latency_generation = latency_generation;
+		table->next_flush_time = now + g_flush_interval;
+	}
+
+	::pthread_key_t g_table_key;
+	::pthread_once_t g_table_key_once = PTHREAD_ONCE_INIT;
+
+	void thread_table_destructor(void *param) NOEXCEPT {
+		const AUTO(table, static_cast<Thread_table *>(param));
+		{
+			const Table_lock tables_lock(&g_tables_mutex);
+			if(table->prev){
+				table->prev->next = table->next;
+			} else {
+				g_tables = table->next;
+			}
+			if(table->next){
+				table->next->prev = table->prev;
+			}
+		}
+		flush_thread_table(table, 0);
+		t_table = NULLPTR;
+		for(std::size_t i = 0; i < g_table_capacity; ++i){
+			delete[] table->entries[i].latency_counts;
+		}
+		delete table;
+	}
+	void create_table_key() NOEXCEPT {
+		int err_code = ::pthread_key_create(&g_table_key, &thread_table_destructor);
+		if(err_code != 0){
+			std::terminate();
+		}
+	}
+
+	Thread_table * get_thread_table() NOEXCEPT {
+		if(t_table_initialized){
+			return t_table;
+		}
+		t_table_initialized = true;
+		::pthread_once(&g_table_key_once, &create_table_key);
+		const AUTO(table, new(std::nothrow) Thread_table());
+		if(!table){
+			return NULLPTR;
+		}
+		table->generation = Profile_depository::get_generation();
+		table->latency_generation = Profile_depository::get_latency_generation();
+		if(::pthread_setspecific(g_table_key, table) != 0){
+			delete table;
+			return NULLPTR;
+		}
+		{
+			const Table_lock tables_lock(&g_tables_mutex);
+			table->next = g_tables;
+			if(table->next){
+				table->next->prev = table;
+			}
+			g_tables = table;
+		}
+		t_table = table;
+		return table;
+	}
+	Thread_counters * find_counters(Thread_table *table, const Profiler::Call_site *site) NOEXCEPT {
+		// 调用点对象的地址的低位总是零，需要先去掉。
+		std::size_t i = (reinterpret_cast<std::size_t>(site) / sizeof(void *)) * 0x9E3779B1u;
+		for(;;){
+			i &= g_table_capacity - 1;
+			AUTO_REF(counters, table->entries[i]);
+			if(counters.site == site){
+				return &counters;
+			}
+			if(!counters.site){
+				break;
+			}
+			++i;
+		}
+		if(table->size >= g_table_max_size){
+			return NULLPTR;
+		}
+		table->size += 1;
+		AUTO_REF(counters, table->entries[i]);
+		counters.site = site;
+		return &counters;
+	}
+	// 只能由表所属的线程调用。表已满时返回 false。
+	bool add_to_thread_table(Thread_table *table, const Profiler::Call_site *site, unsigned long samples, bool new_sample, double total, double exclusive, double latency, double now) NOEXCEPT {
+		const AUTO(counters, find_counters(table, site));
+		if(!counters){
+			return false;
+		}
+		// 抽样计时时，一次计时代表 `samples` 次调用。
+		const AUTO(weight, static_cast<double>(samples));
+		counters->samples += new_sample ? samples : 0;
+		counters->total += total * weight;
+		counters->exclusive += exclusive * weight;
+		if(new_sample){
+			// 延迟包括挂起的时间。
+			if(!counters->latency_counts){
+				counters->latency_counts = new(std::nothrow) boost::uint32_t[Profile_depository::latency_bucket_count]();
+			}
+			if(counters->latency_counts){
+				counters->latency_counts[Profile_depository::get_latency_bucket(latency)] += static_cast<boost::uint32_t>(samples);
+				counters->latency_samples += samples;
+				counters->latency_max = std::max(counters->latency_max, latency);
+			} else {
+				Profile_depository::accumulate_latency(site->file, site->line, site->func, latency, samples);
+			}
+		}
+		if((now >= table->next_flush_time) || atomic_load(table->flush_requested, memory_order_relaxed)){
+			flush_thread_table(table, now);
+		}
+		return true;
+	}
 }
 
 void Profiler::accumulate_all_in_thread() NOEXCEPT {
 	if(!Profile_depository::is_enabled()){
 		return;
 	}
-	Profiler *cur = t_top;
-	if(!cur){
-		return;
-	}
 	const AUTO(now, get_hi_res_mono_clock());
-	do {
+	Profiler *cur = t_top;
+	while(cur){
 		cur->accumulate(now, false);
 		cur = cur->m_prev;
-	} while(cur);
+	}
+	const AUTO(table, get_thread_table());
+	if(table){
+		flush_thread_table(table, now);
+	}
+}
+void Profiler::accumulate_all_threads() NOEXCEPT {
+	if(!Profile_depository::is_enabled()){
+		return;
+	}
+	accumulate_all_in_thread();
+
+	const Table_lock tables_lock(&g_tables_mutex);
+	for(AUTO(table, g_tables); table; table = table->next){
+		atomic_store(table->flush_requested, true, memory_order_relaxed);
+	}
 }
 
 void * Profiler::begin_stack_switch() NOEXCEPT {
 	if(!Profile_depository::is_enabled()){
 		return NULLPTR;
 	}
-	Profiler *cur = t_top;
-	if(!cur){
+	Profiler *const top = t_top;
+	if(!top){
 		return NULLPTR;
 	}
-	const AUTO(now, get_hi_res_mono_clock());
-	cur->accumulate(now, false);
-	cur->m_yielded_since = now;
+	Profiler *const cur = top->find_timed();
+	if(cur){
+		const AUTO(now, get_hi_res_mono_clock());
+		cur->accumulate(now, false);
+		cur->m_yielded_since = now;
+	}
 	t_top = NULLPTR;
-	return cur;
+	return top;
 }
 void Profiler::end_stack_switch(void *opaque) NOEXCEPT {
-	Profiler *cur = static_cast<Profiler *>(opaque);
-	if(!cur){
+	Profiler *const top = static_cast<Profiler *>(opaque);
+	if(!top){
 		return;
 	}
-	const AUTO(now, get_hi_res_mono_clock());
-	cur->m_excluded += now - cur->m_yielded_since;
-	cur->accumulate(now, false);
-	t_top = cur;
+	Profiler *const cur = top->find_timed();
+	if(cur){
+		const AUTO(now, get_hi_res_mono_clock());
+		cur->m_excluded += now - cur->m_yielded_since;
+		cur->accumulate(now, false);
+	}
+	t_top = top;
 }
 
-Profiler::Profiler(const char *file, unsigned long line, const char *func) NOEXCEPT
-	: m_prev(t_top), m_file(file), m_line(line), m_func(func)
-	, m_start(0), m_excluded(0), m_yielded_since(0)
+Profiler::Profiler(const Call_site *site) NOEXCEPT
+	: m_prev(t_top), m_site(site)
+	, m_weight(0), m_timed(false), m_began(0), m_start(0), m_excluded(0), m_yielded_since(0)
 {
 	if(Profile_depository::is_enabled()){
-		const AUTO(now, get_hi_res_mono_clock());
-		m_start = now;
+		const AUTO(interval, Profile_depository::get_sample_interval());
+		if(interval > 1){
+			if(t_sample_countdown > 1){
+				t_sample_countdown -= 1;
+			} else {
+				t_sample_countdown = generate_sample_countdown(interval);
+				m_weight = interval;
+			}
+		} else {
+			m_weight = 1;
+		}
+		// 所有作用域都进入 `t_top` 链表，但只有抽中的作用域和抽中的作用域的直接内层作用域才读取时钟。
+		// 后者不记录计数，只用来从外层作用域的独占时间中扣除自己的耗时。
+		if(m_weight || (m_prev && m_prev->m_weight)){
+			const AUTO(now, get_hi_res_mono_clock());
+			m_timed = true;
+			m_began = now;
+			m_start = now;
+		}
 		t_top = this;
 	}
 }
 Profiler::~Profiler() NOEXCEPT {
 	if(std::uncaught_exception()){
-		POSEIDON_LOG(Logger::special_major | Logger::level_info, "Exception backtrace: file = ", m_file, ", line = ", m_line, ", func = ", m_func);
+		POSEIDON_LOG(Logger::special_major | Logger::level_info, "Exception backtrace: file = ", m_site->file, ", line = ", m_site->line, ", func = ", m_site->func);
 	}
 
 	if(t_top == this){
-		const AUTO(now, get_hi_res_mono_clock());
 		t_top = m_prev;
-		accumulate(now, true);
+		if(m_timed){
+			const AUTO(now, get_hi_res_mono_clock());
+			accumulate(now, true);
+		}
 	}
 }
 
+Profiler * Profiler::find_timed() NOEXCEPT {
+	Profiler *cur = this;
+	while(cur && !cur->m_timed){
+		cur = cur->m_prev;
+	}
+	return cur;
+}
+
 void Profiler::accumulate(double now, bool new_sample) NOEXCEPT {
+	if(!m_timed){
+		return;
+	}
 	const AUTO(total, now - m_start);
 	const AUTO(exclusive, total - m_excluded);
 	m_start = now;
@@ -84,8 +353,22 @@ void Profiler::accumulate(double now, bool new_sample) NOEXCEPT {
 	if(m_prev){
 		m_prev->m_excluded += total;
 	}
+	if(m_weight == 0){
+		return;
+	}
 
-	Profile_depository::accumulate(m_file, m_line, m_func, new_sample, total, exclusive);
+	const AUTO(table, get_thread_table());
+	if(table){
+		if(add_to_thread_table(table, m_site, m_weight, new_sample, total, exclusive, now - m_began, now)){
+			return;
+		}
+	}
+	// 抽样计时时，一次计时代表 `m_weight` 次调用。
+	const AUTO(weight, static_cast<double>(m_weight));
+	Profile_depository::accumulate(m_site->file, m_site->line, m_site->func, new_sample ? m_weight : 0, total * weight, exclusive * weight);
+	if(new_sample){
+		Profile_depository::accumulate_latency(m_site->file, m_site->line, m_site->func, now - m_began, m_weight);
+	}
 }
 
 }
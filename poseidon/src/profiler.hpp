@@ -11,31 +11,48 @@ namespace Poseidon {
 
 class Profiler : NONCOPYABLE {
 public:
+	// 每个调用点一个静态对象，它的地址作为线程局部计数表的键。
+	struct Call_site {
+		const char *file;
+		unsigned long line;
+		const char *func;
+	};
+
+public:
+	// 同时把当前线程积攒的计数并入 Profile_depository。
 	static void accumulate_all_in_thread() NOEXCEPT;
+	// 立即合并当前线程积攒的计数，并请求其他线程在下一次退出抽中的作用域时合并它们的计数。
+	static void accumulate_all_threads() NOEXCEPT;
 
 	static void * begin_stack_switch() NOEXCEPT;
 	static void end_stack_switch(void *opaque) NOEXCEPT;
 
 private:
 	Profiler *const m_prev;
-	const char *const m_file;
-	const unsigned long m_line;
-	const char *const m_func;
+	const Call_site *const m_site;
 
+	unsigned long m_weight; // 没有抽中的作用域为零。
+	bool m_timed; // 是否读取了时钟。
+	double m_began;
 	double m_start;
 	double m_excluded;
 	double m_yielded_since;
 
 public:
-	Profiler(const char *file, unsigned long line, const char *func) NOEXCEPT;
+	explicit Profiler(const Call_site *site) NOEXCEPT;
 	~Profiler() NOEXCEPT;
 
 private:
+	Profiler * find_timed() NOEXCEPT;
 	void accumulate(double now, bool new_sample) NOEXCEPT;
 };
 
 }
 
-#define POSEIDON_PROFILE_ME  const ::Poseidon::Profiler POSEIDON_UNIQUE_NAME(__FILE__, __LINE__, __PRETTY_FUNCTION__)
+#define POSEIDON_PROFILE_ME_(site_)	\
+	static const ::Poseidon::Profiler::Call_site site_ = { __FILE__, __LINE__, __PRETTY_FUNCTION__ };	\
+	const ::Poseidon::Profiler POSEIDON_UNIQUE_NAME(&site_)
+
+#define POSEIDON_PROFILE_ME  POSEIDON_PROFILE_ME_(POSEIDON_UNIQUE_NAME)
 
 #endif
@@ -9,6 +9,10 @@
 
 namespace Poseidon {
 
+Promise::Waiter_base::~Waiter_base(){
+	//
+}
+
 Promise::~Promise(){
 	//
 }
@@ -33,6 +37,22 @@ void Promise::check_and_rethrow() const {
 		STD_RETHROW_EXCEPTION(*ptr);
 	}
 }
+void Promise::add_waiter(const boost::shared_ptr<Waiter_base> &waiter) const {
+	const Recursive_mutex::Unique_lock lock(m_mutex);
+	if(m_except){
+		waiter->on_promise_satisfied();
+		return;
+	}
+	// 超时的等待者不会被移除，在这里顺便清理掉。
+	for(AUTO(it, m_waiters.begin()); it != m_waiters.end(); ){
+		if(it->expired()){
+			it = m_waiters.erase(it);
+		} else {
+			++it;
+		}
+	}
+	m_waiters.push_back(waiter);
+}
 
 void Promise::set_success(bool throw_if_already_set){
 	set_exception(STD_EXCEPTION_PTR(), throw_if_already_set);
@@ -46,6 +66,16 @@ void Promise::set_exception(STD_EXCEPTION_PTR except, bool throw_if_already_set)
 		return;
 	}
 	m_except = STD_MOVE_IDN(except);
+
+	boost::container::vector<boost::weak_ptr<Waiter_base> > waiters;
+	waiters.swap(m_waiters);
+	for(AUTO(it, waiters.begin()); it != waiters.end(); ++it){
+		const AUTO(waiter, it->lock());
+		if(!waiter){
+			continue;
+		}
+		waiter->on_promise_satisfied();
+	}
 }
 
 void yield(const boost::shared_ptr<const Promise> &promise, bool insignificant){
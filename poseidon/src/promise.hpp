@@ -8,19 +8,32 @@
 #include "cxx_util.hpp"
 #include "recursive_mutex.hpp"
 #include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/container/vector.hpp>
 #include <boost/type_traits/remove_const.hpp>
 #include <boost/optional.hpp>
 
 namespace Poseidon {
 
 class Promise : NONCOPYABLE {
+public:
+	// 在 Promise 被满足时得到通知。通知可能在任意线程上发出，发出时可能持有 Promise 的锁。
+	class Waiter_base {
+	public:
+		virtual ~Waiter_base();
+
+	public:
+		virtual void on_promise_satisfied() NOEXCEPT = 0;
+	};
+
 protected:
 	mutable Recursive_mutex m_mutex;
 	boost::optional<STD_EXCEPTION_PTR> m_except;
+	mutable boost::container::vector<boost::weak_ptr<Waiter_base> > m_waiters;
 
 public:
 	Promise()
-		: m_mutex(), m_except()
+		: m_mutex(), m_except(), m_waiters()
 	{
 		//
 	}
@@ -30,6 +43,8 @@ public:
 	bool is_satisfied() const NOEXCEPT;
 	bool would_throw() const NOEXCEPT;
 	void check_and_rethrow() const;
+	// 只保存弱引用。如果已经被满足，立即通知 `waiter`。
+	void add_waiter(const boost::shared_ptr<Waiter_base> &waiter) const;
 
 	void set_success(bool throw_if_already_set = true);
 	void set_exception(STD_EXCEPTION_PTR except, bool throw_if_already_set = true);
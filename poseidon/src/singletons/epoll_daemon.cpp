@@ -12,7 +12,6 @@
 #include "../profiler.hpp"
 #include "../recursive_mutex.hpp"
 #include "../raii.hpp"
-#include "../multi_index_map.hpp"
 #include "../checked_arithmetic.hpp"
 #include "../system_exception.hpp"
 #include "../errno.hpp"
@@ -25,9 +24,6 @@
 namespace Poseidon {
 
 namespace {
-	volatile bool g_running = false;
-	Thread g_thread;
-
 	class Weakable_socket {
 	private:
 		boost::shared_ptr<Socket_base> m_strong;
@@ -50,258 +46,682 @@ namespace {
 		}
 	};
 
-	struct Socket_element {
-		// Invariants.
-		boost::shared_ptr<const Weakable_socket> weakable;
-		// Indices.
-		const volatile Socket_base *ptr;
-		boost::uint64_t read_time;
-		boost::uint64_t write_time;
-		int err_code;
-		// Variables.
-		mutable bool readable;
-		mutable bool writable;
+	enum {
+		queue_readable,
+		queue_writable,
+		queue_throttled,
+		queue_closed,
+		queue_count
 	};
-	POSEIDON_MULTI_INDEX_MAP(Socket_map, Socket_element,
-		POSEIDON_UNIQUE_MEMBER_INDEX(ptr)
-		POSEIDON_MULTI_MEMBER_INDEX(read_time)
-		POSEIDON_MULTI_MEMBER_INDEX(write_time)
-		POSEIDON_MULTI_MEMBER_INDEX(err_code)
-	);
-
-	Recursive_mutex g_mutex;
-	Unique_file g_epoll;
-	Socket_map g_socket_map;
-
-	bool wait_for_sockets(unsigned timeout) NOEXCEPT {
-		POSEIDON_PROFILE_ME;
-
-		boost::array< ::epoll_event, 256> events;
-		const int result = ::epoll_wait(g_epoll.get(), events.data(), static_cast<int>(events.size()), static_cast<int>(std::min<unsigned>(timeout, INT_MAX)));
-		if(result < 0){
-			const int err_code = errno;
-			if(err_code != EINTR){
-				POSEIDON_LOG_ERROR("::epoll_wait() failed! errno was ", err_code, " (", get_error_desc(err_code), ")");
-			}
-			return false;
-		}
-		if(result == 0){
-			return false;
-		}
-		const AUTO(now, get_fast_mono_clock());
-		const Recursive_mutex::Unique_lock lock(g_mutex);
-		for(unsigned i = 0; i < static_cast<unsigned>(result); ++i){
-			const AUTO(ptr, static_cast<Socket_base *>(events[i].data.ptr));
-			const AUTO(it, g_socket_map.find<0>(ptr));
-			if(it == g_socket_map.end()){
-				POSEIDON_LOG_TRACE("Socket reported by epoll is not registered: ptr = ", static_cast<void *>(ptr));
-				continue;
-			}
-			const AUTO(socket, it->weakable->lock());
-			if(!socket){
-				g_socket_map.erase<0>(it);
-				continue;
-			}
-			if(has_any_flags_of(events[i].events, EPOLLIN) && has_none_flags_of(events[i].events, EPOLLERR)){
-				it->readable = true;
-				g_socket_map.set_key<0, 1>(it, now);
-			}
-			if(has_any_flags_of(events[i].events, EPOLLOUT) && has_none_flags_of(events[i].events, EPOLLERR)){
-				it->writable = true;
-				g_socket_map.set_key<0, 2>(it, now);
-			}
-			if(has_any_flags_of(events[i].events, EPOLLHUP | EPOLLERR)){
-				int err_code;
-				if(socket->did_time_out()){
-					err_code = ETIMEDOUT;
-				} else if(has_any_flags_of(events[i].events, EPOLLERR)){
-					::socklen_t err_len = sizeof(err_code);
-					if(::getsockopt(socket->get_fd(), SOL_SOCKET, SO_ERROR, &err_code, &err_len) != 0){
-						err_code = errno;
-						POSEIDON_LOG_WARNING("::getsockopt() failed: fd = ", socket->get_fd(), ", err_code = ", err_code, " (", get_error_desc(err_code), ")");
-					}
-				} else {
-					err_code = 0;
-				}
-				POSEIDON_LOG(Logger::special_major | Logger::level_debug, "Socket closed: remote = ", socket->get_remote_info(), ", typeid = ", typeid(*socket).name(), ", err_code = ", err_code, " (", get_error_desc(err_code), ")");
-				g_socket_map.set_key<0, 3>(it, err_code);
-			}
+
+	// 套接字簿记表。所有节点存放在一个连续的数组中，用 (generation, slot) 组成的句柄寻址，
+	// 句柄同时作为 epoll_event 的数据和 Socket_base 中的钩子，因此查找、入队、出队和删除都是 O(1) 的。
+	// 槽位被释放时 generation 递增，epoll 报告的过期句柄会被识别出来并丢弃。
+	class Socket_table : NONCOPYABLE {
+	public:
+		typedef boost::uint64_t Handle;
+
+		struct Element {
+			boost::shared_ptr<const Weakable_socket> weakable;
+			const volatile Socket_base *ptr;
+			bool readable;
+			bool writable;
+			int err_code;
+			boost::uint64_t throttled_until;
+		};
+
+	private:
+		enum {
+			slot_npos = 0xFFFFFFFFu
+		};
+
+		struct Queue_hook {
+			boost::uint32_t prev;
+			boost::uint32_t next;
+			bool linked;
+		};
+		struct Node {
+			boost::uint32_t generation;
+			Element elem;
+			Queue_hook hooks[queue_count];
+		};
+
+		static boost::uint32_t get_slot(Handle handle) NOEXCEPT {
+			return static_cast<boost::uint32_t>(handle);
+		}
+		static boost::uint32_t get_generation(Handle handle) NOEXCEPT {
+			return static_cast<boost::uint32_t>(handle >> 32);
 		}
-		return true;
-	}
 
-	bool pump_one_readable_socket(boost::container::vector<unsigned char> &io_buffer) NOEXCEPT {
-		POSEIDON_PROFILE_ME;
+	private:
+		boost::container::vector<Node> m_nodes;
+		boost::container::vector<boost::uint32_t> m_free_slots;
+		boost::array<boost::uint32_t, queue_count> m_heads;
+		boost::array<boost::uint32_t, queue_count> m_tails;
 
-		const AUTO(now, get_fast_mono_clock());
-		boost::shared_ptr<Socket_base> socket;
-		bool readable;
+	public:
+		Socket_table()
+			: m_nodes(), m_free_slots()
 		{
-			const Recursive_mutex::Unique_lock lock(g_mutex);
-			const AUTO(it, g_socket_map.begin<1>());
-			if(it == g_socket_map.end<1>()){
-				return false;
+			m_heads.fill(slot_npos);
+			m_tails.fill(slot_npos);
+		}
+
+	private:
+		Handle make_handle(boost::uint32_t slot) const NOEXCEPT {
+			return (static_cast<Handle>(m_nodes[slot].generation) << 32) | slot;
+		}
+		Node * find_node(Handle handle) NOEXCEPT {
+			const AUTO(slot, get_slot(handle));
+			if(slot >= m_nodes.size()){
+				return NULLPTR;
+			}
+			const AUTO(node, &(m_nodes[slot]));
+			if((node->generation != get_generation(handle)) || !node->elem.weakable){
+				return NULLPTR;
 			}
-			if(now < it->read_time){
+			return node;
+		}
+
+	public:
+		std::size_t size() const NOEXCEPT {
+			return m_nodes.size() - m_free_slots.size();
+		}
+		std::size_t get_slot_count() const NOEXCEPT {
+			return m_nodes.size();
+		}
+		const Element * get_by_slot(std::size_t slot) const NOEXCEPT {
+			const AUTO_REF(node, m_nodes.at(slot));
+			if(!node.elem.weakable){
+				return NULLPTR;
+			}
+			return &(node.elem);
+		}
+
+		Handle insert(Element elem){
+			boost::uint32_t slot;
+			if(m_free_slots.empty()){
+				POSEIDON_THROW_UNLESS(m_nodes.size() < slot_npos, Exception, Rcnts::view("Too many sockets in epoll"));
+				slot = static_cast<boost::uint32_t>(m_nodes.size());
+				Node node = { 1 };
+				for(unsigned q = 0; q < queue_count; ++q){
+					node.hooks[q].prev = slot_npos;
+					node.hooks[q].next = slot_npos;
+					node.hooks[q].linked = false;
+				}
+				m_nodes.push_back(STD_MOVE(node));
+			} else {
+				slot = m_free_slots.back();
+				m_free_slots.pop_back();
+			}
+			m_nodes[slot].elem = STD_MOVE(elem);
+			return make_handle(slot);
+		}
+		Element * find(Handle handle) NOEXCEPT {
+			const AUTO(node, find_node(handle));
+			if(!node){
+				return NULLPTR;
+			}
+			return &(node->elem);
+		}
+		bool erase(Handle handle) NOEXCEPT {
+			const AUTO(node, find_node(handle));
+			if(!node){
 				return false;
 			}
-			socket = it->weakable->lock();
-			if(!socket){
-				g_socket_map.erase<1>(it);
-				return true;
+			for(unsigned q = 0; q < queue_count; ++q){
+				unlink(q, handle);
+			}
+			node->elem = Element();
+			// 跳过零，使得零永远不是一个有效的句柄。
+			if(++(node->generation) == 0){
+				node->generation = 1;
 			}
-			readable = it->readable;
+			m_free_slots.push_back(get_slot(handle));
+			return true;
+		}
+		void clear() NOEXCEPT {
+			m_nodes.clear();
+			m_free_slots.clear();
+			m_heads.fill(slot_npos);
+			m_tails.fill(slot_npos);
 		}
 
-		if(socket->is_throttled()){
-			POSEIDON_LOG(Logger::special_major | Logger::level_debug, "Socket is throttled: socket = ", socket, ", typeid = ", typeid(*socket).name());
-			const Recursive_mutex::Unique_lock lock(g_mutex);
-			const AUTO(it, g_socket_map.find<0>(socket.get()));
-			if(it != g_socket_map.end<0>()){
-				g_socket_map.set_key<0, 1>(it, now + 5000);
+		Handle front(unsigned q) const NOEXCEPT {
+			const AUTO(slot, m_heads[q]);
+			if(slot == slot_npos){
+				return 0;
 			}
+			return make_handle(slot);
+		}
+		// 一个元素在同一个队列中最多出现一次。如果已经在队列中就返回 false。
+		bool push_back(unsigned q, Handle handle) NOEXCEPT {
+			const AUTO(node, find_node(handle));
+			if(!node){
+				return false;
+			}
+			AUTO_REF(hook, node->hooks[q]);
+			if(hook.linked){
+				return false;
+			}
+			const AUTO(slot, get_slot(handle));
+			hook.prev = m_tails[q];
+			hook.next = slot_npos;
+			hook.linked = true;
+			if(m_tails[q] != slot_npos){
+				m_nodes[m_tails[q]].hooks[q].next = slot;
+			} else {
+				m_heads[q] = slot;
+			}
+			m_tails[q] = slot;
+			return true;
+		}
+		bool unlink(unsigned q, Handle handle) NOEXCEPT {
+			const AUTO(node, find_node(handle));
+			if(!node){
+				return false;
+			}
+			AUTO_REF(hook, node->hooks[q]);
+			if(!hook.linked){
+				return false;
+			}
+			if(hook.prev != slot_npos){
+				m_nodes[hook.prev].hooks[q].next = hook.next;
+			} else {
+				m_heads[q] = hook.next;
+			}
+			if(hook.next != slot_npos){
+				m_nodes[hook.next].hooks[q].prev = hook.prev;
+			} else {
+				m_tails[q] = hook.prev;
+			}
+			hook.prev = slot_npos;
+			hook.next = slot_npos;
+			hook.linked = false;
 			return true;
 		}
+		bool is_linked(unsigned q, Handle handle) NOEXCEPT {
+			const AUTO(node, find_node(handle));
+			if(!node){
+				return false;
+			}
+			return node->hooks[q].linked;
+		}
+		Handle pop_front(unsigned q) NOEXCEPT {
+			const AUTO(handle, front(q));
+			if(handle != 0){
+				unlink(q, handle);
+			}
+			return handle;
+		}
+	};
 
+	// 一轮中从某个队列中取出的套接字，在不持有锁的情况下逐个处理。
+	struct Pending_socket {
+		Socket_table::Handle handle;
+		boost::shared_ptr<Socket_base> socket;
+		bool ready;
 		int err_code;
-		try {
-			err_code = socket->poll_read_and_process(io_buffer.data(), io_buffer.size(), readable);
-			POSEIDON_LOG_TRACE("Socket read result: socket = ", socket, ", typeid = ", typeid(*socket).name(), ", err_code = ", err_code);
-		} catch(std::exception &e){
-			POSEIDON_LOG_WARNING("std::exception thrown: what = ", e.what(), ", socket = ", socket, ", typeid = ", typeid(*socket).name());
-			err_code = ECONNRESET;
-		} catch(...){
-			POSEIDON_LOG_WARNING("Unknown exception thrown: socket = ", socket, ", typeid = ", typeid(*socket).name());
-			err_code = ECONNRESET;
-		}
-		if((err_code == 0) || (err_code == EINTR)){
-			// Success.
-		} else if((err_code == EWOULDBLOCK) || (err_code == EAGAIN)){
-			const Recursive_mutex::Unique_lock lock(g_mutex);
-			const AUTO(it, g_socket_map.find<0>(socket.get()));
-			if(it != g_socket_map.end<0>()){
-				g_socket_map.set_key<0, 1>(it, -1ull);
-			}
-		} else {
-			POSEIDON_LOG_DEBUG("Socket read error: socket = ", socket, ", typeid = ", typeid(*socket).name(), ", err_code = ", err_code, " (", get_error_desc(err_code), ")");
-			socket->force_shutdown();
-		}
-		return true;
-	}
+	};
 
-	bool pump_one_writable_socket(boost::container::vector<unsigned char> &io_buffer) NOEXCEPT {
-		POSEIDON_PROFILE_ME;
+	// 每个周期把套接字表分成这么多批，每批间隔 `1 / sweep_batches` 个周期，这样每个套接字每个周期恰好被扫描一次。
+	CONSTEXPR const std::size_t g_sweep_batches = 16;
 
-		const AUTO(now, get_fast_mono_clock());
-		boost::shared_ptr<Socket_base> socket;
-		bool writable;
+	// 每个线程拥有独立的 epoll 实例、套接字表、I/O 缓冲区和互斥锁。
+	// 套接字在 add_socket() 时按地址散列固定到某一个线程上，此后不会迁移。
+	class Epoll_thread : NONCOPYABLE {
+	private:
+		Thread m_thread;
+		volatile bool m_running;
+
+		mutable Recursive_mutex m_mutex;
+		Unique_file m_epoll;
+		Socket_table m_table;
+
+		// 这些只在 epoll 线程中访问。
+		boost::container::vector<unsigned char> m_io_buffer;
+		boost::container::vector<Pending_socket> m_batch;
+		boost::uint64_t m_sweep_interval;
+		boost::uint64_t m_next_sweep_time;
+		std::size_t m_sweep_cursor;
+
+	public:
+		Epoll_thread()
+			: m_running(false)
+			, m_sweep_interval(0), m_next_sweep_time(0), m_sweep_cursor(0)
 		{
-			const Recursive_mutex::Unique_lock lock(g_mutex);
-			const AUTO(it, g_socket_map.begin<2>());
-			if(it == g_socket_map.end<2>()){
+			//
+		}
+
+	private:
+		void erase_socket_unlocked(Socket_table::Handle handle, const boost::shared_ptr<Socket_base> &socket) NOEXCEPT {
+			if(socket && (socket->get_epoll_handle() == handle)){
+				socket->set_epoll_handle(0);
+			}
+			m_table.erase(handle);
+		}
+
+		// 把队列中的套接字全部取出放入 m_batch 中。已经销毁的套接字在这里顺便清理掉。
+		void drain_queue_unlocked(unsigned q){
+			for(;;){
+				const AUTO(handle, m_table.pop_front(q));
+				if(handle == 0){
+					break;
+				}
+				const AUTO(elem, m_table.find(handle));
+				AUTO(socket, elem->weakable->lock());
+				if(!socket){
+					erase_socket_unlocked(handle, socket);
+					continue;
+				}
+				Pending_socket pending = { handle, STD_MOVE(socket), (q == queue_writable) ? elem->writable : elem->readable, elem->err_code };
+				m_batch.push_back(STD_MOVE(pending));
+			}
+		}
+
+		bool wait_for_sockets(unsigned timeout) NOEXCEPT {
+			POSEIDON_PROFILE_ME;
+
+			boost::array< ::epoll_event, 256> events;
+			const int result = ::epoll_wait(m_epoll.get(), events.data(), static_cast<int>(events.size()), static_cast<int>(std::min<unsigned>(timeout, INT_MAX)));
+			if(result < 0){
+				const int err_code = errno;
+				if(err_code != EINTR){
+					POSEIDON_LOG_ERROR("::epoll_wait() failed! errno was ", err_code, " (", get_error_desc(err_code), ")");
+				}
+				return false;
+			}
+			if(result == 0){
 				return false;
 			}
-			if(now < it->write_time){
+			const Recursive_mutex::Unique_lock lock(m_mutex);
+			for(unsigned i = 0; i < static_cast<unsigned>(result); ++i){
+				const AUTO(handle, static_cast<Socket_table::Handle>(events[i].data.u64));
+				const AUTO(elem, m_table.find(handle));
+				if(!elem){
+					POSEIDON_LOG_TRACE("Socket reported by epoll is not registered: handle = ", handle);
+					continue;
+				}
+				const AUTO(socket, elem->weakable->lock());
+				if(!socket){
+					erase_socket_unlocked(handle, socket);
+					continue;
+				}
+				if(has_any_flags_of(events[i].events, EPOLLIN) && has_none_flags_of(events[i].events, EPOLLERR)){
+					elem->readable = true;
+					if(!m_table.is_linked(queue_throttled, handle)){
+						m_table.push_back(queue_readable, handle);
+					}
+				}
+				if(has_any_flags_of(events[i].events, EPOLLOUT) && has_none_flags_of(events[i].events, EPOLLERR)){
+					elem->writable = true;
+					m_table.push_back(queue_writable, handle);
+				}
+				if(has_any_flags_of(events[i].events, EPOLLHUP | EPOLLERR)){
+					int err_code;
+					if(socket->did_time_out()){
+						err_code = ETIMEDOUT;
+					} else if(has_any_flags_of(events[i].events, EPOLLERR)){
+						::socklen_t err_len = sizeof(err_code);
+						if(::getsockopt(socket->get_fd(), SOL_SOCKET, SO_ERROR, &err_code, &err_len) != 0){
+							err_code = errno;
+							POSEIDON_LOG_WARNING("::getsockopt() failed: fd = ", socket->get_fd(), ", err_code = ", err_code, " (", get_error_desc(err_code), ")");
+						}
+					} else {
+						err_code = 0;
+					}
+					POSEIDON_LOG(Logger::special_major | Logger::level_debug, "Socket closed: remote = ", socket->get_remote_info(), ", typeid = ", typeid(*socket).name(), ", err_code = ", err_code, " (", get_error_desc(err_code), ")");
+					elem->err_code = err_code;
+					m_table.push_back(queue_closed, handle);
+				}
+			}
+			return true;
+		}
+
+		bool pump_readable_sockets() NOEXCEPT {
+			POSEIDON_PROFILE_ME;
+
+			const AUTO(now, get_fast_mono_clock());
+			m_batch.clear();
+			{
+				const Recursive_mutex::Unique_lock lock(m_mutex);
+				// 节流的重试延迟是固定的，因此这个队列总是按照到期时间排序的，只需要检查队首。
+				for(;;){
+					const AUTO(handle, m_table.front(queue_throttled));
+					if(handle == 0){
+						break;
+					}
+					if(now < m_table.find(handle)->throttled_until){
+						break;
+					}
+					m_table.unlink(queue_throttled, handle);
+					m_table.push_back(queue_readable, handle);
+				}
+				drain_queue_unlocked(queue_readable);
+			}
+			if(m_batch.empty()){
 				return false;
 			}
-			socket = it->weakable->lock();
-			if(!socket){
-				g_socket_map.erase<2>(it);
-				return true;
+
+			for(AUTO(it, m_batch.begin()); it != m_batch.end(); ++it){
+				const AUTO_REF(socket, it->socket);
+				if(socket->is_throttled()){
+					POSEIDON_LOG(Logger::special_major | Logger::level_debug, "Socket is throttled: socket = ", socket, ", typeid = ", typeid(*socket).name());
+					it->err_code = EBUSY;
+					continue;
+				}
+
+				int err_code;
+				try {
+					err_code = socket->poll_read_and_process(m_io_buffer.data(), m_io_buffer.size(), it->ready);
+					POSEIDON_LOG_TRACE("Socket read result: socket = ", socket, ", typeid = ", typeid(*socket).name(), ", err_code = ", err_code);
+				} catch(std::exception &e){
+					POSEIDON_LOG_WARNING("std::exception thrown: what = ", e.what(), ", socket = ", socket, ", typeid = ", typeid(*socket).name());
+					err_code = ECONNRESET;
+				} catch(...){
+					POSEIDON_LOG_WARNING("Unknown exception thrown: socket = ", socket, ", typeid = ", typeid(*socket).name());
+					err_code = ECONNRESET;
+				}
+				if((err_code == 0) || (err_code == EINTR)){
+					// Success.
+				} else if((err_code == EWOULDBLOCK) || (err_code == EAGAIN)){
+					// Wait for the next edge.
+				} else {
+					POSEIDON_LOG_DEBUG("Socket read error: socket = ", socket, ", typeid = ", typeid(*socket).name(), ", err_code = ", err_code, " (", get_error_desc(err_code), ")");
+					socket->force_shutdown();
+				}
+				it->err_code = err_code;
+			}
+
+			// 边沿触发模式下，读取成功的套接字需要一直读到 EAGAIN 为止，因此把它们放回队列，下一轮接着读。
+			const Recursive_mutex::Unique_lock lock(m_mutex);
+			for(AUTO(it, m_batch.begin()); it != m_batch.end(); ++it){
+				const AUTO(elem, m_table.find(it->handle));
+				if(!elem){
+					continue;
+				}
+				if(it->err_code == EBUSY){
+					elem->throttled_until = now + 5000;
+					m_table.unlink(queue_readable, it->handle);
+					m_table.push_back(queue_throttled, it->handle);
+				} else if((it->err_code == 0) || (it->err_code == EINTR)){
+					m_table.push_back(queue_readable, it->handle);
+				}
 			}
-			writable = it->writable;
+			m_batch.clear();
+			return true;
 		}
 
-		Mutex::Unique_lock write_lock;
-		int err_code;
-		try {
-			err_code = socket->poll_write(write_lock, io_buffer.data(), io_buffer.size(), writable);
-			POSEIDON_LOG_TRACE("Socket write result: socket = ", socket, ", typeid = ", typeid(*socket).name(), ", err_code = ", err_code);
-		} catch(std::exception &e){
-			POSEIDON_LOG(Logger::special_major | Logger::level_info, "std::exception thrown: what = ", e.what(), ", socket = ", socket, ", typeid = ", typeid(*socket).name());
-			err_code = ECONNRESET;
-		} catch(...){
-			POSEIDON_LOG(Logger::special_major | Logger::level_info, "Unknown exception thrown: socket = ", socket, ", typeid = ", typeid(*socket).name());
-			err_code = ECONNRESET;
-		}
-		if((err_code == 0) || (err_code == EINTR)){
-			// Success.
-		} else if((err_code == EWOULDBLOCK) || (err_code == EAGAIN)){
-			const Recursive_mutex::Unique_lock lock(g_mutex);
-			const AUTO(it, g_socket_map.find<0>(socket.get()));
-			if(it != g_socket_map.end<0>()){
-				g_socket_map.set_key<0, 2>(it, -1ull);
-			}
-		} else {
-			POSEIDON_LOG_DEBUG("Socket write error: socket = ", socket, ", typeid = ", typeid(*socket).name(), ", err_code = ", err_code, " (", get_error_desc(err_code), ")");
-			socket->force_shutdown();
-		}
-		return true;
-	}
+		bool pump_writable_sockets() NOEXCEPT {
+			POSEIDON_PROFILE_ME;
 
-	bool pump_one_closed_socket() NOEXCEPT {
-		POSEIDON_PROFILE_ME;
+			m_batch.clear();
+			{
+				const Recursive_mutex::Unique_lock lock(m_mutex);
+				drain_queue_unlocked(queue_writable);
+			}
+			if(m_batch.empty()){
+				return false;
+			}
 
-		// const AUTO(now, get_fast_mono_clock());
-		boost::shared_ptr<Socket_base> socket;
-		int err_code;
-		{
-			const Recursive_mutex::Unique_lock lock(g_mutex);
-			const AUTO(it, g_socket_map.lower_bound<3>(0));
-			if(it == g_socket_map.end<3>()){
+			for(AUTO(it, m_batch.begin()); it != m_batch.end(); ++it){
+				const AUTO_REF(socket, it->socket);
+
+				// 套接字在出队之后再被标记为可写，会被重新放入队列，所以这里不需要持有写锁来避免丢失唤醒。
+				Mutex::Unique_lock write_lock;
+				int err_code;
+				try {
+					err_code = socket->poll_write(write_lock, m_io_buffer.data(), m_io_buffer.size(), it->ready);
+					POSEIDON_LOG_TRACE("Socket write result: socket = ", socket, ", typeid = ", typeid(*socket).name(), ", err_code = ", err_code);
+				} catch(std::exception &e){
+					POSEIDON_LOG(Logger::special_major | Logger::level_info, "std::exception thrown: what = ", e.what(), ", socket = ", socket, ", typeid = ", typeid(*socket).name());
+					err_code = ECONNRESET;
+				} catch(...){
+					POSEIDON_LOG(Logger::special_major | Logger::level_info, "Unknown exception thrown: socket = ", socket, ", typeid = ", typeid(*socket).name());
+					err_code = ECONNRESET;
+				}
+				if((err_code == 0) || (err_code == EINTR)){
+					// Success.
+				} else if((err_code == EWOULDBLOCK) || (err_code == EAGAIN)){
+					// Wait for the next edge or the next call to `mark_socket_writable()`.
+				} else {
+					POSEIDON_LOG_DEBUG("Socket write error: socket = ", socket, ", typeid = ", typeid(*socket).name(), ", err_code = ", err_code, " (", get_error_desc(err_code), ")");
+					socket->force_shutdown();
+				}
+				it->err_code = err_code;
+			}
+
+			const Recursive_mutex::Unique_lock lock(m_mutex);
+			for(AUTO(it, m_batch.begin()); it != m_batch.end(); ++it){
+				if((it->err_code != 0) && (it->err_code != EINTR)){
+					continue;
+				}
+				m_table.push_back(queue_writable, it->handle);
+			}
+			m_batch.clear();
+			return true;
+		}
+
+		bool pump_closed_sockets() NOEXCEPT {
+			POSEIDON_PROFILE_ME;
+
+			m_batch.clear();
+			{
+				const Recursive_mutex::Unique_lock lock(m_mutex);
+				drain_queue_unlocked(queue_closed);
+			}
+			if(m_batch.empty()){
 				return false;
 			}
-			socket = it->weakable->lock();
-			if(!socket){
-				g_socket_map.erase<3>(it);
-				return true;
+
+			for(AUTO(it, m_batch.begin()); it != m_batch.end(); ++it){
+				const AUTO_REF(socket, it->socket);
+				const AUTO(err_code, it->err_code);
+
+				socket->mark_shutdown();
+				try {
+					POSEIDON_LOG_DEBUG("Socket closed: socket = ", socket, ", typeid = ", typeid(*socket).name(), ", err_code = ", err_code, " (", get_error_desc(err_code), ")");
+					socket->on_close(err_code);
+				} catch(std::exception &e){
+					POSEIDON_LOG(Logger::special_major | Logger::level_info, "std::exception thrown: what = ", e.what(), ", socket = ", socket, ", typeid = ", typeid(*socket).name());
+				} catch(...){
+					POSEIDON_LOG(Logger::special_major | Logger::level_info, "Unknown exception thrown: socket = ", socket, ", typeid = ", typeid(*socket).name());
+				}
 			}
-			err_code = it->err_code;
+
+			const Recursive_mutex::Unique_lock lock(m_mutex);
+			for(AUTO(it, m_batch.begin()); it != m_batch.end(); ++it){
+				erase_socket_unlocked(it->handle, it->socket);
+			}
+			m_batch.clear();
+			return true;
 		}
 
-		socket->mark_shutdown();
-		try {
-			POSEIDON_LOG_DEBUG("Socket closed: socket = ", socket, ", typeid = ", typeid(*socket).name(), ", err_code = ", err_code, " (", get_error_desc(err_code), ")");
-			socket->on_close(err_code);
-		} catch(std::exception &e){
-			POSEIDON_LOG(Logger::special_major | Logger::level_info, "std::exception thrown: what = ", e.what(), ", socket = ", socket, ", typeid = ", typeid(*socket).name());
-		} catch(...){
-			POSEIDON_LOG(Logger::special_major | Logger::level_info, "Unknown exception thrown: socket = ", socket, ", typeid = ", typeid(*socket).name());
+		// 所有套接字共享这一个检测器，取代每个连接各自的计时器。
+		void sweep_sockets() NOEXCEPT {
+			POSEIDON_PROFILE_ME;
+
+			const AUTO(now, get_fast_mono_clock());
+			if(now < m_next_sweep_time){
+				return;
+			}
+			m_next_sweep_time = saturated_add(now, m_sweep_interval);
+
+			m_batch.clear();
+			{
+				const Recursive_mutex::Unique_lock lock(m_mutex);
+				const AUTO(slot_count, m_table.get_slot_count());
+				if(slot_count == 0){
+					return;
+				}
+				try {
+					const AUTO(batch_size, (slot_count + g_sweep_batches - 1) / g_sweep_batches);
+					for(std::size_t i = 0; i < batch_size; ++i){
+						if(m_sweep_cursor >= slot_count){
+							m_sweep_cursor = 0;
+						}
+						const AUTO(elem, m_table.get_by_slot(m_sweep_cursor++));
+						if(!elem){
+							continue;
+						}
+						AUTO(socket, elem->weakable->lock());
+						if(!socket){
+							continue;
+						}
+						Pending_socket pending = { socket->get_epoll_handle(), STD_MOVE(socket), false, 0 };
+						m_batch.push_back(STD_MOVE(pending));
+					}
+				} catch(std::exception &e){
+					POSEIDON_LOG_ERROR("std::exception thrown: what = ", e.what());
+				}
+			}
+			for(AUTO(it, m_batch.begin()); it != m_batch.end(); ++it){
+				const AUTO_REF(socket, it->socket);
+				try {
+					socket->on_sweep(now);
+				} catch(std::exception &e){
+					POSEIDON_LOG_WARNING("std::exception thrown: what = ", e.what(), ", socket = ", socket, ", typeid = ", typeid(*socket).name());
+					socket->force_shutdown();
+				} catch(...){
+					POSEIDON_LOG_WARNING("Unknown exception thrown: socket = ", socket, ", typeid = ", typeid(*socket).name());
+					socket->force_shutdown();
+				}
+			}
+			m_batch.clear();
 		}
-		const Recursive_mutex::Unique_lock lock(g_mutex);
-		const AUTO(it, g_socket_map.find<0>(socket.get()));
-		if(it != g_socket_map.end<0>()){
-			g_socket_map.erase<0>(it);
+
+		void thread_proc(){
+			POSEIDON_PROFILE_ME;
+			POSEIDON_LOG(Logger::special_major | Logger::level_info, "Epoll thread started.");
+
+			unsigned timeout = 0;
+			for(;;){
+				bool busy;
+				do {
+					// 每一轮把 epoll 报告的所有就绪套接字一次处理完，而不是每次只处理一个。
+					busy = wait_for_sockets(0);
+					busy += pump_readable_sockets();
+					busy += pump_writable_sockets();
+					busy += pump_closed_sockets();
+					// 持续繁忙时也要按时清扫，否则超时和保活都不会发生。
+					sweep_sockets();
+					timeout = std::min(timeout * 2u + 1u, !busy * 100u);
+				} while(busy);
+
+				if(!atomic_load(m_running, memory_order_consume)){
+					break;
+				}
+				wait_for_sockets(timeout);
+			}
+
+			POSEIDON_LOG(Logger::special_major | Logger::level_info, "Epoll thread stopped.");
 		}
-		return true;
-	}
 
-	void thread_proc(){
-		POSEIDON_PROFILE_ME;
-		POSEIDON_LOG(Logger::special_major | Logger::level_info, "Epoll daemon started.");
+	public:
+		void start(std::size_t io_buffer_size, boost::uint64_t sweep_period){
+			const Recursive_mutex::Unique_lock lock(m_mutex);
+			POSEIDON_THROW_UNLESS(m_epoll.reset(::epoll_create(100)), System_exception);
+			m_io_buffer.resize(io_buffer_size);
+			m_sweep_interval = std::max<boost::uint64_t>(sweep_period / g_sweep_batches, 1);
+			m_next_sweep_time = saturated_add(get_fast_mono_clock(), m_sweep_interval);
+			// 必须在创建线程之前设置，否则线程可能立即退出。
+			atomic_store(m_running, true, memory_order_release);
+			Thread(boost::bind(&Epoll_thread::thread_proc, this), Rcnts::view("   N"), Rcnts::view("Network")).swap(m_thread);
+		}
+		void stop(){
+			atomic_store(m_running, false, memory_order_release);
+		}
+		void safe_join(){
+			if(m_thread.joinable()){
+				m_thread.join();
+			}
 
-		boost::container::vector<unsigned char> io_buffer;
-		const AUTO(io_buffer_size, Main_config::get<std::size_t>("epoll_io_buffer_size", 4096));
-		io_buffer.resize(std::max<std::size_t>(io_buffer_size, 508)); // 508 is the maximum size of UDP packets guaranteed to be transmitted.
+			const Recursive_mutex::Unique_lock lock(m_mutex);
+			for(std::size_t slot = 0; slot < m_table.get_slot_count(); ++slot){
+				const AUTO(elem, m_table.get_by_slot(slot));
+				if(!elem){
+					continue;
+				}
+				const AUTO(socket, elem->weakable->lock());
+				if(!socket){
+					continue;
+				}
+				socket->set_epoll_handle(0);
+			}
+			m_table.clear();
+			m_epoll.reset();
+		}
 
-		unsigned timeout = 0;
-		for(;;){
-			bool busy;
-			do {
-				busy = wait_for_sockets(0);
-				busy += pump_one_readable_socket(io_buffer);
-				busy += pump_one_writable_socket(io_buffer);
-				busy += pump_one_closed_socket();
-				timeout = std::min(timeout * 2u + 1u, !busy * 100u);
-			} while(busy);
+		void add_socket(const boost::shared_ptr<Socket_base> &socket, bool take_ownership){
+			POSEIDON_PROFILE_ME;
+
+			const Recursive_mutex::Unique_lock lock(m_mutex);
+			POSEIDON_THROW_UNLESS(socket->get_epoll_handle() == 0, Exception, Rcnts::view("Socket is already in epoll"));
+			Socket_table::Element elem = { boost::make_shared<Weakable_socket>(take_ownership, socket), socket.get(), false, false, -1, 0 };
+			const AUTO(handle, m_table.insert(STD_MOVE(elem)));
+			try {
+				m_table.push_back(queue_readable, handle);
+				m_table.push_back(queue_writable, handle);
+				::epoll_event event = { };
+				event.events = static_cast<boost::uint32_t>(EPOLLIN | EPOLLOUT | EPOLLET);
+				event.data.u64 = handle;
+				POSEIDON_THROW_UNLESS(::epoll_ctl(m_epoll.get(), EPOLL_CTL_ADD, socket->get_fd(), &event) == 0, System_exception);
+			} catch(...){
+				m_table.erase(handle);
+				throw;
+			}
+			socket->set_epoll_handle(handle);
+		}
+		bool mark_socket_writable(const volatile Socket_base *ptr) NOEXCEPT {
+			const Recursive_mutex::Unique_lock lock(m_mutex);
+			const AUTO(handle, ptr->get_epoll_handle());
+			const AUTO(elem, m_table.find(handle));
+			if(!elem || (elem->ptr != ptr)){
+				POSEIDON_LOG_TRACE("Socket not found in epoll: ptr = ", ptr);
+				return false;
+			}
+			m_table.push_back(queue_writable, handle);
+			return true;
+		}
 
-			if(!atomic_load(g_running, memory_order_consume)){
-				break;
+		void snapshot(boost::container::vector<Epoll_daemon::Snapshot_element> &ret) const {
+			const Recursive_mutex::Unique_lock lock(m_mutex);
+			ret.reserve(ret.size() + m_table.size());
+			for(std::size_t slot = 0; slot < m_table.get_slot_count(); ++slot){
+				const AUTO(elem, m_table.get_by_slot(slot));
+				if(!elem){
+					continue;
+				}
+				const AUTO(socket, elem->weakable->lock());
+				if(!socket){
+					continue;
+				}
+				Epoll_daemon::Snapshot_element info = { };
+				info.remote_info = socket->get_remote_info();
+				info.local_info = socket->get_local_info();
+				info.creation_time = socket->get_creation_time();
+				info.listening = socket->is_listening();
+				info.readable = elem->readable;
+				info.writable = elem->writable;
+				ret.push_back(STD_MOVE(info));
 			}
-			wait_for_sockets(timeout);
 		}
+	};
+
+	volatile bool g_running = false;
+
+	typedef boost::container::vector<boost::shared_ptr<Epoll_thread> > Thread_vector;
 
-		POSEIDON_LOG(Logger::special_major | Logger::level_info, "Epoll daemon stopped.");
+	// 线程数组在启动时一次性构造好再发布，之后不再改变，因此查找线程时无需加锁。
+	// 停止时只撤下指针，数组本身直到进程退出才释放，因为其他线程可能仍然持有它。
+	const Thread_vector *volatile g_threads = NULLPTR;
+	boost::container::vector<boost::shared_ptr<const Thread_vector> > g_retired_threads;
+
+	Epoll_thread & get_thread_for(const Thread_vector &threads, const volatile Socket_base *ptr){
+		// 对象地址的低位总是零，需要先去掉。
+		const AUTO(seed, static_cast<boost::uint64_t>(reinterpret_cast<boost::uintptr_t>(ptr)) / 64);
+		const AUTO(i, static_cast<std::size_t>(seed % threads.size()));
+		return *(threads.at(i));
 	}
 }
 
@@ -312,8 +732,25 @@ void Epoll_daemon::start(){
 	}
 	POSEIDON_LOG(Logger::special_major | Logger::level_info, "Starting epoll daemon...");
 
-	POSEIDON_THROW_UNLESS(g_epoll.reset(::epoll_create(100)), System_exception);
-	Thread(&thread_proc, Rcnts::view("   N"), Rcnts::view("Network")).swap(g_thread);
+	const AUTO(thread_count, Main_config::get<std::size_t>("epoll_thread_count", 1));
+	if(thread_count == 0){
+		POSEIDON_LOG_FATAL("You shall not set `epoll_thread_count` in `main.conf` to zero.");
+		std::terminate();
+	}
+	const AUTO(io_buffer_size, Main_config::get<std::size_t>("epoll_io_buffer_size", 4096));
+	const AUTO(sweep_period, Main_config::get<boost::uint64_t>("tcp_shutdown_timer_period", 15000));
+	const AUTO(threads, boost::make_shared<Thread_vector>());
+	threads->resize(thread_count);
+	for(std::size_t i = 0; i < threads->size(); ++i){
+		POSEIDON_LOG(Logger::special_major | Logger::level_debug, "Creating epoll thread ", i);
+		const AUTO(thread, boost::make_shared<Epoll_thread>());
+		thread->start(std::max<std::size_t>(io_buffer_size, 508), sweep_period); // 508 is the maximum size of UDP packets guaranteed to be transmitted.
+		threads->at(i) = thread;
+	}
+	g_retired_threads.push_back(threads);
+	atomic_store(g_threads, threads.get(), memory_order_release);
+
+	POSEIDON_LOG(Logger::special_major | Logger::level_info, "Epoll daemon started.");
 }
 void Epoll_daemon::stop(){
 	if(atomic_exchange(g_running, false, memory_order_acq_rel) == false){
@@ -321,65 +758,51 @@ void Epoll_daemon::stop(){
 	}
 	POSEIDON_LOG(Logger::special_major | Logger::level_info, "Stopping epoll daemon...");
 
-	if(g_thread.joinable()){
-		g_thread.join();
+	const AUTO(threads, atomic_exchange(g_threads, static_cast<const Thread_vector *>(NULLPTR), memory_order_acq_rel));
+	if(!threads){
+		return;
+	}
+	for(std::size_t i = 0; i < threads->size(); ++i){
+		const AUTO_REF(thread, threads->at(i));
+		POSEIDON_LOG(Logger::special_major | Logger::level_info, "Stopping epoll thread ", i);
+		thread->stop();
+	}
+	for(std::size_t i = 0; i < threads->size(); ++i){
+		const AUTO_REF(thread, threads->at(i));
+		POSEIDON_LOG(Logger::special_major | Logger::level_info, "Waiting for epoll thread ", i, " to terminate...");
+		thread->safe_join();
 	}
 
-	const Recursive_mutex::Unique_lock lock(g_mutex);
-	g_socket_map.clear();
-	g_epoll.reset();
+	POSEIDON_LOG(Logger::special_major | Logger::level_info, "Epoll daemon stopped.");
 }
 
 void Epoll_daemon::add_socket(const boost::shared_ptr<Socket_base> &socket, bool take_ownership){
 	POSEIDON_PROFILE_ME;
 
-	const AUTO(now, get_fast_mono_clock());
-	const Recursive_mutex::Unique_lock lock(g_mutex);
-	Socket_element elem = { boost::make_shared<Weakable_socket>(take_ownership, socket), socket.get(), now, now, -1 };
-	const AUTO(result, g_socket_map.insert(STD_MOVE(elem)));
-	POSEIDON_THROW_UNLESS(result.second, Exception, Rcnts::view("Socket is already in epoll"));
-	try {
-		::epoll_event event = { };
-		event.events = static_cast<boost::uint32_t>(EPOLLIN | EPOLLOUT | EPOLLET);
-		event.data.ptr = socket.get();
-		POSEIDON_THROW_UNLESS(::epoll_ctl(g_epoll.get(), EPOLL_CTL_ADD, socket->get_fd(), &event) == 0, System_exception);
-	} catch(...){
-		g_socket_map.erase(result.first);
-		throw;
-	}
+	const AUTO(threads, atomic_load(g_threads, memory_order_consume));
+	POSEIDON_THROW_UNLESS(threads, Basic_exception, Rcnts::view("Epoll daemon is not running"));
+	get_thread_for(*threads, socket.get()).add_socket(socket, take_ownership);
 }
 bool Epoll_daemon::mark_socket_writable(const volatile Socket_base *ptr) NOEXCEPT {
 	POSEIDON_PROFILE_ME;
 
-	const Recursive_mutex::Unique_lock lock(g_mutex);
-	const AUTO(it, g_socket_map.find<0>(ptr));
-	if(it == g_socket_map.end()){
-		POSEIDON_LOG_TRACE("Socket not found in epoll: ptr = ", ptr);
+	const AUTO(threads, atomic_load(g_threads, memory_order_consume));
+	if(!threads){
+		POSEIDON_LOG_TRACE("Epoll daemon is not running: ptr = ", ptr);
 		return false;
 	}
-	const AUTO(now, get_fast_mono_clock());
-	g_socket_map.set_key<0, 2>(it, now);
-	return true;
+	return get_thread_for(*threads, ptr).mark_socket_writable(ptr);
 }
 
 void Epoll_daemon::snapshot(boost::container::vector<Epoll_daemon::Snapshot_element> &ret){
 	POSEIDON_PROFILE_ME;
 
-	const Recursive_mutex::Unique_lock lock(g_mutex);
-	ret.reserve(ret.size() + g_socket_map.size());
-	for(AUTO(it, g_socket_map.begin()); it != g_socket_map.end(); ++it){
-		const AUTO(socket, it->weakable->lock());
-		if(!socket){
-			continue;
-		}
-		Snapshot_element elem = { };
-		elem.remote_info = socket->get_remote_info();
-		elem.local_info = socket->get_local_info();
-		elem.creation_time = socket->get_creation_time();
-		elem.listening = socket->is_listening();
-		elem.readable = it->readable;
-		elem.writable = it->writable;
-		ret.push_back(STD_MOVE(elem));
+	const AUTO(threads, atomic_load(g_threads, memory_order_consume));
+	if(!threads){
+		return;
+	}
+	for(std::size_t i = 0; i < threads->size(); ++i){
+		threads->at(i)->snapshot(ret);
 	}
 }
 
@@ -4,8 +4,8 @@
 #include "../precompiled.hpp"
 #include "job_dispatcher.hpp"
 #include "main_config.hpp"
-#include <ucontext.h>
 #include <sys/mman.h>
+#include <unistd.h>
 #include "../job_base.hpp"
 #include "../promise.hpp"
 #include "../atomic.hpp"
@@ -13,10 +13,120 @@
 #include "../log.hpp"
 #include "../profiler.hpp"
 #include "../mutex.hpp"
-#include "../recursive_mutex.hpp"
 #include "../condition_variable.hpp"
 #include "../time.hpp"
 #include "../checked_arithmetic.hpp"
+#include "../thread.hpp"
+#include <boost/version.hpp>
+
+// 只保存被调用者保存的寄存器，不像 `swapcontext()` 那样每次都调用 `rt_sigprocmask`。
+#if defined(POSEIDON_ENABLE_ASM_CONTEXT) && (defined(__x86_64__) || defined(__aarch64__))
+#  define POSEIDON_JOB_DISPATCHER_ASM_CONTEXT_   1
+#else
+#  include <ucontext.h>
+#endif
+
+#ifdef POSEIDON_JOB_DISPATCHER_ASM_CONTEXT_
+extern "C" {
+	// 把被调用者保存的寄存器压入当前栈，栈指针存入 `*save_sp`，然后切换到 `new_sp` 并弹出那里保存的寄存器。
+	__attribute__((__visibility__("hidden"))) void poseidon_job_dispatcher_switch_context(void **save_sp, void *new_sp);
+	// 新纤程的第一次切换返回到这里，然后以第一个参数调用入口函数。入口函数不得返回。
+	__attribute__((__visibility__("hidden"))) void poseidon_job_dispatcher_fiber_trampoline();
+}
+
+#  if defined(__x86_64__)
+__asm__(
+	"	.text\n"
+	"	.p2align 4\n"
+	"	.globl poseidon_job_dispatcher_switch_context\n"
+	"	.hidden poseidon_job_dispatcher_switch_context\n"
+	"	.type poseidon_job_dispatcher_switch_context, @function\n"
+	"poseidon_job_dispatcher_switch_context:\n"
+	"	pushq %rbp\n"
+	"	pushq %rbx\n"
+	"	pushq %r12\n"
+	"	pushq %r13\n"
+	"	pushq %r14\n"
+	"	pushq %r15\n"
+	"	subq $16, %rsp\n"
+	"	stmxcsr 8(%rsp)\n"
+	"	fnstcw (%rsp)\n"
+	"	movq %rsp, (%rdi)\n"
+	"	movq %rsi, %rsp\n"
+	"	fldcw (%rsp)\n"
+	"	ldmxcsr 8(%rsp)\n"
+	"	addq $16, %rsp\n"
+	"	popq %r15\n"
+	"	popq %r14\n"
+	"	popq %r13\n"
+	"	popq %r12\n"
+	"	popq %rbx\n"
+	"	popq %rbp\n"
+	"	ret\n"
+	"	.size poseidon_job_dispatcher_switch_context, . - poseidon_job_dispatcher_switch_context\n"
+	"	.p2align 4\n"
+	"	.globl poseidon_job_dispatcher_fiber_trampoline\n"
+	"	.hidden poseidon_job_dispatcher_fiber_trampoline\n"
+	"	.type poseidon_job_dispatcher_fiber_trampoline, @function\n"
+	"poseidon_job_dispatcher_fiber_trampoline:\n"
+	"	.cfi_startproc\n"
+	"	.cfi_undefined rip\n"
+	"	movq %r12, %rdi\n"
+	"	callq *%r13\n"
+	"	ud2\n"
+	"	.cfi_endproc\n"
+	"	.size poseidon_job_dispatcher_fiber_trampoline, . - poseidon_job_dispatcher_fiber_trampoline\n"
+);
+#  elif defined(__aarch64__)
+__asm__(
+	"	.text\n"
+	"	.p2align 4\n"
+	"	.globl poseidon_job_dispatcher_switch_context\n"
+	"	.hidden poseidon_job_dispatcher_switch_context\n"
+	"	.type poseidon_job_dispatcher_switch_context, %function\n"
+	"poseidon_job_dispatcher_switch_context:\n"
+	"	sub sp, sp, #176\n"
+	"	stp x19, x20, [sp, #0]\n"
+	"	stp x21, x22, [sp, #16]\n"
+	"	stp x23, x24, [sp, #32]\n"
+	"	stp x25, x26, [sp, #48]\n"
+	"	stp x27, x28, [sp, #64]\n"
+	"	stp x29, x30, [sp, #80]\n"
+	"	stp d8, d9, [sp, #96]\n"
+	"	stp d10, d11, [sp, #112]\n"
+	"	stp d12, d13, [sp, #128]\n"
+	"	stp d14, d15, [sp, #144]\n"
+	"	mov x2, sp\n"
+	"	str x2, [x0]\n"
+	"	mov sp, x1\n"
+	"	ldp x19, x20, [sp, #0]\n"
+	"	ldp x21, x22, [sp, #16]\n"
+	"	ldp x23, x24, [sp, #32]\n"
+	"	ldp x25, x26, [sp, #48]\n"
+	"	ldp x27, x28, [sp, #64]\n"
+	"	ldp x29, x30, [sp, #80]\n"
+	"	ldp d8, d9, [sp, #96]\n"
+	"	ldp d10, d11, [sp, #112]\n"
+	"	ldp d12, d13, [sp, #128]\n"
+	"	ldp d14, d15, [sp, #144]\n"
+	"	add sp, sp, #176\n"
+	"	ret\n"
+	"	.size poseidon_job_dispatcher_switch_context, . - poseidon_job_dispatcher_switch_context\n"
+	"	.p2align 4\n"
+	"	.globl poseidon_job_dispatcher_fiber_trampoline\n"
+	"	.hidden poseidon_job_dispatcher_fiber_trampoline\n"
+	"	.type poseidon_job_dispatcher_fiber_trampoline, %function\n"
+	"poseidon_job_dispatcher_fiber_trampoline:\n"
+	"	.cfi_startproc\n"
+	"	.cfi_undefined x30\n"
+	"	mov x0, x19\n"
+	"	blr x20\n"
+	"	brk #0\n"
+	"	.cfi_endproc\n"
+	"	.size poseidon_job_dispatcher_fiber_trampoline, . - poseidon_job_dispatcher_fiber_trampoline\n"
+);
+#  endif
+#endif
 
 namespace Poseidon {
 
@@ -36,86 +146,203 @@ namespace {
 		bool insignificant;
 	};
 
-	struct Stack_storage FINAL {
-		static void *operator new(std::size_t cb){
-			assert(cb == sizeof(Stack_storage));
-			(void)cb;
+	// 栈的最低一页不可访问，栈溢出时会立即触发段错误，而不是悄悄地破坏相邻的内存。
+	// 物理内存是在第一次访问时才分配的，因此较大的栈并不会浪费物理内存，除非真的用到了。
+	// 但是栈不能增长：每个栈都占用完整的 `job_fiber_stack_size` 加一页的地址空间，`MAP_NORESERVE` 只是不计入内存承诺。
+	// 栈上的地址可能被保存在任何地方，无法移动，所以按需增长也只能预留同样大小的地址空间。
+	// 同时挂起的任务很多时，应当减小 `job_fiber_stack_size`。
+	class Stack_storage : NONCOPYABLE {
+	public:
+		static std::size_t get_page_size() NOEXCEPT {
+			static const std::size_t s_page_size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+			return s_page_size;
+		}
+
+	private:
+		void *m_map;
+		std::size_t m_map_size;
+		bool m_trimmed;
 
-			void *const ptr = mmap(NULLPTR, sizeof(Stack_storage), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+	public:
+		explicit Stack_storage(std::size_t size)
+			: m_map(NULLPTR), m_map_size(checked_add(size, get_page_size())), m_trimmed(true)
+		{
+			void *const ptr = ::mmap(NULLPTR, m_map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK | MAP_NORESERVE, -1, 0);
 			if(ptr == MAP_FAILED){
 				const int err_code = errno;
 				POSEIDON_LOG_ERROR("Failed to allocate stack: err_code = ", err_code);
 				throw std::bad_alloc();
 			}
-			return ptr;
+			if(::mprotect(ptr, get_page_size(), PROT_NONE) != 0){
+				const int err_code = errno;
+				POSEIDON_LOG_ERROR("Failed to protect stack guard page: err_code = ", err_code);
+				::munmap(ptr, m_map_size);
+				throw std::bad_alloc();
+			}
+			m_map = ptr;
 		}
-		static void operator delete(void *ptr) NOEXCEPT {
-			if(::munmap(ptr, sizeof(Stack_storage)) != 0){
+		~Stack_storage(){
+			if(::munmap(m_map, m_map_size) != 0){
 				const int err_code = errno;
 				POSEIDON_LOG_ERROR("Failed to deallocate stack: err_code = ", err_code);
 				std::terminate();
 			}
 		}
 
-		char bytes[0x40000];
+	public:
+		void * get_bottom() const NOEXCEPT {
+			return static_cast<char *>(m_map) + get_page_size();
+		}
+		std::size_t get_size() const NOEXCEPT {
+			return m_map_size - get_page_size();
+		}
+		// 包含保护页。
+		std::size_t get_map_size() const NOEXCEPT {
+			return m_map_size;
+		}
+
+		// 归还物理内存，地址空间保持不变。再次使用时内核会分配全零的页。
+		bool trim() NOEXCEPT {
+			if(m_trimmed){
+				return false;
+			}
+			if(::madvise(get_bottom(), get_size(), MADV_DONTNEED) != 0){
+				const int err_code = errno;
+				POSEIDON_LOG_WARNING("Failed to trim stack: err_code = ", err_code);
+				return false;
+			}
+			m_trimmed = true;
+			return true;
+		}
+		void mark_used() NOEXCEPT {
+			m_trimmed = false;
+		}
+	};
+
+	struct Stack_pool_statistics {
+		std::size_t stack_size;
+		std::size_t stacks_in_use;
+		std::size_t stacks_pooled;
+		unsigned long long stacks_mapped;
+		unsigned long long stacks_unmapped;
+		unsigned long long pool_hits;
+		unsigned long long stacks_trimmed;
+		unsigned long long address_space;
 	};
 
+	// 空闲的栈按照后进先出的顺序复用，最近用过的栈的页很可能还在 TLB 和缓存中。
+	// 超出 `trim_threshold` 的栈不太可能很快被再次用到，因此归还其物理内存。
 	class Fiber_stack_allocator : NONCOPYABLE {
 	private:
 		mutable Mutex m_mutex;
-		boost::array<boost::scoped_ptr<Stack_storage>, 64> m_pool;
-		std::size_t m_size;
+		std::size_t m_stack_size;
+		std::size_t m_pool_capacity;
+		std::size_t m_trim_threshold;
+		boost::container::vector<boost::shared_ptr<Stack_storage> > m_pool;
+		Stack_pool_statistics m_stats;
 
 	public:
 		Fiber_stack_allocator()
-			: m_mutex(), m_pool(), m_size(0)
+			: m_mutex(), m_stack_size(0x40000), m_pool_capacity(64), m_trim_threshold(64), m_pool()
 		{
-			//
+			m_pool.reserve(m_pool_capacity);
+			std::memset(&m_stats, 0, sizeof(m_stats));
 		}
 
 	public:
-		void allocate(boost::scoped_ptr<Stack_storage> &ptr){
+		void set_parameters(std::size_t stack_size, std::size_t pool_capacity, std::size_t trim_threshold){
 			const Mutex::Unique_lock lock(m_mutex);
-			if(m_size == 0){
-				ptr.reset(new Stack_storage);
+			const AUTO(page_size, Stack_storage::get_page_size());
+			m_stack_size = checked_add(stack_size, page_size - 1) / page_size * page_size;
+			m_pool_capacity = pool_capacity;
+			m_trim_threshold = trim_threshold;
+			for(AUTO(it, m_pool.begin()); it != m_pool.end(); ++it){
+				m_stats.address_space -= (*it)->get_map_size();
+				m_stats.stacks_unmapped += 1;
+			}
+			m_pool.clear();
+			m_pool.reserve(pool_capacity);
+		}
+
+		void allocate(boost::shared_ptr<Stack_storage> &ptr){
+			const Mutex::Unique_lock lock(m_mutex);
+			if(m_pool.empty()){
+				ptr = boost::make_shared<Stack_storage>(m_stack_size);
+				m_stats.stacks_mapped += 1;
+				m_stats.address_space += ptr->get_map_size();
 			} else {
-				ptr.swap(m_pool.at(--m_size));
+				ptr.swap(m_pool.back());
+				m_pool.pop_back();
+				m_stats.pool_hits += 1;
 			}
+			ptr->mark_used();
+			m_stats.stacks_in_use += 1;
 		}
-		void deallocate(boost::scoped_ptr<Stack_storage> &ptr) NOEXCEPT {
+		void deallocate(boost::shared_ptr<Stack_storage> &ptr) NOEXCEPT {
 			const Mutex::Unique_lock lock(m_mutex);
-			if(m_size == m_pool.size()){
+			m_stats.stacks_in_use -= 1;
+			if((m_pool.size() >= m_pool_capacity) || (ptr->get_size() != m_stack_size)){
+				m_stats.address_space -= ptr->get_map_size();
 				ptr.reset();
-			} else {
-				ptr.swap(m_pool.at(m_size++));
+				m_stats.stacks_unmapped += 1;
+				return;
+			}
+			m_pool.push_back(STD_MOVE(ptr));
+			ptr.reset();
+			if(m_pool.size() > m_trim_threshold){
+				// 刚刚被挤出热区的那个栈。
+				const AUTO_REF(cold, m_pool.at(m_pool.size() - 1 - m_trim_threshold));
+				m_stats.stacks_trimmed += cold->trim();
 			}
 		}
-	} g_stack_allocator;
 
+		Stack_pool_statistics get_statistics() const {
+			const Mutex::Unique_lock lock(m_mutex);
+			Stack_pool_statistics stats = m_stats;
+			stats.stack_size = m_stack_size;
+			stats.stacks_pooled = m_pool.size();
+			return stats;
+		}
+	};
+
+	// 以下数据结构只由所属的调度线程访问。
 	struct Fiber_control : NONCOPYABLE {
-		struct Initializer { };
+		struct Initializer {
+			Fiber_stack_allocator *stack_allocator;
+			boost::shared_ptr<Promise::Waiter_base> waiter;
+		};
 
-		Recursive_mutex queue_mutex;
 		boost::container::deque<Job_element> queue;
 
 		Fiber_state state;
-		boost::scoped_ptr<Stack_storage> stack;
+		bool ready_queued; // 是否已在就绪队列中。
+		boost::shared_ptr<Promise::Waiter_base> waiter;
+		Fiber_stack_allocator *stack_allocator;
+		boost::shared_ptr<Stack_storage> stack;
+#ifdef POSEIDON_JOB_DISPATCHER_ASM_CONTEXT_
+		void *inner; // 保存的栈指针。
+		void *outer;
+#else
 		::ucontext_t inner;
 		::ucontext_t outer;
+#endif
 
-		explicit Fiber_control(Initializer){
+		explicit Fiber_control(Initializer init){
 			state = fiber_state_ready;
-			g_stack_allocator.allocate(stack);
+			ready_queued = false;
+			waiter = STD_MOVE(init.waiter);
+			stack_allocator = init.stack_allocator;
+			stack_allocator->allocate(stack);
 #ifndef NDEBUG
-			std::memset(&inner, 0xCC, sizeof(outer));
+			std::memset(&inner, 0xCC, sizeof(inner));
 			std::memset(&outer, 0xCC, sizeof(outer));
 #endif
 		}
 		~Fiber_control(){
 			assert(state == fiber_state_ready);
-			g_stack_allocator.deallocate(stack);
+			stack_allocator->deallocate(stack);
 #ifndef NDEBUG
-			std::memset(&inner, 0xCC, sizeof(outer));
+			std::memset(&inner, 0xCC, sizeof(inner));
 			std::memset(&outer, 0xCC, sizeof(outer));
 #endif
 		}
@@ -123,16 +350,103 @@ namespace {
 
 	__thread Fiber_control *volatile t_current_fiber = 0; // XXX: NULLPTR
 
-	Mutex g_fiber_map_mutex;
-	Condition_variable g_new_job;
-	boost::container::map<boost::weak_ptr<const void>, Fiber_control> g_fiber_map;
+	struct Submission : NONCOPYABLE {
+		Submission *next;
+		boost::weak_ptr<const void> category;
+		boost::shared_ptr<Job_base> job; // 为空指针表示唤醒 `category` 对应的纤程。
+		boost::shared_ptr<const bool> withdrawn;
+	};
+
+	// 多生产者单消费者的无锁队列。
+	// 生产者用 CAS 把元素压入一个栈，消费者一次取走整个栈，再反转为先进先出的顺序。
+	class Submission_queue : NONCOPYABLE {
+	private:
+		Submission *volatile m_head;
 
-	void fiber_proc(int low, int high) NOEXCEPT {
-		POSEIDON_PROFILE_ME;
+	public:
+		CONSTEXPR Submission_queue() NOEXCEPT
+			: m_head(NULLPTR)
+		{
+			//
+		}
+		~Submission_queue(){
+			AUTO(sub, m_head);
+			while(sub){
+				const AUTO(next, sub->next);
+				delete sub;
+				sub = next;
+			}
+		}
 
-		Fiber_control *fiber;
-		const int params[2] = { low, high };
-		std::memcpy(&fiber, params, sizeof(fiber));
+	public:
+		bool empty() const NOEXCEPT {
+			return !atomic_load(m_head, memory_order_relaxed);
+		}
+		// 如果队列原来是空的，返回 true。
+		bool push(Submission *sub) NOEXCEPT {
+			AUTO(head, atomic_load(m_head, memory_order_relaxed));
+			do {
+				sub->next = head;
+			} while(!atomic_compare_exchange(m_head, head, sub, memory_order_release, memory_order_relaxed));
+			return !head;
+		}
+		// 只能由消费者调用。
+		Submission * pop_all() NOEXCEPT {
+			AUTO(head, atomic_exchange(m_head, static_cast<Submission *>(NULLPTR), memory_order_acquire));
+			Submission *fifo = NULLPTR;
+			while(head){
+				const AUTO(next, head->next);
+				head->next = fifo;
+				fifo = head;
+				head = next;
+			}
+			return fifo;
+		}
+	};
+
+	// 纤程的唤醒者持有它的共享指针，因此它可能比所属的调度线程活得更久。
+	struct Job_inbox : NONCOPYABLE {
+		Submission_queue submissions;
+		// 这个互斥锁只用于在队列由空变为非空时唤醒调度线程。
+		Mutex new_job_mutex;
+		Condition_variable new_job;
+
+		void push(Submission *sub) NOEXCEPT {
+			if(submissions.push(sub)){
+				const Mutex::Unique_lock lock(new_job_mutex);
+				new_job.signal();
+			}
+		}
+	};
+
+	// Promise 被满足时把对应的纤程放回所属调度线程的就绪队列。
+	class Fiber_waiter : public Promise::Waiter_base {
+	private:
+		const boost::shared_ptr<Job_inbox> m_inbox;
+		const boost::weak_ptr<const void> m_category;
+
+	public:
+		Fiber_waiter(boost::shared_ptr<Job_inbox> inbox, boost::weak_ptr<const void> category)
+			: m_inbox(STD_MOVE(inbox)), m_category(STD_MOVE(category))
+		{
+			//
+		}
+
+	public:
+		void on_promise_satisfied() NOEXCEPT OVERRIDE {
+			try {
+				const AUTO(sub, new Submission);
+				sub->category = m_category;
+				m_inbox->push(sub);
+			} catch(std::exception &e){
+				// 纤程会在超时检查时被恢复。
+				POSEIDON_LOG_ERROR("std::exception thrown: what = ", e.what());
+			}
+		}
+	};
+
+	void fiber_proc(Fiber_control *fiber) NOEXCEPT {
+		POSEIDON_PROFILE_ME;
 
 		POSEIDON_LOG_TRACE("Entering fiber ", static_cast<void *>(fiber));
 		try {
@@ -147,23 +461,88 @@ namespace {
 		fiber->state = fiber_state_ready;
 	}
 
+#ifdef POSEIDON_JOB_DISPATCHER_ASM_CONTEXT_
+	void fiber_entry(Fiber_control *fiber) NOEXCEPT {
+		fiber_proc(fiber);
+		// 切换出去之后这个栈就被丢弃了，下次调度时会重新初始化。
+		::poseidon_job_dispatcher_switch_context(&(fiber->inner), fiber->outer);
+		std::terminate();
+	}
+
+	void initialize_fiber_context(Fiber_control *fiber) NOEXCEPT {
+		// 伪造一个被 `poseidon_job_dispatcher_switch_context()` 保存的栈帧，使第一次切换返回到 trampoline 中。
+		const AUTO(top, reinterpret_cast<boost::uintptr_t>(fiber->stack->get_bottom()) + fiber->stack->get_size());
+#  if defined(__x86_64__)
+		// 从低地址到高地址：x87 控制字，MXCSR，r15，r14，r13，r12，rbx，rbp，返回地址。
+		// 进入 trampoline 时栈指针按 16 字节对齐，这样 `callq` 之后满足 ABI 的要求。
+		const AUTO(frame, reinterpret_cast<boost::uint64_t *>((top & ~static_cast<boost::uintptr_t>(15)) - 88));
+		std::memset(frame, 0, 88);
+		frame[0] = 0x037F;
+		frame[1] = 0x1F80;
+		frame[4] = reinterpret_cast<boost::uintptr_t>(&fiber_entry);
+		frame[5] = reinterpret_cast<boost::uintptr_t>(fiber);
+		frame[8] = reinterpret_cast<boost::uintptr_t>(&::poseidon_job_dispatcher_fiber_trampoline);
+#  elif defined(__aarch64__)
+		// 从低地址到高地址：x19 到 x30，d8 到 d15，填充。
+		const AUTO(frame, reinterpret_cast<boost::uint64_t *>((top & ~static_cast<boost::uintptr_t>(15)) - 176));
+		std::memset(frame, 0, 176);
+		frame[0] = reinterpret_cast<boost::uintptr_t>(fiber);
+		frame[1] = reinterpret_cast<boost::uintptr_t>(&fiber_entry);
+		frame[11] = reinterpret_cast<boost::uintptr_t>(&::poseidon_job_dispatcher_fiber_trampoline);
+#  endif
+		fiber->inner = frame;
+	}
+	void switch_into_fiber(Fiber_control *fiber) NOEXCEPT {
+		::poseidon_job_dispatcher_switch_context(&(fiber->outer), fiber->inner);
+	}
+	void switch_out_of_fiber(Fiber_control *fiber) NOEXCEPT {
+		::poseidon_job_dispatcher_switch_context(&(fiber->inner), fiber->outer);
+	}
+#else
+	void fiber_proc_ucontext(int low, int high) NOEXCEPT {
+		Fiber_control *fiber;
+		const int params[2] = { low, high };
+		std::memcpy(&fiber, params, sizeof(fiber));
+
+		fiber_proc(fiber);
+	}
+
+	void initialize_fiber_context(Fiber_control *fiber) NOEXCEPT {
+		if(::getcontext(&(fiber->inner)) != 0){
+			const int err_code = errno;
+			POSEIDON_LOG_FATAL("::getcontext() failed: err_code = ", err_code);
+			std::terminate();
+		}
+		fiber->inner.uc_stack.ss_sp = fiber->stack->get_bottom();
+		fiber->inner.uc_stack.ss_size = fiber->stack->get_size();
+		fiber->inner.uc_link = &(fiber->outer);
+
+		int params[2] = { };
+		BOOST_STATIC_ASSERT(sizeof(fiber) <= sizeof(params));
+		std::memcpy(params, &fiber, sizeof(fiber));
+		::makecontext(&(fiber->inner), reinterpret_cast<void (*)()>(&fiber_proc_ucontext), 2, params[0], params[1]);
+	}
+	void switch_into_fiber(Fiber_control *fiber) NOEXCEPT {
+		if(::swapcontext(&(fiber->outer), &(fiber->inner)) != 0){
+			const int err_code = errno;
+			POSEIDON_LOG_FATAL("::swapcontext() failed: err_code = ", err_code);
+			std::terminate();
+		}
+	}
+	void switch_out_of_fiber(Fiber_control *fiber) NOEXCEPT {
+		if(::swapcontext(&(fiber->inner), &(fiber->outer)) != 0){
+			const int err_code = errno;
+			POSEIDON_LOG_FATAL("::swapcontext() failed: err_code = ", err_code);
+			std::terminate();
+		}
+	}
+#endif
+
 	void schedule_fiber(Fiber_control *fiber) NOEXCEPT {
 		POSEIDON_PROFILE_ME;
 
 		if(fiber->state == fiber_state_ready){
-			if(::getcontext(&(fiber->inner)) != 0){
-				const int err_code = errno;
-				POSEIDON_LOG_FATAL("::getcontext() failed: err_code = ", err_code);
-				std::terminate();
-			}
-			fiber->inner.uc_stack.ss_sp = fiber->stack.get();
-			fiber->inner.uc_stack.ss_size = sizeof(*(fiber->stack));
-			fiber->inner.uc_link = &(fiber->outer);
-
-			int params[2] = { };
-			BOOST_STATIC_ASSERT(sizeof(fiber) <= sizeof(params));
-			std::memcpy(params, &fiber, sizeof(fiber));
-			::makecontext(&(fiber->inner), reinterpret_cast<void (*)()>(&fiber_proc), 2, params[0], params[1]);
+			initialize_fiber_context(fiber);
 		}
 
 		t_current_fiber = fiber;
@@ -174,11 +553,7 @@ namespace {
 				std::terminate();
 			}
 			fiber->state = fiber_state_running;
-			if(::swapcontext(&(fiber->outer), &(fiber->inner)) != 0){
-				const int err_code = errno;
-				POSEIDON_LOG_FATAL("::swapcontext() failed: err_code = ", err_code);
-				std::terminate();
-			}
+			switch_into_fiber(fiber);
 		}
 		Profiler::end_stack_switch(profiler_hook);
 		t_current_fiber = NULLPTR;
@@ -189,97 +564,407 @@ namespace {
 
 		const AUTO(now, get_fast_mono_clock());
 
-		Job_element *elem;
-		{
-			const Recursive_mutex::Unique_lock queue_lock(fiber->queue_mutex);
-			if(fiber->queue.empty()){
+		if(fiber->queue.empty()){
+			return false;
+		}
+		const AUTO(elem, &(fiber->queue.front()));
+		if(elem->promise && !elem->promise->is_satisfied()){
+			if((now < elem->expiry_time) && !(elem->insignificant && force_expiry)){
 				return false;
 			}
-			elem = &(fiber->queue.front());
-			if(elem->promise && !elem->promise->is_satisfied()){
-				if((now < elem->expiry_time) && !(elem->insignificant && force_expiry)){
-					return false;
-				}
-				POSEIDON_LOG_WARNING("Job timed out");
-			}
-			elem->promise.reset();
+			POSEIDON_LOG_WARNING("Job timed out");
 		}
+		elem->promise.reset();
 		if((fiber->state == fiber_state_ready) && elem->withdrawn && *(elem->withdrawn)){
 			POSEIDON_LOG_DEBUG("Job is withdrawn");
 		} else {
 			schedule_fiber(fiber);
 		}
 		if(fiber->state == fiber_state_ready){
-			const Recursive_mutex::Unique_lock queue_lock(fiber->queue_mutex);
 			fiber->queue.pop_front();
 		}
 		return true;
 	}
-	bool pump_one_round(bool force_expiry) NOEXCEPT {
-		POSEIDON_PROFILE_ME;
+	// 计入已提交但尚未完成的任务，用于在停止时等待所有线程上的任务都执行完。
+	volatile std::size_t g_pending_jobs = 0;
+
+#if BOOST_VERSION < 107400
+	// 旧版本的 Boost 不能对 weak_ptr 的控制块求哈希，而 `lock().get()` 在类别过期之后是空指针，对于别名指针也与控制块无关。
+	// 因此按 `owner_before()` 记录每个类别被分配到的线程，直到这个类别的任务全部完成。
+	// 注意有多个调度线程时每次提交和完成任务都要锁住 `g_route_mutex`，多个线程同时提交任务时这里会成为瓶颈。
+	struct Category_route {
+		std::size_t index;
+		std::size_t count;
+	};
+
+	Mutex g_route_mutex;
+	boost::container::map<boost::weak_ptr<const void>, Category_route> g_routes;
+	std::size_t g_next_route_index = 0;
+	// 只有一个调度线程时不会分配路由，完成任务时也就不必查找。在发布线程数组之前设置。
+	volatile bool g_routing = false;
+#endif
+
+	// 一个类别中的 `count` 个任务已经完成或者被丢弃。
+	void release_category(const boost::weak_ptr<const void> &category, std::size_t count) NOEXCEPT {
+#if BOOST_VERSION < 107400
+		if(count == 0){
+			return;
+		}
+		if(!atomic_load(g_routing, memory_order_acquire)){
+			return;
+		}
+		const Mutex::Unique_lock lock(g_route_mutex);
+		const AUTO(it, g_routes.find(category));
+		if(it == g_routes.end()){
+			return;
+		}
+		it->second.count -= count;
+		if(it->second.count == 0){
+			g_routes.erase(it);
+		}
+#else
+		(void)category;
+		(void)count;
+#endif
+	}
+
+	// 挂起的纤程由 Promise 唤醒，超时的纤程则由定期的检查恢复。
+	CONSTEXPR const unsigned g_expiry_check_interval = 1000;
+
+	class Job_worker : NONCOPYABLE {
+	private:
+		typedef boost::container::map<boost::weak_ptr<const void>, Fiber_control> Fiber_map;
+
+	private:
+		const boost::shared_ptr<Job_inbox> m_inbox;
+
+		Fiber_stack_allocator m_stack_allocator;
+		Fiber_map m_fiber_map;
+		boost::container::deque<Fiber_map::iterator> m_ready_queue;
+		boost::uint64_t m_next_expiry_check;
+
+		volatile bool m_running;
+		Thread m_thread;
+
+	public:
+		Job_worker()
+			: m_inbox(boost::make_shared<Job_inbox>()), m_next_expiry_check(0), m_running(false)
+		{
+			//
+		}
+
+	private:
+		void mark_ready(Fiber_map::iterator it) NOEXCEPT {
+			if(it->second.ready_queued){
+				return;
+			}
+			try {
+				m_ready_queue.push_back(it);
+				it->second.ready_queued = true;
+			} catch(std::exception &e){
+				// 纤程会在超时检查时被恢复。
+				POSEIDON_LOG_ERROR("std::exception thrown: what = ", e.what());
+			}
+		}
+
+		void accept_submissions() NOEXCEPT {
+			POSEIDON_PROFILE_ME;
+
+			AUTO(sub, m_inbox->submissions.pop_all());
+			while(sub){
+				const boost::scoped_ptr<Submission> guard(sub);
+				sub = sub->next;
+
+				if(!guard->job){
+					// 纤程可能已经因为超时而被恢复了，在调度时会再次检查 Promise 的状态。
+					const AUTO(it, m_fiber_map.find(guard->category));
+					if((it != m_fiber_map.end()) && (it->second.state == fiber_state_suspended)){
+						mark_ready(it);
+					}
+					continue;
+				}
+				try {
+					AUTO(it, m_fiber_map.find(guard->category));
+					if(it == m_fiber_map.end()){
+						const Fiber_control::Initializer init = { &m_stack_allocator, boost::make_shared<Fiber_waiter>(m_inbox, guard->category) };
+						it = m_fiber_map.emplace(guard->category, init).first;
+					}
+					Job_element elem = { STD_MOVE(guard->job), STD_MOVE(guard->withdrawn) };
+					it->second.queue.push_back(STD_MOVE(elem));
+					if(it->second.queue.size() == 1){
+						mark_ready(it);
+					}
+				} catch(std::exception &e){
+					POSEIDON_LOG_ERROR("std::exception thrown: what = ", e.what());
+					release_category(guard->category, 1);
+					atomic_sub(g_pending_jobs, 1, memory_order_release);
+				}
+			}
+		}
 
-		bool busy = false;
-		Mutex::Unique_lock lock(g_fiber_map_mutex);
-		bool erase_it;
-		for(AUTO(it, g_fiber_map.begin()); it != g_fiber_map.end(); erase_it ? (it = g_fiber_map.erase(it)) : ++it){
+		void pump_fiber(Fiber_map::iterator it, bool force_expiry) NOEXCEPT {
 			AUTO(fiber, &(it->second));
-			lock.unlock();
-			{
-				busy += pump_one_fiber(fiber, force_expiry);
+			const AUTO(old_size, fiber->queue.size());
+			pump_one_fiber(fiber, force_expiry);
+			release_category(it->first, old_size - fiber->queue.size());
+			atomic_sub(g_pending_jobs, old_size - fiber->queue.size(), memory_order_release);
+			if(fiber->queue.empty()){
+				m_fiber_map.erase(it);
+			} else if(fiber->state == fiber_state_ready){
+				// 执行完一个任务，继续执行下一个。
+				mark_ready(it);
+			}
+		}
+		void check_expiry(bool force_expiry) NOEXCEPT {
+			POSEIDON_PROFILE_ME;
+
+			AUTO(it, m_fiber_map.begin());
+			while(it != m_fiber_map.end()){
+				const AUTO(cur, it++);
+				if(cur->second.ready_queued){
+					continue;
+				}
+				pump_fiber(cur, force_expiry);
+			}
+		}
+
+		void thread_proc(){
+			POSEIDON_LOG(Logger::special_major | Logger::level_info, "Job worker thread started.");
+
+			for(;;){
+				while(pump_one_round(false)){
+					//
+				}
+				if(!atomic_load(m_running, memory_order_consume)){
+					break;
+				}
+				wait_for_jobs(get_idle_timeout());
+			}
+			drain();
+
+			POSEIDON_LOG(Logger::special_major | Logger::level_info, "Job worker thread stopped.");
+		}
+
+	public:
+		void set_stack_parameters(std::size_t stack_size, std::size_t pool_capacity, std::size_t trim_threshold){
+			m_stack_allocator.set_parameters(stack_size, pool_capacity, trim_threshold);
+		}
+		Stack_pool_statistics get_stack_statistics() const {
+			return m_stack_allocator.get_statistics();
+		}
+
+		void start(){
+			// 必须在创建线程之前设置，否则线程可能立即退出。
+			atomic_store(m_running, true, memory_order_release);
+			Thread(boost::bind(&Job_worker::thread_proc, this), Rcnts::view("J   "), Rcnts::view("Job")).swap(m_thread);
+		}
+		void stop(){
+			atomic_store(m_running, false, memory_order_release);
+			const Mutex::Unique_lock lock(m_inbox->new_job_mutex);
+			m_inbox->new_job.signal();
+		}
+		void safe_join(){
+			if(m_thread.joinable()){
+				m_thread.join();
+			}
+		}
+
+		// 只调度就绪的纤程。如果还有就绪的纤程，返回 true。
+		bool pump_one_round(bool force_expiry) NOEXCEPT {
+			POSEIDON_PROFILE_ME;
+
+			accept_submissions();
+
+			// 在这一轮中重新就绪的纤程留到下一轮，以免一个纤程长时间占用调度线程。
+			for(AUTO(count, m_ready_queue.size()); count != 0; --count){
+				const AUTO(it, m_ready_queue.front());
+				m_ready_queue.pop_front();
+				it->second.ready_queued = false;
+				pump_fiber(it, force_expiry);
+			}
+
+			const AUTO(now, get_fast_mono_clock());
+			if(force_expiry || (m_next_expiry_check <= now)){
+				check_expiry(force_expiry);
+				m_next_expiry_check = saturated_add(now, static_cast<boost::uint64_t>(g_expiry_check_interval));
+			}
+			return !m_ready_queue.empty();
+		}
+		unsigned get_idle_timeout() const NOEXCEPT {
+			const AUTO(now, get_fast_mono_clock());
+			if(m_next_expiry_check <= now){
+				return 0;
+			}
+			return static_cast<unsigned>(std::min<boost::uint64_t>(m_next_expiry_check - now, g_expiry_check_interval));
+		}
+		void wait_for_jobs(unsigned timeout){
+			Mutex::Unique_lock lock(m_inbox->new_job_mutex);
+			if(!m_inbox->submissions.empty()){
+				return;
+			}
+			m_inbox->new_job.timed_wait(lock, timeout);
+		}
+		// 停止时调用。其他线程上的任务可能还会向这里提交新任务，因此要等到所有线程上的任务都执行完。
+		void drain(){
+			boost::uint64_t last_info_time = 0;
+			unsigned timeout = 0;
+			for(;;){
+				const bool busy = pump_one_round(true);
+				const AUTO(pending_jobs, atomic_load(g_pending_jobs, memory_order_acquire));
+				if(pending_jobs == 0){
+					break;
+				}
+				const AUTO(now, get_fast_mono_clock());
+				if(last_info_time + 500 < now){
+					POSEIDON_LOG(Logger::special_major | Logger::level_info, "There are ", pending_jobs, " job(s) remaining.");
+					last_info_time = now;
+				}
+				timeout = std::min(timeout * 2u + 1u, !busy * 100u);
+				if(timeout != 0){
+					wait_for_jobs(timeout);
+				}
 			}
-			lock.lock();
-			erase_it = fiber->queue.empty();
 		}
-		return busy;
+
+		void enqueue(Submission *sub) NOEXCEPT {
+			atomic_add(g_pending_jobs, 1, memory_order_relaxed);
+			m_inbox->push(sub);
+		}
+	};
+
+	// 主线程上的调度器总是存在，其余的在 start() 中创建。
+	Job_worker g_primary_worker;
+	typedef boost::container::vector<boost::shared_ptr<Job_worker> > Worker_vector;
+
+	// 线程数组在启动时一次性构造好再发布，之后不再改变，因此提交任务时无需加锁。
+	// 停止时只撤下指针，数组本身直到进程退出才释放，因为其他线程可能仍然持有它。
+	const Worker_vector *volatile g_workers = NULLPTR;
+	boost::container::vector<boost::shared_ptr<const Worker_vector> > g_retired_workers;
+
+	// 同一个类别的任务在完成之前必须总是交给同一个线程。
+	std::size_t get_worker_index(const boost::weak_ptr<const void> &category, std::size_t count){
+#if BOOST_VERSION >= 107400
+		return category.owner_hash_value() / 16 % count;
+#else
+		const Mutex::Unique_lock lock(g_route_mutex);
+		AUTO(it, g_routes.find(category));
+		if(it == g_routes.end()){
+			const Category_route route = { g_next_route_index++ % count, 0 };
+			it = g_routes.emplace(category, route).first;
+		}
+		++(it->second.count);
+		return it->second.index;
+#endif
+	}
+	Job_worker & get_worker_for(const boost::weak_ptr<const void> &category){
+		const AUTO(workers, atomic_load(g_workers, memory_order_consume));
+		if(!workers){
+			return g_primary_worker;
+		}
+		const AUTO(count, workers->size() + 1);
+		if(count == 1){
+			return g_primary_worker;
+		}
+		const AUTO(index, get_worker_index(category, count));
+		if(index == 0){
+			return g_primary_worker;
+		}
+		return *(workers->at(index - 1));
 	}
 }
 
 void Job_dispatcher::start(){
 	POSEIDON_LOG(Logger::special_major | Logger::level_info, "Starting job dispatcher...");
 
-	//
+	const AUTO(thread_count, Main_config::get<std::size_t>("job_dispatcher_thread_count", 1));
+	if(thread_count == 0){
+		POSEIDON_LOG_FATAL("You shall not set `job_dispatcher_thread_count` in `main.conf` to zero.");
+		std::terminate();
+	}
+	const AUTO(stack_size, Main_config::get<std::size_t>("job_fiber_stack_size", 0x40000));
+	if(stack_size == 0){
+		POSEIDON_LOG_FATAL("You shall not set `job_fiber_stack_size` in `main.conf` to zero.");
+		std::terminate();
+	}
+	const AUTO(stack_pool_size, Main_config::get<std::size_t>("job_fiber_stack_pool_size", 1024));
+	const AUTO(stack_trim_threshold, Main_config::get<std::size_t>("job_fiber_stack_trim_threshold", 16));
+	g_primary_worker.set_stack_parameters(stack_size, stack_pool_size, stack_trim_threshold);
+	// 主线程也是一个调度线程。
+	const AUTO(workers, boost::make_shared<Worker_vector>());
+	workers->resize(thread_count - 1);
+	for(std::size_t i = 0; i < workers->size(); ++i){
+		POSEIDON_LOG(Logger::special_major | Logger::level_debug, "Creating job worker thread ", i + 1);
+		const AUTO(worker, boost::make_shared<Job_worker>());
+		worker->set_stack_parameters(stack_size, stack_pool_size, stack_trim_threshold);
+		worker->start();
+		workers->at(i) = worker;
+	}
+	g_retired_workers.push_back(workers);
+#if BOOST_VERSION < 107400
+	if(thread_count > 1){
+		atomic_store(g_routing, true, memory_order_release);
+	}
+#endif
+	atomic_store(g_workers, workers.get(), memory_order_release);
 }
 void Job_dispatcher::stop(){
 	POSEIDON_LOG(Logger::special_major | Logger::level_info, "Stopping job dispatcher...");
 
-	Mutex::Unique_lock lock(g_fiber_map_mutex);
-	boost::uint64_t last_info_time = 0;
-	for(;;){
-		const AUTO(pending_fibers, g_fiber_map.size());
-		if(pending_fibers == 0){
-			break;
-		}
-		lock.unlock();
-
-		const AUTO(now, get_fast_mono_clock());
-		if(last_info_time + 500 < now){
-			POSEIDON_LOG(Logger::special_major | Logger::level_info, "There are ", pending_fibers, " fiber(s) remaining.");
-			last_info_time = now;
-		}
-		pump_one_round(true);
+	// 其他线程上的任务在排空时仍然可能提交新任务，它们必须交给原来的线程，因此线程全部退出之后才撤下数组。
+	const AUTO(workers, atomic_load(g_workers, memory_order_consume));
+	if(!workers){
+		g_primary_worker.drain();
+		return;
+	}
+	for(std::size_t i = 0; i < workers->size(); ++i){
+		const AUTO_REF(worker, workers->at(i));
+		POSEIDON_LOG(Logger::special_major | Logger::level_info, "Stopping job worker thread ", i + 1);
+		worker->stop();
+	}
+	g_primary_worker.drain();
+	for(std::size_t i = 0; i < workers->size(); ++i){
+		const AUTO_REF(worker, workers->at(i));
+		POSEIDON_LOG(Logger::special_major | Logger::level_info, "Waiting for job worker thread ", i + 1, " to terminate...");
+		worker->safe_join();
+	}
+	atomic_store(g_workers, static_cast<const Worker_vector *>(NULLPTR), memory_order_release);
+}
 
-		lock.lock();
+void Job_dispatcher::snapshot_stack_pools(boost::container::vector<Job_dispatcher::Stack_pool_snapshot_element> &ret){
+	const AUTO(workers, atomic_load(g_workers, memory_order_consume));
+	const AUTO(worker_count, workers ? workers->size() : 0);
+	ret.reserve(ret.size() + 1 + worker_count);
+	for(std::size_t i = 0; i <= worker_count; ++i){
+		const AUTO(worker, (i == 0) ? &g_primary_worker : workers->at(i - 1).get());
+		const AUTO(stats, worker->get_stack_statistics());
+		Stack_pool_snapshot_element elem = { };
+		elem.thread_index = i;
+		elem.stack_size = stats.stack_size;
+		elem.stacks_in_use = stats.stacks_in_use;
+		elem.stacks_pooled = stats.stacks_pooled;
+		elem.stacks_mapped = stats.stacks_mapped;
+		elem.stacks_unmapped = stats.stacks_unmapped;
+		elem.pool_hits = stats.pool_hits;
+		elem.stacks_trimmed = stats.stacks_trimmed;
+		elem.address_space = stats.address_space;
+		ret.push_back(elem);
 	}
 }
 
 void Job_dispatcher::do_modal(volatile int &sig_recv){
-	unsigned timeout = 0;
 	for(;;){
 		const int sig = atomic_exchange(sig_recv, 0, memory_order_acquire);
 		if(sig != 0){
 			POSEIDON_LOG_WARNING("Received signal: ", sig, " (", ::strsignal(sig), ")");
 		}
-		bool busy;
-		do {
-			busy = pump_one_round(sig != 0);
-			timeout = std::min(timeout * 2u + 1u, !busy * 100u);
-		} while(busy);
-
-		Mutex::Unique_lock lock(g_fiber_map_mutex);
+		while(g_primary_worker.pump_one_round(sig != 0)){
+			//
+		}
 		if(sig != 0){
 			break;
 		}
-		g_new_job.timed_wait(lock, timeout);
+		// 信号处理函数不会唤醒条件变量，因此最多等待 100 毫秒。
+		g_primary_worker.wait_for_jobs(std::min(g_primary_worker.get_idle_timeout(), 100u));
 	}
 }
 
@@ -292,18 +977,18 @@ void Job_dispatcher::enqueue(boost::shared_ptr<Job_base> job, boost::shared_ptr<
 		category = job;
 	}
 
-	const Mutex::Unique_lock lock(g_fiber_map_mutex);
-	AUTO(it, g_fiber_map.find(category));
-	if(it == g_fiber_map.end()){
-		it = g_fiber_map.emplace(category, Fiber_control::Initializer()).first;
-	}
-	const AUTO(fiber, &(it->second));
-	{
-		const Recursive_mutex::Unique_lock queue_lock(fiber->queue_mutex);
-		Job_element elem = { STD_MOVE(job), STD_MOVE(withdrawn) };
-		fiber->queue.push_back(STD_MOVE(elem));
+	const AUTO(sub, new Submission);
+	sub->category = STD_MOVE(category);
+	sub->job = STD_MOVE(job);
+	sub->withdrawn = STD_MOVE(withdrawn);
+	Job_worker *worker;
+	try {
+		worker = &get_worker_for(sub->category);
+	} catch(...){
+		delete sub;
+		throw;
 	}
-	g_new_job.signal();
+	worker->enqueue(sub);
 }
 void Job_dispatcher::yield(boost::shared_ptr<const Promise> promise, bool insignificant){
 	POSEIDON_PROFILE_ME;
@@ -318,7 +1003,13 @@ void Job_dispatcher::yield(boost::shared_ptr<const Promise> promise, bool insign
 		POSEIDON_LOG_TRACE("Skipped yielding from fiber ", static_cast<void *>(fiber));
 	} else {
 		POSEIDON_LOG_TRACE("Yielding from fiber ", static_cast<void *>(fiber));
-		const AUTO(job_timeout, Main_config::get<boost::uint64_t>("job_timeout", 60000));
+		// 唤醒要等到切换出去之后才会被调度线程处理，因此这里不会错过。
+		if(promise){
+			promise->add_waiter(fiber->waiter);
+		} else {
+			fiber->waiter->on_promise_satisfied();
+		}
+		const AUTO(job_timeout, Main_config::get_snapshot().job_timeout);
 		AUTO_REF(elem, fiber->queue.front());
 		elem.promise = promise;
 		elem.expiry_time = saturated_add(get_fast_mono_clock(), job_timeout);
@@ -326,11 +1017,7 @@ void Job_dispatcher::yield(boost::shared_ptr<const Promise> promise, bool insign
 		const AUTO(profiler_hook, Profiler::begin_stack_switch());
 		{
 			fiber->state = fiber_state_suspended;
-			if(::swapcontext(&(fiber->inner), &(fiber->outer)) != 0){
-				const int err_code = errno;
-				POSEIDON_LOG_FATAL("::swapcontext() failed: err_code = ", err_code);
-				std::terminate();
-			}
+			switch_out_of_fiber(fiber);
 		}
 		Profiler::end_stack_switch(profiler_hook);
 		POSEIDON_LOG_TRACE("Resumed to fiber ", static_cast<void *>(fiber));
@@ -6,6 +6,7 @@
 
 #include "../cxx_ver.hpp"
 #include <boost/shared_ptr.hpp>
+#include <boost/container/vector.hpp>
 
 namespace Poseidon {
 
@@ -13,6 +14,19 @@ class Job_base;
 class Promise;
 
 class Job_dispatcher {
+public:
+	struct Stack_pool_snapshot_element {
+		std::size_t thread_index; // 零表示主线程。
+		std::size_t stack_size; // 不含保护页。
+		std::size_t stacks_in_use;
+		std::size_t stacks_pooled;
+		unsigned long long stacks_mapped; // 调用 `mmap()` 的次数。
+		unsigned long long stacks_unmapped; // 调用 `munmap()` 的次数。
+		unsigned long long pool_hits; // 从缓存中取得栈的次数。
+		unsigned long long stacks_trimmed; // 用 `MADV_DONTNEED` 归还物理内存的次数。
+		unsigned long long address_space; // 所有已映射的栈占用的地址空间的字节数，含保护页。
+	};
+
 private:
 	Job_dispatcher();
 
@@ -22,6 +36,8 @@ public:
 
 	static void do_modal(volatile int &sig_recv);
 
+	static void snapshot_stack_pools(boost::container::vector<Stack_pool_snapshot_element> &ret);
+
 	static void enqueue(boost::shared_ptr<Job_base> job, boost::shared_ptr<const bool> withdrawn);
 	// Pass `promise` by value to avoid false aliasing.
 	static void yield(boost::shared_ptr<const Promise> promise, bool insignificant);
@@ -0,0 +1,606 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "../precompiled.hpp"
+#include "log_daemon.hpp"
+#include "main_config.hpp"
+#include "../thread.hpp"
+#include "../mutex.hpp"
+#include "../condition_variable.hpp"
+#include "../atomic.hpp"
+#include "../log.hpp"
+#include "../time.hpp"
+#include "../raii.hpp"
+#include "../system_exception.hpp"
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+
+namespace Poseidon {
+
+namespace {
+	CONSTEXPR const std::size_t g_min_buffer_size = 4096;
+	CONSTEXPR const std::size_t g_max_iovec_count = 256;
+	CONSTEXPR const unsigned g_idle_timeout = 100;
+	CONSTEXPR const boost::uint64_t g_drop_report_interval = 1000;
+
+	// 每条记录以头部开始，整条记录按头部大小对齐，因此头部永远不会跨越缓冲区的末尾。
+	struct Record_header {
+		boost::uint32_t size; // 不含头部和对齐。
+		boost::int32_t fd;
+	};
+
+	// 每个线程一个单生产者单消费者的环形缓冲区。
+	// 偏移量只增不减，取模之后才是缓冲区中的位置。
+	struct Log_ring {
+		Log_ring *next;
+		char *data;
+		std::size_t capacity; // 2 的幂。
+		volatile std::size_t read_offset; // 只由持有 `g_write_mutex` 的线程修改。
+		volatile std::size_t write_offset; // 只由所属线程修改。
+	};
+
+	volatile bool g_started = false;
+	volatile bool g_running = false; // 后台线程正在运行。
+	Thread g_thread;
+
+	std::size_t g_buffer_size = 0;
+	bool g_discard_when_full = false;
+	volatile unsigned long long g_dropped_line_count = 0;
+
+	// 所有写出操作，以及缓冲区的链表，都由这个互斥锁保护。
+	// 这里不能使用 `Mutex`，因为日志在静态对象析构之后依然可能被写出。
+	::pthread_mutex_t g_write_mutex = PTHREAD_MUTEX_INITIALIZER;
+	Log_ring *g_rings = 0; // XXX: NULLPTR
+
+	Mutex g_wakeup_mutex;
+	Condition_variable g_wakeup;
+	volatile bool g_sleeping = false;
+
+	// 缓冲区满时，写日志的线程在这里等待后台线程腾出空间。
+	Mutex g_space_mutex;
+	Condition_variable g_space_available;
+	volatile std::size_t g_space_waiters = 0;
+
+	__thread Log_ring *t_ring = 0; // XXX: NULLPTR
+	__thread bool t_ring_initialized = false;
+	__thread bool t_is_log_thread = false;
+
+	class Write_lock : NONCOPYABLE {
+	public:
+		Write_lock() NOEXCEPT {
+			int err_code = ::pthread_mutex_lock(&g_write_mutex);
+			(void)err_code;
+			assert(err_code == 0);
+		}
+		~Write_lock() NOEXCEPT {
+			int err_code = ::pthread_mutex_unlock(&g_write_mutex);
+			(void)err_code;
+			assert(err_code == 0);
+		}
+	};
+
+	std::size_t get_record_size(std::size_t size) NOEXCEPT {
+		return sizeof(Record_header) + ((size + sizeof(Record_header) - 1) & ~(sizeof(Record_header) - 1));
+	}
+
+	void write_all(int fd, ::iovec *iov, std::size_t count) NOEXCEPT {
+		while(count != 0){
+			const ::ssize_t result = ::writev(fd, iov, static_cast<int>(count));
+			if(result < 0){
+				if(errno == EINTR){
+					continue;
+				}
+				break;
+			}
+			if(result == 0){
+				break;
+			}
+			std::size_t written = static_cast<std::size_t>(result);
+			while((count != 0) && (written >= iov->iov_len)){
+				written -= iov->iov_len;
+				++iov;
+				--count;
+			}
+			if(count != 0){
+				iov->iov_base = static_cast<char *>(iov->iov_base) + written;
+				iov->iov_len -= written;
+			}
+		}
+	}
+	void write_buffer(int fd, Stream_buffer &line) NOEXCEPT {
+		char str[4096];
+		for(;;){
+			const std::size_t len = line.get(str, sizeof(str));
+			if(len == 0){
+				break;
+			}
+			::iovec iov = { str, len };
+			write_all(fd, &iov, 1);
+		}
+	}
+
+	// 调用者必须持有 `g_write_mutex`。返回写出的字节数。
+	std::size_t drain_ring(Log_ring *ring) NOEXCEPT {
+		const std::size_t mask = ring->capacity - 1;
+		std::size_t read_offset = ring->read_offset;
+		const std::size_t write_offset = atomic_load(ring->write_offset, memory_order_acquire);
+		std::size_t bytes_written = 0;
+		// 连续的、写往同一个文件描述符的记录合并成一次 `writev()`。
+		::iovec iov[g_max_iovec_count];
+		std::size_t count = 0;
+		int fd = -1;
+		while(read_offset != write_offset){
+			Record_header header;
+			std::memcpy(&header, ring->data + (read_offset & mask), sizeof(header));
+			if((count != 0) && ((header.fd != fd) || (count + 2 > g_max_iovec_count))){
+				write_all(fd, iov, count);
+				count = 0;
+				atomic_store(ring->read_offset, read_offset, memory_order_release);
+			}
+			fd = header.fd;
+			const std::size_t begin = (read_offset + sizeof(header)) & mask;
+			const std::size_t first = std::min<std::size_t>(header.size, ring->capacity - begin);
+			iov[count].iov_base = ring->data + begin;
+			iov[count].iov_len = first;
+			++count;
+			if(header.size > first){
+				iov[count].iov_base = ring->data;
+				iov[count].iov_len = header.size - first;
+				++count;
+			}
+			bytes_written += header.size;
+			read_offset += get_record_size(header.size);
+		}
+		if(count != 0){
+			write_all(fd, iov, count);
+		}
+		atomic_store(ring->read_offset, read_offset, memory_order_release);
+		return bytes_written;
+	}
+	std::size_t drain_all_rings() NOEXCEPT {
+		std::size_t bytes_written = 0;
+		for(Log_ring *ring = g_rings; ring; ring = ring->next){
+			bytes_written += drain_ring(ring);
+		}
+		return bytes_written;
+	}
+	bool has_pending_records() NOEXCEPT {
+		const Write_lock lock;
+		for(Log_ring *ring = g_rings; ring; ring = ring->next){
+			if(ring->read_offset != atomic_load(ring->write_offset, memory_order_acquire)){
+				return true;
+			}
+		}
+		return false;
+	}
+
+	::pthread_key_t g_ring_key;
+	::pthread_once_t g_ring_key_once = PTHREAD_ONCE_INIT;
+
+	void ring_destructor(void *param) NOEXCEPT {
+		// 线程退出时写出它的缓冲区中剩余的日志，然后把缓冲区从链表中摘下。
+		const AUTO(ring, static_cast<Log_ring *>(param));
+		{
+			const Write_lock lock;
+			drain_ring(ring);
+			Log_ring **prev = &g_rings;
+			while(*prev != ring){
+				prev = &((*prev)->next);
+			}
+			*prev = ring->next;
+		}
+		t_ring = NULLPTR;
+		delete[] ring->data;
+		delete ring;
+	}
+	void create_ring_key() NOEXCEPT {
+		int err_code = ::pthread_key_create(&g_ring_key, &ring_destructor);
+		if(err_code != 0){
+			std::terminate();
+		}
+	}
+
+	Log_ring * get_thread_ring() NOEXCEPT {
+		if(t_ring_initialized){
+			return t_ring;
+		}
+		t_ring_initialized = true;
+		::pthread_once(&g_ring_key_once, &create_ring_key);
+		const AUTO(ring, new(std::nothrow) Log_ring());
+		if(!ring){
+			return NULLPTR;
+		}
+		ring->data = new(std::nothrow) char[g_buffer_size];
+		if(!ring->data){
+			delete ring;
+			return NULLPTR;
+		}
+		ring->capacity = g_buffer_size;
+		if(::pthread_setspecific(g_ring_key, ring) != 0){
+			delete[] ring->data;
+			delete ring;
+			return NULLPTR;
+		}
+		{
+			const Write_lock lock;
+			ring->next = g_rings;
+			g_rings = ring;
+		}
+		t_ring = ring;
+		return ring;
+	}
+
+	bool has_room(const Log_ring *ring, std::size_t size) NOEXCEPT {
+		const std::size_t read_offset = atomic_load(ring->read_offset, memory_order_acquire);
+		return ring->capacity - (ring->write_offset - read_offset) >= get_record_size(size);
+	}
+	bool push_record(Log_ring *ring, int fd, Stream_buffer &line) NOEXCEPT {
+		const std::size_t mask = ring->capacity - 1;
+		const std::size_t size = line.size();
+		const std::size_t write_offset = ring->write_offset;
+		if(!has_room(ring, size)){
+			return false;
+		}
+		Record_header header = { static_cast<boost::uint32_t>(size), fd };
+		std::memcpy(ring->data + (write_offset & mask), &header, sizeof(header));
+		const std::size_t begin = (write_offset + sizeof(header)) & mask;
+		const std::size_t first = std::min(size, ring->capacity - begin);
+		line.get(ring->data + begin, first);
+		line.get(ring->data, size - first);
+		atomic_store(ring->write_offset, write_offset + get_record_size(size), memory_order_release);
+		return true;
+	}
+	void wake_daemon() NOEXCEPT {
+		// 与 `thread_proc()` 中对 `g_sleeping` 的写入配对。
+		atomic_fence(memory_order_seq_cst);
+		if(!atomic_load(g_sleeping, memory_order_relaxed)){
+			return;
+		}
+		const Mutex::Unique_lock lock(g_wakeup_mutex);
+		g_wakeup.signal();
+	}
+	// 在写出缓冲区中的日志之后调用。调用者不能持有 `g_write_mutex`。
+	void notify_space_waiters() NOEXCEPT {
+		// 与 `Log_daemon::write()` 中对 `g_space_waiters` 的写入配对。
+		atomic_fence(memory_order_seq_cst);
+		if(atomic_load(g_space_waiters, memory_order_relaxed) == 0){
+			return;
+		}
+		const Mutex::Unique_lock lock(g_space_mutex);
+		g_space_available.broadcast();
+	}
+
+	// 二进制日志文件，由 `g_binary_mutex` 保护。
+	CONSTEXPR const char g_binary_magic[8] = { 'P', 'S', 'D', 'N', 'B', 'L', 'G', '1' };
+	CONSTEXPR const std::size_t g_binary_header_size = 16;
+	CONSTEXPR const unsigned char g_binary_record_site = 1;
+	CONSTEXPR const unsigned char g_binary_record_line = 2;
+
+	// 按文件名的内容而不是 `__FILE__` 的地址比较，因为模块被卸载之后同一个地址可能指向别的字符串。
+	struct Binary_site_key {
+		const char *file;
+		unsigned long line;
+	};
+	struct Binary_site_key_comparator {
+		bool operator()(const Binary_site_key &lhs, const Binary_site_key &rhs) const NOEXCEPT {
+			if(lhs.line != rhs.line){
+				return lhs.line < rhs.line;
+			}
+			if(lhs.file == rhs.file){
+				return false;
+			}
+			return std::strcmp(lhs.file, rhs.file) < 0;
+		}
+	};
+
+	::pthread_mutex_t g_binary_mutex = PTHREAD_MUTEX_INITIALIZER;
+	volatile bool g_binary_enabled = false;
+	std::string g_binary_path;
+	std::size_t g_binary_capacity = 0;
+	Unique_file g_binary_file;
+	char *g_binary_data = 0; // XXX: NULLPTR
+	std::size_t g_binary_offset = 0;
+	boost::container::flat_map<Binary_site_key, boost::uint32_t, Binary_site_key_comparator> g_binary_sites;
+	// `g_binary_sites` 的键指向这里的副本。deque 在末尾插入时不会移动已有的元素。
+	boost::container::deque<std::string> g_binary_site_files;
+
+	class Binary_lock : NONCOPYABLE {
+	public:
+		Binary_lock() NOEXCEPT {
+			int err_code = ::pthread_mutex_lock(&g_binary_mutex);
+			(void)err_code;
+			assert(err_code == 0);
+		}
+		~Binary_lock() NOEXCEPT {
+			int err_code = ::pthread_mutex_unlock(&g_binary_mutex);
+			(void)err_code;
+			assert(err_code == 0);
+		}
+	};
+
+	// 调用者必须持有 `g_binary_mutex`。这里不能写日志。
+	void close_binary_file() NOEXCEPT {
+		if(g_binary_data){
+			::munmap(g_binary_data, g_binary_capacity);
+			g_binary_data = NULLPTR;
+		}
+		if(g_binary_file){
+			// 去掉文件末尾没有用到的部分。
+			static_cast<void>(::ftruncate(g_binary_file.get(), static_cast< ::off_t>(g_binary_offset)));
+			g_binary_file.reset();
+		}
+		g_binary_offset = 0;
+		g_binary_sites.clear();
+		g_binary_site_files.clear();
+	}
+	int open_binary_file() NOEXCEPT {
+		Unique_file file;
+		if(!file.reset(::open(g_binary_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644))){
+			return errno;
+		}
+		if(::ftruncate(file.get(), static_cast< ::off_t>(g_binary_capacity)) != 0){
+			return errno;
+		}
+		void *const data = ::mmap(NULLPTR, g_binary_capacity, PROT_READ | PROT_WRITE, MAP_SHARED, file.get(), 0);
+		if(data == MAP_FAILED){
+			return errno;
+		}
+		g_binary_file.swap(file);
+		g_binary_data = static_cast<char *>(data);
+		std::memcpy(g_binary_data, g_binary_magic, sizeof(g_binary_magic));
+		g_binary_offset = g_binary_header_size;
+		return 0;
+	}
+	int rotate_binary_file() NOEXCEPT {
+		// 只保留一个旧文件。
+		close_binary_file();
+		const AUTO(old_path, g_binary_path + ".old");
+		if(::rename(g_binary_path.c_str(), old_path.c_str()) != 0){
+			return errno;
+		}
+		return open_binary_file();
+	}
+
+	// 调用者必须持有 `g_binary_mutex` 并确保文件中有足够的空间。
+	// 记录的长度最后写入，因此进程崩溃时文件中不会留下不完整的记录。
+	char * begin_binary_record(std::size_t size, unsigned char type) NOEXCEPT {
+		char *const record = g_binary_data + g_binary_offset;
+		g_binary_offset += size;
+		record[4] = static_cast<char>(type);
+		return record + 5;
+	}
+	void end_binary_record(char *record_begin, std::size_t size) NOEXCEPT {
+		const AUTO(size32, static_cast<boost::uint32_t>(size));
+		std::memcpy(record_begin - 5, &size32, 4);
+	}
+	char * put_binary_field(char *wptr, const void *data, std::size_t size) NOEXCEPT {
+		std::memcpy(wptr, data, size);
+		return wptr + size;
+	}
+
+	void thread_proc(){
+		// 后台线程自己的日志总是同步写出，否则缓冲区满时它会等待它自己。
+		t_is_log_thread = true;
+		POSEIDON_LOG(Logger::special_major | Logger::level_info, "Log daemon started.");
+
+		unsigned long long dropped_reported = 0;
+		boost::uint64_t next_drop_report_time = 0;
+		for(;;){
+			std::size_t bytes_written;
+			{
+				const Write_lock lock;
+				bytes_written = drain_all_rings();
+			}
+			notify_space_waiters();
+			if(bytes_written != 0){
+				continue;
+			}
+
+			const AUTO(dropped, atomic_load(g_dropped_line_count, memory_order_relaxed));
+			const AUTO(now, get_fast_mono_clock());
+			if((dropped != dropped_reported) && (now >= next_drop_report_time)){
+				POSEIDON_LOG_WARNING("Log buffers were full: ", dropped - dropped_reported, " line(s) of logs were discarded.");
+				dropped_reported = dropped;
+				next_drop_report_time = now + g_drop_report_interval;
+			}
+
+			Mutex::Unique_lock lock(g_wakeup_mutex);
+			if(!atomic_load(g_running, memory_order_consume)){
+				break;
+			}
+			atomic_store(g_sleeping, true, memory_order_seq_cst);
+			atomic_fence(memory_order_seq_cst);
+			if(!has_pending_records()){
+				g_wakeup.timed_wait(lock, g_idle_timeout);
+			}
+			atomic_store(g_sleeping, false, memory_order_relaxed);
+		}
+
+		POSEIDON_LOG(Logger::special_major | Logger::level_info, "Log daemon stopped.");
+	}
+}
+
+void Log_daemon::start(){
+	if(atomic_exchange(g_started, true, memory_order_acq_rel) != false){
+		POSEIDON_LOG_FATAL("Only one daemon is allowed at the same time.");
+		std::terminate();
+	}
+	POSEIDON_LOG(Logger::special_major | Logger::level_info, "Starting log daemon...");
+
+	const AUTO(binary_path, Main_config::get<std::string>("log_binary_file"));
+	if(!binary_path.empty()){
+		const AUTO(binary_size, Main_config::get<std::size_t>("log_binary_file_size", 67108864));
+		POSEIDON_LOG(Logger::special_major | Logger::level_info, "Opening binary log file: ", binary_path);
+		int err_code;
+		{
+			const Binary_lock lock;
+			g_binary_path = binary_path;
+			g_binary_capacity = std::max(binary_size, g_min_buffer_size);
+			err_code = open_binary_file();
+		}
+		if(err_code != 0){
+			POSEIDON_LOG_ERROR("Failed to open binary log file: path = ", binary_path, ", err_code = ", err_code);
+			POSEIDON_THROW(System_exception, err_code);
+		}
+		atomic_store(g_binary_enabled, true, memory_order_release);
+	}
+
+	const AUTO(buffer_size, Main_config::get<std::size_t>("log_buffer_size", 262144));
+	if(buffer_size == 0){
+		POSEIDON_LOG(Logger::special_major | Logger::level_info, "Asynchronous logging is disabled.");
+		return;
+	}
+	std::size_t capacity = g_min_buffer_size;
+	while(capacity < buffer_size){
+		capacity *= 2;
+	}
+	g_buffer_size = capacity;
+	g_discard_when_full = Main_config::get<bool>("log_discard_when_full", false);
+
+	atomic_store(g_running, true, memory_order_release);
+	Thread(&thread_proc, Rcnts::view("  L "), Rcnts::view("Log")).swap(g_thread);
+}
+void Log_daemon::stop(){
+	if(atomic_exchange(g_started, false, memory_order_acq_rel) == false){
+		return;
+	}
+	POSEIDON_LOG(Logger::special_major | Logger::level_info, "Stopping log daemon...");
+
+	if(atomic_exchange(g_running, false, memory_order_acq_rel) != false){
+		{
+			const Mutex::Unique_lock lock(g_wakeup_mutex);
+			g_wakeup.signal();
+		}
+		if(g_thread.joinable()){
+			g_thread.join();
+		}
+
+		// 写出后台线程退出之后放入缓冲区的日志。
+		{
+			const Write_lock lock;
+			drain_all_rings();
+		}
+		// 正在等待的线程会看到后台线程已经退出，转而同步写出。
+		notify_space_waiters();
+	}
+
+	atomic_store(g_binary_enabled, false, memory_order_release);
+	const Binary_lock lock;
+	close_binary_file();
+}
+
+void Log_daemon::write(int fd, Stream_buffer &line, bool droppable, bool urgent) NOEXCEPT {
+	if(!urgent && !t_is_log_thread && atomic_load(g_running, memory_order_acquire)){
+		const AUTO(ring, get_thread_ring());
+		if(ring && (get_record_size(line.size()) <= ring->capacity)){
+			for(;;){
+				if(push_record(ring, fd, line)){
+					wake_daemon();
+					// 如果后台线程已经开始退出，这一行可能没有人写出，因此在下面同步写出积压的日志。
+					atomic_fence(memory_order_seq_cst);
+					if(atomic_load(g_running, memory_order_relaxed)){
+						return;
+					}
+					break;
+				}
+				if(droppable && g_discard_when_full){
+					atomic_add(g_dropped_line_count, 1, memory_order_relaxed);
+					return;
+				}
+				wake_daemon();
+				{
+					Mutex::Unique_lock lock(g_space_mutex);
+					atomic_add(g_space_waiters, 1, memory_order_relaxed);
+					// 与 `notify_space_waiters()` 中的读取配对。
+					atomic_fence(memory_order_seq_cst);
+					while(atomic_load(g_running, memory_order_relaxed) && !has_room(ring, line.size())){
+						g_space_available.wait(lock);
+					}
+					atomic_sub(g_space_waiters, 1, memory_order_relaxed);
+				}
+				if(!atomic_load(g_running, memory_order_acquire)){
+					break;
+				}
+			}
+		}
+	}
+
+	{
+		const Write_lock lock;
+		drain_all_rings();
+		write_buffer(fd, line);
+	}
+	notify_space_waiters();
+}
+
+unsigned long long Log_daemon::get_dropped_line_count() NOEXCEPT {
+	return atomic_load(g_dropped_line_count, memory_order_relaxed);
+}
+
+bool Log_daemon::is_binary_log_enabled() NOEXCEPT {
+	return atomic_load(g_binary_enabled, memory_order_consume);
+}
+void Log_daemon::write_binary(unsigned level, const char *file, unsigned long line, boost::uint64_t local_time,
+	unsigned long tid, const char *tag, Stream_buffer &args) NOEXCEPT
+try {
+	int err_code = 0;
+	{
+		const Binary_lock lock;
+		if(!g_binary_data){
+			return;
+		}
+		const Binary_site_key key = { file, line };
+		const std::size_t file_len = std::strlen(file);
+		const std::size_t site_size = 5 + 4 + 4 + file_len;
+		const std::size_t line_size = 5 + 4 + 1 + 8 + 4 + 4 + args.size();
+		if(site_size + line_size > g_binary_capacity - g_binary_header_size){
+			atomic_add(g_dropped_line_count, 1, memory_order_relaxed);
+			return;
+		}
+		AUTO(site_it, g_binary_sites.find(key));
+		if(g_binary_capacity - g_binary_offset < ((site_it == g_binary_sites.end()) ? site_size : 0) + line_size){
+			// 新的文件中没有调用点记录。
+			err_code = rotate_binary_file();
+			site_it = g_binary_sites.end();
+		}
+		if(g_binary_data){
+			if(site_it == g_binary_sites.end()){
+				const AUTO(site_id, static_cast<boost::uint32_t>(g_binary_sites.size()));
+				g_binary_site_files.push_back(std::string(file, file_len));
+				const Binary_site_key owned_key = { g_binary_site_files.back().c_str(), line };
+				site_it = g_binary_sites.emplace(owned_key, site_id).first;
+				const AUTO(line32, static_cast<boost::uint32_t>(line));
+				char *const begin = begin_binary_record(site_size, g_binary_record_site);
+				char *wptr = begin;
+				wptr = put_binary_field(wptr, &site_id, 4);
+				wptr = put_binary_field(wptr, &line32, 4);
+				wptr = put_binary_field(wptr, file, file_len);
+				end_binary_record(begin, site_size);
+			}
+			const AUTO(site_id, site_it->second);
+			const AUTO(level8, static_cast<boost::uint8_t>(level));
+			const AUTO(tid32, static_cast<boost::uint32_t>(tid));
+			char *const begin = begin_binary_record(line_size, g_binary_record_line);
+			char *wptr = begin;
+			wptr = put_binary_field(wptr, &site_id, 4);
+			wptr = put_binary_field(wptr, &level8, 1);
+			wptr = put_binary_field(wptr, &local_time, 8);
+			wptr = put_binary_field(wptr, &tid32, 4);
+			wptr = put_binary_field(wptr, tag, 4);
+			args.get(wptr, args.size());
+			end_binary_record(begin, line_size);
+		} else {
+			atomic_store(g_binary_enabled, false, memory_order_release);
+		}
+	}
+	if(err_code != 0){
+		POSEIDON_LOG_ERROR("Failed to rotate binary log file: path = ", g_binary_path, ", err_code = ", err_code);
+	}
+} catch(...){
+	return;
+}
+
+}
@@ -0,0 +1,53 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_SINGLETONS_LOG_DAEMON_HPP_
+#define POSEIDON_SINGLETONS_LOG_DAEMON_HPP_
+
+#include "../cxx_ver.hpp"
+#include "../stream_buffer.hpp"
+#include <boost/cstdint.hpp>
+
+namespace Poseidon {
+
+class Log_daemon {
+public:
+	// 二进制日志文件中参数的类型。这些值会写入文件，不能修改。
+	enum {
+		binary_arg_bool      = 'b', // u8
+		binary_arg_char      = 'c', // char
+		binary_arg_signed    = 'i', // i64
+		binary_arg_unsigned  = 'u', // u64
+		binary_arg_pointer   = 'p', // u64
+		binary_arg_string    = 's', // u32 长度，随后是字节
+	};
+
+private:
+	Log_daemon();
+
+public:
+	static void start();
+	static void stop();
+
+	// 把一行日志放入当前线程的缓冲区，由后台线程批量写出。
+	// 后台线程没有运行，或者 `urgent` 为 true 时，先写出所有积压的日志，然后在当前线程同步写出这一行。
+	// 缓冲区满时，若 `droppable` 为 true 并且配置允许，这一行被丢弃；否则等待后台线程腾出空间。
+	static void write(int fd, Stream_buffer &line, bool droppable, bool urgent) NOEXCEPT;
+
+	// 因缓冲区满而被丢弃的日志行数。
+	static unsigned long long get_dropped_line_count() NOEXCEPT;
+
+	// 二进制日志文件通过 `mmap()` 写入，用 `utilities/binlog_decode.cpp` 还原为文本。
+	// 所有数据都是本机字节序。文件以 8 字节的 "PSDNBLG1" 和 8 字节的保留字段开始，随后是记录。
+	// 每条记录以 u32 总长度（包括这个字段，为零表示没有更多记录）和 u8 类型开始：
+	//   类型 1（调用点）：u32 编号，u32 行号，随后是文件名；
+	//   类型 2（日志）：u32 调用点编号，u8 级别，u64 本地时间（毫秒），u32 线程号，4 字节线程标签，随后是参数。
+	// 每个参数以 u8 类型开始，类型见上面的 `binary_arg_*`。
+	static bool is_binary_log_enabled() NOEXCEPT;
+	static void write_binary(unsigned level, const char *file, unsigned long line, boost::uint64_t local_time,
+		unsigned long tid, const char *tag, Stream_buffer &args) NOEXCEPT;
+};
+
+}
+
+#endif
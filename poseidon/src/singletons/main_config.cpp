@@ -8,6 +8,7 @@
 #include "../system_exception.hpp"
 #include "../raii.hpp"
 #include "../mutex.hpp"
+#include "../atomic.hpp"
 #include <limits.h>
 #include <stdlib.h>
 
@@ -27,6 +28,15 @@ namespace {
 
 	Mutex g_mutex;
 	boost::shared_ptr<Config_file> g_config;
+
+	const Main_config::Snapshot g_default_snapshot = {
+#define POSEIDON_MAIN_CONFIG_SNAPSHOT_DEFAULT_(type_, name_, def_)	def_,
+		POSEIDON_MAIN_CONFIG_SNAPSHOT_FIELDS(POSEIDON_MAIN_CONFIG_SNAPSHOT_DEFAULT_)
+#undef POSEIDON_MAIN_CONFIG_SNAPSHOT_DEFAULT_
+	};
+	const Main_config::Snapshot *volatile g_snapshot = &g_default_snapshot;
+	// 读者不加锁，无从得知旧的快照何时不再被使用，因此旧的快照一直保留到进程退出。重新加载很少发生。
+	boost::container::vector<boost::shared_ptr<const Main_config::Snapshot> > g_snapshots;
 }
 
 void Main_config::set_run_path(const char *path){
@@ -39,9 +49,15 @@ void Main_config::set_run_path(const char *path){
 void Main_config::reload(){
 	POSEIDON_LOG(Logger::special_major | Logger::level_info, "Loading main config file: ", g_main_conf_name);
 	AUTO(config, boost::make_shared<Config_file>(g_main_conf_name));
+	AUTO(snapshot, boost::make_shared<Snapshot>());
+#define POSEIDON_MAIN_CONFIG_SNAPSHOT_PARSE_(type_, name_, def_)	snapshot->name_ = config->get<type_>(#name_, def_);
+	POSEIDON_MAIN_CONFIG_SNAPSHOT_FIELDS(POSEIDON_MAIN_CONFIG_SNAPSHOT_PARSE_)
+#undef POSEIDON_MAIN_CONFIG_SNAPSHOT_PARSE_
 	POSEIDON_LOG(Logger::special_major | Logger::level_info, "Done loading main config file: ", g_main_conf_name);
 	const Mutex::Unique_lock lock(g_mutex);
+	g_snapshots.push_back(snapshot);
 	g_config.swap(config);
+	atomic_store(g_snapshot, snapshot.get(), memory_order_release);
 }
 
 boost::shared_ptr<const Config_file> Main_config::get_file(){
@@ -49,5 +65,8 @@ boost::shared_ptr<const Config_file> Main_config::get_file(){
 	POSEIDON_THROW_UNLESS(g_config, Exception, Rcnts::view("Main config file has not been loaded"));
 	return g_config;
 }
+const Main_config::Snapshot & Main_config::get_snapshot() NOEXCEPT {
+	return *atomic_load(g_snapshot, memory_order_consume);
+}
 
 }
@@ -6,10 +6,45 @@
 
 #include "../config_file.hpp"
 #include <boost/shared_ptr.hpp>
+#include <boost/cstdint.hpp>
+
+// 热点路径上用到的选项：类型，名字，默认值。
+// 这些选项在 `Main_config::reload()` 时解析一次，读取时既不加锁也不查表。
+#define POSEIDON_MAIN_CONFIG_SNAPSHOT_FIELDS(field_)	\
+	field_(boost::uint64_t, job_timeout, 60000)	\
+	field_(boost::uint64_t, tcp_request_timeout, 5000)	\
+	field_(boost::uint64_t, tcp_response_timeout, 30000)	\
+	field_(boost::uint64_t, cbpp_max_request_length, 16384)	\
+	field_(boost::uint64_t, cbpp_keep_alive_timeout, 30000)	\
+	field_(boost::uint64_t, http_max_request_length, 16384)	\
+	field_(boost::uint64_t, http_keep_alive_timeout, 5000)	\
+	field_(std::size_t, http_max_header_line_length, 8192)	\
+	field_(std::size_t, http_max_headers_per_request, 64)	\
+	field_(boost::uint64_t, http_digest_nonce_expiry_time, 60000)	\
+	field_(boost::uint64_t, websocket_max_request_length, 16384)	\
+	field_(boost::uint64_t, websocket_keep_alive_timeout, 30000)	\
+	field_(std::size_t, simple_http_client_max_redirect_count, 10)	\
+	field_(std::size_t, mysql_max_retry_count, 3)	\
+	field_(boost::uint64_t, mysql_retry_init_delay, 1000)	\
+	field_(boost::uint64_t, mysql_reconn_delay, 5000)	\
+	field_(boost::uint64_t, mysql_save_delay, 5000)	\
+	field_(std::size_t, mysql_max_batch_length, 1048576)	\
+	field_(bool, mysql_use_prepared_statements, false)	\
+	field_(std::size_t, mongodb_max_retry_count, 3)	\
+	field_(boost::uint64_t, mongodb_retry_init_delay, 1000)	\
+	field_(boost::uint64_t, mongodb_reconn_delay, 5000)	\
+	field_(boost::uint64_t, mongodb_save_delay, 5000)
 
 namespace Poseidon {
 
 class Main_config {
+public:
+	struct Snapshot {
+#define POSEIDON_MAIN_CONFIG_SNAPSHOT_DECLARE_(type_, name_, def_)	type_ name_;
+		POSEIDON_MAIN_CONFIG_SNAPSHOT_FIELDS(POSEIDON_MAIN_CONFIG_SNAPSHOT_DECLARE_)
+#undef POSEIDON_MAIN_CONFIG_SNAPSHOT_DECLARE_
+	};
+
 private:
 	Main_config();
 
@@ -18,6 +53,8 @@ public:
 	static void reload();
 
 	static boost::shared_ptr<const Config_file> get_file();
+	// 在第一次 `reload()` 之前返回默认值。返回的引用一直有效，但不会反映之后的 `reload()`。
+	static const Snapshot & get_snapshot() NOEXCEPT;
 
 	static bool get_raw(std::string &val, const char *key){
 		return get_file()->get_raw(val, key);
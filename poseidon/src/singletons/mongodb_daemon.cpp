@@ -471,11 +471,11 @@ namespace {
 				conn->discard_result();
 			}
 			if(except){
-				const AUTO(max_retry_count, Main_config::get<std::size_t>("mongodb_max_retry_count", 3));
+				const AUTO(max_retry_count, Main_config::get_snapshot().mongodb_max_retry_count);
 				const AUTO(retry_count, ++(elem->retry_count));
 				if(retry_count < max_retry_count){
 					POSEIDON_LOG(Logger::special_major | Logger::level_info, "Going to retry MongoDB operation: retry_count = ", retry_count);
-					const AUTO(retry_init_delay, Main_config::get<boost::uint64_t>("mongodb_retry_init_delay", 1000));
+					const AUTO(retry_init_delay, Main_config::get_snapshot().mongodb_retry_init_delay);
 					elem->due_time = now + (retry_init_delay << retry_count);
 					conn.reset();
 					return true;
@@ -503,7 +503,7 @@ namespace {
 			boost::shared_ptr<Mongodb::Connection> master_conn, slave_conn;
 			unsigned timeout = 0;
 			for(;;){
-				const AUTO(reconnect_delay, Main_config::get<boost::uint64_t>("mongodb_reconn_delay", 5000));
+				const AUTO(reconnect_delay, Main_config::get_snapshot().mongodb_reconn_delay);
 				bool busy;
 				do {
 					while(!master_conn){
@@ -596,7 +596,7 @@ namespace {
 			const AUTO(combinable_object, operation->get_combinable_object());
 
 			const AUTO(now, get_fast_mono_clock());
-			const AUTO(save_delay, Main_config::get<boost::uint64_t>("mongodb_save_delay", 5000));
+			const AUTO(save_delay, Main_config::get_snapshot().mongodb_save_delay);
 			// 有紧急操作时无视写入延迟，这个逻辑不在这里处理。
 			const AUTO(due_time, saturated_add(now, save_delay));
 
@@ -55,10 +55,48 @@ namespace {
 		return Mysql::Connection::create(server_addr.c_str(), server_port, username.c_str(), password.c_str(), schema.c_str(), use_ssl, charset.c_str());
 	}
 
+	// 数据库线程操作。
+	class Operation_base : NONCOPYABLE {
+	private:
+		const boost::weak_ptr<Promise> m_weak_promise;
+
+		boost::shared_ptr<const void> m_probe;
+
+	public:
+		explicit Operation_base(const boost::shared_ptr<Promise> &promise)
+			: m_weak_promise(promise)
+		{
+			//
+		}
+		virtual ~Operation_base(){
+			//
+		}
+
+	public:
+		void set_probe(boost::shared_ptr<const void> probe){
+			m_probe = STD_MOVE(probe);
+		}
+
+		virtual boost::shared_ptr<Promise> get_promise() const {
+			return m_weak_promise.lock();
+		}
+		virtual bool should_use_slave() const = 0;
+		virtual boost::shared_ptr<const Mysql::Object_base> get_combinable_object() const = 0;
+		// 返回非空指针的操作可以与同一张表上相同动词的操作合并为一条多行语句，数据来自 `get_combinable_object()`。
+		virtual const char * get_batch_verb() const = 0;
+		virtual const char * get_table() const = 0;
+		virtual void generate_sql(std::string &query) const = 0;
+		// 生成最近一次 `execute()` 实际执行的语句，用于转储。
+		virtual void generate_executed_sql(std::string &query) const {
+			generate_sql(query);
+		}
+		virtual void execute(const boost::shared_ptr<Mysql::Connection> &conn) = 0;
+	};
+
 	// 对于日志文件的写操作应当互斥。
 	Mutex g_dump_mutex;
 
-	void dump_sql_to_file(const std::string &query, unsigned long err_code, const char *err_msg) NOEXCEPT
+	void dump_sql_to_file(const Operation_base &operation, unsigned long err_code, const char *err_msg) NOEXCEPT
 	try {
 		POSEIDON_PROFILE_ME;
 
@@ -87,6 +125,8 @@ namespace {
 		}
 
 		POSEIDON_LOG(Logger::special_major | Logger::level_info, "Writing MySQL dump...");
+		std::string query;
+		operation.generate_executed_sql(query);
 		Buffer_ostream os;
 		len = format_time(temp, sizeof(temp), local_now, false);
 		os <<"-- " <<temp <<": err_code = " <<err_code <<", err_msg = " <<err_msg <<std::endl;
@@ -111,47 +151,18 @@ namespace {
 		POSEIDON_LOG_ERROR("Error writing SQL dump: what = ", e.what());
 	}
 
-	// 数据库线程操作。
-	class Operation_base : NONCOPYABLE {
-	private:
-		const boost::weak_ptr<Promise> m_weak_promise;
-
-		boost::shared_ptr<const void> m_probe;
-
-	public:
-		explicit Operation_base(const boost::shared_ptr<Promise> &promise)
-			: m_weak_promise(promise)
-		{
-			//
-		}
-		virtual ~Operation_base(){
-			//
-		}
-
-	public:
-		void set_probe(boost::shared_ptr<const void> probe){
-			m_probe = STD_MOVE(probe);
-		}
-
-		virtual boost::shared_ptr<Promise> get_promise() const {
-			return m_weak_promise.lock();
-		}
-		virtual bool should_use_slave() const = 0;
-		virtual boost::shared_ptr<const Mysql::Object_base> get_combinable_object() const = 0;
-		virtual const char * get_table() const = 0;
-		virtual void generate_sql(std::string &query) const = 0;
-		virtual void execute(const boost::shared_ptr<Mysql::Connection> &conn, const std::string &query) = 0;
-	};
-
 	class Save_operation : public Operation_base {
 	private:
 		boost::shared_ptr<const Mysql::Object_base> m_object;
 		bool m_to_replace;
 
+		Mysql::Connection::Param_vector m_params;
+
 	public:
 		Save_operation(const boost::shared_ptr<Promise> &promise, boost::shared_ptr<const Mysql::Object_base> object, bool to_replace)
 			: Operation_base(promise)
 			, m_object(STD_MOVE(object)), m_to_replace(to_replace)
+			, m_params()
 		{
 			//
 		}
@@ -163,6 +174,9 @@ namespace {
 		boost::shared_ptr<const Mysql::Object_base> get_combinable_object() const OVERRIDE {
 			return m_object;
 		}
+		const char * get_batch_verb() const OVERRIDE {
+			return m_to_replace ? "REPLACE" : "INSERT";
+		}
 		const char * get_table() const OVERRIDE {
 			return m_object->get_table();
 		}
@@ -178,10 +192,53 @@ namespace {
 			query = os.get_buffer().dump_string();
 			query.erase(query.find_last_not_of(" ,") + 1);
 		}
-		void execute(const boost::shared_ptr<Mysql::Connection> &conn, const std::string &query) OVERRIDE {
+		void generate_executed_sql(std::string &query) const OVERRIDE {
+			if(m_params.empty()){
+				generate_sql(query);
+				return;
+			}
+			Buffer_ostream os;
+			os <<get_batch_verb() <<" INTO `" <<get_table() <<"` (" <<m_object->get_sql_columns() <<") VALUES (";
+			for(AUTO(it, m_params.begin()); it != m_params.end(); ++it){
+				if(it != m_params.begin()){
+					os <<", ";
+				}
+				switch(it->type){
+				case Mysql::Connection::Param::type_signed:
+					os <<static_cast<boost::int64_t>(it->integer);
+					break;
+				case Mysql::Connection::Param::type_unsigned:
+					os <<it->integer;
+					break;
+				case Mysql::Connection::Param::type_double:
+					os <<it->number;
+					break;
+				case Mysql::Connection::Param::type_string:
+				case Mysql::Connection::Param::type_blob:
+					os <<Mysql::String_escaper(it->bytes);
+					break;
+				default:
+					os <<"NULL";
+					break;
+				}
+			}
+			os <<")";
+			query = os.get_buffer().dump_string();
+		}
+		void execute(const boost::shared_ptr<Mysql::Connection> &conn) OVERRIDE {
 			POSEIDON_PROFILE_ME;
 
-			conn->execute_sql(query);
+			if(!Main_config::get_snapshot().mysql_use_prepared_statements){
+				m_params.clear();
+				std::string query;
+				generate_sql(query);
+				conn->execute_sql(query);
+				return;
+			}
+			// 通过预处理语句写入。参数是字段的副本，执行时不持有对象的锁。失败时参数保留下来，转储时据此生成文本。
+			m_params.clear();
+			m_object->generate_sql_params(m_params);
+			conn->execute_prepared(m_object->get_sql_prepared_statement(m_to_replace), m_params);
 		}
 	};
 
@@ -205,20 +262,23 @@ namespace {
 		boost::shared_ptr<const Mysql::Object_base> get_combinable_object() const OVERRIDE {
 			return VAL_INIT; // 不能合并。
 		}
+		const char * get_batch_verb() const OVERRIDE {
+			return NULLPTR;
+		}
 		const char * get_table() const OVERRIDE {
 			return m_object->get_table();
 		}
 		void generate_sql(std::string &query) const OVERRIDE {
 			query = m_query;
 		}
-		void execute(const boost::shared_ptr<Mysql::Connection> &conn, const std::string &query) OVERRIDE {
+		void execute(const boost::shared_ptr<Mysql::Connection> &conn) OVERRIDE {
 			POSEIDON_PROFILE_ME;
 
 			if(!get_promise()){
-				POSEIDON_LOG_WARNING("Discarding isolated MySQL query: table = ", get_table(), ", query = ", query);
+				POSEIDON_LOG_WARNING("Discarding isolated MySQL query: table = ", get_table(), ", query = ", m_query);
 				return;
 			}
-			conn->execute_sql(query);
+			conn->execute_sql(m_query);
 			POSEIDON_THROW_UNLESS(conn->fetch_row(), Mysql::Exception, Rcnts::view(get_table()), ER_SP_FETCH_NO_DATA, Rcnts::view("No rows returned"));
 			m_object->fetch(conn);
 		}
@@ -244,16 +304,19 @@ namespace {
 		boost::shared_ptr<const Mysql::Object_base> get_combinable_object() const OVERRIDE {
 			return VAL_INIT; // 不能合并。
 		}
+		const char * get_batch_verb() const OVERRIDE {
+			return NULLPTR;
+		}
 		const char * get_table() const OVERRIDE {
 			return m_table_hint;
 		}
 		void generate_sql(std::string &query) const OVERRIDE {
 			query = m_query;
 		}
-		void execute(const boost::shared_ptr<Mysql::Connection> &conn, const std::string &query) OVERRIDE {
+		void execute(const boost::shared_ptr<Mysql::Connection> &conn) OVERRIDE {
 			POSEIDON_PROFILE_ME;
 
-			conn->execute_sql(query);
+			conn->execute_sql(m_query);
 		}
 	};
 
@@ -278,20 +341,23 @@ namespace {
 		boost::shared_ptr<const Mysql::Object_base> get_combinable_object() const OVERRIDE {
 			return VAL_INIT; // 不能合并。
 		}
+		const char * get_batch_verb() const OVERRIDE {
+			return NULLPTR;
+		}
 		const char * get_table() const OVERRIDE {
 			return m_table_hint;
 		}
 		void generate_sql(std::string &query) const OVERRIDE {
 			query = m_query;
 		}
-		void execute(const boost::shared_ptr<Mysql::Connection> &conn, const std::string &query) OVERRIDE {
+		void execute(const boost::shared_ptr<Mysql::Connection> &conn) OVERRIDE {
 			POSEIDON_PROFILE_ME;
 
 			if(!get_promise()){
-				POSEIDON_LOG_WARNING("Discarding isolated MySQL query: table = ", get_table(), ", query = ", query);
+				POSEIDON_LOG_WARNING("Discarding isolated MySQL query: table = ", get_table(), ", query = ", m_query);
 				return;
 			}
-			conn->execute_sql(query);
+			conn->execute_sql(m_query);
 			if(m_callback){
 				while(conn->fetch_row()){
 					m_callback(conn);
@@ -323,13 +389,16 @@ namespace {
 		boost::shared_ptr<const Mysql::Object_base> get_combinable_object() const OVERRIDE {
 			return VAL_INIT; // 不能合并。
 		}
+		const char * get_batch_verb() const OVERRIDE {
+			return NULLPTR;
+		}
 		const char * get_table() const OVERRIDE {
 			return m_table_hint;
 		}
 		void generate_sql(std::string & /* query */) const OVERRIDE {
 			// no query
 		}
-		void execute(const boost::shared_ptr<Mysql::Connection> &conn, const std::string & /* query */) OVERRIDE {
+		void execute(const boost::shared_ptr<Mysql::Connection> &conn) OVERRIDE {
 			POSEIDON_PROFILE_ME;
 
 			m_callback(conn);
@@ -360,25 +429,29 @@ namespace {
 		boost::shared_ptr<const Mysql::Object_base> get_combinable_object() const OVERRIDE {
 			return VAL_INIT; // 不能合并。
 		}
+		const char * get_batch_verb() const OVERRIDE {
+			return NULLPTR;
+		}
 		const char * get_table() const OVERRIDE {
 			return "";
 		}
 		void generate_sql(std::string &query) const OVERRIDE {
 			query = "DO 0";
 		}
-		void execute(const boost::shared_ptr<Mysql::Connection> &conn, const std::string &query) OVERRIDE {
+		void execute(const boost::shared_ptr<Mysql::Connection> &conn) OVERRIDE {
 			POSEIDON_PROFILE_ME;
 
-			conn->execute_sql(query);
+			conn->execute_sql("DO 0");
 		}
 	};
 
 	class Mysql_thread : NONCOPYABLE {
 	private:
 		struct Operation_queue_element {
-			boost::shared_ptr<Operation_base> operation;
+			boost::shared_ptr<Operation_base> operation; // 为空表示已经作为多行语句的一部分执行完毕。
 			boost::uint64_t due_time;
 			std::size_t retry_count;
+			bool unbatched; // 多行语句失败之后，逐行执行。
 		};
 
 	private:
@@ -389,16 +462,178 @@ namespace {
 		mutable Condition_variable m_new_operation;
 		volatile bool m_urgent; // 无视延迟写入，一次性处理队列中所有操作。
 		boost::container::deque<Operation_queue_element> m_queue;
+		std::size_t m_finished_count; // `m_queue` 中已经执行完毕、尚未弹出的元素个数。
 
 	public:
 		Mysql_thread()
 			: m_running(false)
-			, m_urgent(false), m_queue()
+			, m_urgent(false), m_queue(), m_finished_count(0)
 		{
 			//
 		}
 
 	private:
+		// 调用者必须持有 `m_mutex`。弹出之后队首不会是已经执行完毕的操作。
+		void pop_front_operation(){
+			do {
+				if(!m_queue.front().operation){
+					--m_finished_count;
+				}
+				m_queue.pop_front();
+			} while(!m_queue.empty() && !m_queue.front().operation);
+		}
+
+		// 把队首开始的、连续的、已经到期的写入操作中，与队首同一张表、相同动词的，合并为一条多行语句执行。
+		// 遇到其他表或者其他类型的操作时停止，以保证所有操作按入队的顺序执行（例如外键约束要求先写入父表）。
+		// 生成成功时返回 true，`batch` 中是已经合并的操作（包括被更新的写入操作覆盖的那些）；否则返回 false。
+		bool generate_batched_sql(std::string &query, std::size_t &row_count, boost::container::vector<Operation_queue_element *> &batch, boost::uint64_t now){
+			POSEIDON_PROFILE_ME;
+
+			const AUTO(max_batch_length, Main_config::get_snapshot().mysql_max_batch_length);
+			if(max_batch_length == 0){
+				return false;
+			}
+
+			boost::container::vector<Operation_queue_element *> candidates;
+			const char *table;
+			const char *verb;
+			{
+				const Mutex::Unique_lock lock(m_mutex);
+				AUTO(it, m_queue.begin());
+				if((it->retry_count != 0) || it->unbatched){
+					return false;
+				}
+				table = it->operation->get_table();
+				verb = it->operation->get_batch_verb();
+				if(!verb){
+					return false;
+				}
+				const bool urgent = atomic_load(m_urgent, memory_order_consume);
+				for(; it != m_queue.end(); ++it){
+					if(!it->operation){
+						continue;
+					}
+					if(!urgent && (now < it->due_time)){
+						break;
+					}
+					const char *const test_verb = it->operation->get_batch_verb();
+					if(!test_verb || it->unbatched){
+						break;
+					}
+					if((std::strcmp(it->operation->get_table(), table) != 0) || (std::strcmp(test_verb, verb) != 0)){
+						break;
+					}
+					candidates.push_back(&*it);
+				}
+			}
+			if(candidates.size() < 2){
+				return false;
+			}
+
+			// 生成语句。一个对象在队列中出现多次时只写入一行。超出长度限制的操作留待下次执行。
+			boost::container::flat_set<const void *> objects;
+			batch.reserve(candidates.size());
+			objects.reserve(candidates.size());
+			for(AUTO(it, candidates.begin()); it != candidates.end(); ++it){
+				const AUTO(elem, *it);
+				const AUTO(combinable_object, elem->operation->get_combinable_object());
+				const AUTO(old_write_stamp, combinable_object->get_combined_write_stamp());
+				if(old_write_stamp && (old_write_stamp != elem)){
+					// 有更新的写入操作，这一个直接完成。
+					batch.push_back(elem);
+					continue;
+				}
+				if(objects.count(combinable_object.get()) != 0){
+					combinable_object->set_combined_write_stamp(NULLPTR);
+					batch.push_back(elem);
+					continue;
+				}
+				if(query.empty()){
+					query += verb;
+					query += " INTO `";
+					query += table;
+					query += "` (";
+					query += combinable_object->get_sql_columns();
+					query += ") VALUES ";
+				}
+				Buffer_ostream os;
+				os <<"(";
+				combinable_object->generate_sql_values(os);
+				AUTO(row, os.get_buffer().dump_string());
+				row.erase(row.find_last_not_of(" ,") + 1);
+				row += ")";
+				if((row_count != 0) && (query.size() + 2 + row.size() > max_batch_length)){
+					break;
+				}
+				if(row_count != 0){
+					query += ", ";
+				}
+				query += row;
+				++row_count;
+				combinable_object->set_combined_write_stamp(NULLPTR);
+				objects.insert(combinable_object.get());
+				batch.push_back(elem);
+			}
+			if(row_count < 2){
+				return false;
+			}
+			POSEIDON_LOG_DEBUG("Executing batched SQL: table = ", table, ", row_count = ", row_count, ", operation_count = ", batch.size());
+			return true;
+		}
+		// 调用者必须持有 `m_mutex`。
+		void mark_unbatched(const boost::container::vector<Operation_queue_element *> &batch){
+			m_queue.front().unbatched = true;
+			for(AUTO(it, batch.begin()); it != batch.end(); ++it){
+				(*it)->unbatched = true;
+			}
+		}
+		// 合并成功时返回 true；否则返回 false，由调用者逐个执行队首的操作。
+		bool pump_batched_operations(boost::shared_ptr<Mysql::Connection> &master_conn, boost::uint64_t now) NOEXCEPT {
+			POSEIDON_PROFILE_ME;
+
+			std::string query;
+			std::size_t row_count = 0;
+			boost::container::vector<Operation_queue_element *> batch;
+			try {
+				if(!generate_batched_sql(query, row_count, batch, now)){
+					// 写入标记可能已经清除，逐个执行时不会被跳过。
+					if(!batch.empty()){
+						const Mutex::Unique_lock lock(m_mutex);
+						mark_unbatched(batch);
+					}
+					return false;
+				}
+				master_conn->execute_sql(query);
+			} catch(std::exception &e){
+				POSEIDON_LOG_WARNING("Batched SQL failed, falling back to single rows: row_count = ", row_count, ", what = ", e.what());
+				master_conn->discard_result();
+				const Mutex::Unique_lock lock(m_mutex);
+				mark_unbatched(batch);
+				return false;
+			} catch(...){
+				POSEIDON_LOG_WARNING("Batched SQL failed, falling back to single rows: row_count = ", row_count, ", what = <unknown>");
+				master_conn->discard_result();
+				const Mutex::Unique_lock lock(m_mutex);
+				mark_unbatched(batch);
+				return false;
+			}
+			master_conn->discard_result();
+
+			for(AUTO(it, batch.begin()); it != batch.end(); ++it){
+				const AUTO(promise, (*it)->operation->get_promise());
+				if(promise){
+					promise->set_success(false);
+				}
+			}
+			const Mutex::Unique_lock lock(m_mutex);
+			for(AUTO(it, batch.begin()); it != batch.end(); ++it){
+				(*it)->operation.reset();
+			}
+			m_finished_count += batch.size();
+			pop_front_operation();
+			return true;
+		}
+
 		bool pump_one_operation(boost::shared_ptr<Mysql::Connection> &master_conn, boost::shared_ptr<Mysql::Connection> &slave_conn) NOEXCEPT {
 			POSEIDON_PROFILE_ME;
 
@@ -415,10 +650,12 @@ namespace {
 				}
 				elem = &m_queue.front();
 			}
+			if(pump_batched_operations(master_conn, now)){
+				return true;
+			}
 			const AUTO_REF(operation, elem->operation);
 			AUTO_REF(conn, elem->operation->should_use_slave() ? slave_conn : master_conn);
 
-			std::string query;
 			STD_EXCEPTION_PTR except;
 			unsigned long err_code = 0;
 			char err_msg[4096];
@@ -439,9 +676,12 @@ namespace {
 			}
 			if(execute_it){
 				try {
-					operation->generate_sql(query);
-					POSEIDON_LOG_DEBUG("Executing SQL: table = ", operation->get_table(), ", query = ", query);
-					operation->execute(conn, query);
+					if(Logger::check_mask(Logger::special_poseidon | Logger::level_debug)){
+						std::string query;
+						operation->generate_sql(query);
+						POSEIDON_LOG_DEBUG("Executing SQL: table = ", operation->get_table(), ", query = ", query);
+					}
+					operation->execute(conn);
 				} catch(Mysql::Exception &e){
 					POSEIDON_LOG_WARNING("Mysql::Exception thrown: code = ", e.get_code(), ", what = ", e.what());
 					except = STD_CURRENT_EXCEPTION();
@@ -461,17 +701,17 @@ namespace {
 				conn->discard_result();
 			}
 			if(except){
-				const AUTO(max_retry_count, Main_config::get<std::size_t>("mysql_max_retry_count", 3));
+				const AUTO(max_retry_count, Main_config::get_snapshot().mysql_max_retry_count);
 				const AUTO(retry_count, ++(elem->retry_count));
 				if(retry_count < max_retry_count){
 					POSEIDON_LOG(Logger::special_major | Logger::level_info, "Going to retry MySQL operation: retry_count = ", retry_count);
-					const AUTO(retry_init_delay, Main_config::get<boost::uint64_t>("mysql_retry_init_delay", 1000));
+					const AUTO(retry_init_delay, Main_config::get_snapshot().mysql_retry_init_delay);
 					elem->due_time = now + (retry_init_delay << retry_count);
 					conn.reset();
 					return true;
 				}
 				POSEIDON_LOG_ERROR("Max retry count exceeded.");
-				dump_sql_to_file(query, err_code, err_msg);
+				dump_sql_to_file(*operation, err_code, err_msg);
 			}
 			const AUTO(promise, elem->operation->get_promise());
 			if(promise){
@@ -482,7 +722,7 @@ namespace {
 				}
 			}
 			const Mutex::Unique_lock lock(m_mutex);
-			m_queue.pop_front();
+			pop_front_operation();
 			return true;
 		}
 
@@ -493,7 +733,7 @@ namespace {
 			boost::shared_ptr<Mysql::Connection> master_conn, slave_conn;
 			unsigned timeout = 0;
 			for(;;){
-				const AUTO(reconnect_delay, Main_config::get<boost::uint64_t>("mysql_reconn_delay", 5000));
+				const AUTO(reconnect_delay, Main_config::get_snapshot().mysql_reconn_delay);
 				bool busy;
 				do {
 					while(!master_conn){
@@ -559,7 +799,7 @@ namespace {
 				std::string current_sql;
 				{
 					const Mutex::Unique_lock lock(m_mutex);
-					pending_objects = m_queue.size();
+					pending_objects = m_queue.size() - m_finished_count;
 					if(pending_objects == 0){
 						break;
 					}
@@ -578,7 +818,7 @@ namespace {
 
 		std::size_t get_queue_size() const {
 			const Mutex::Unique_lock lock(m_mutex);
-			return m_queue.size();
+			return m_queue.size() - m_finished_count;
 		}
 		void add_operation(boost::shared_ptr<Operation_base> operation, bool urgent){
 			POSEIDON_PROFILE_ME;
@@ -586,13 +826,13 @@ namespace {
 			const AUTO(combinable_object, operation->get_combinable_object());
 
 			const AUTO(now, get_fast_mono_clock());
-			const AUTO(save_delay, Main_config::get<boost::uint64_t>("mysql_save_delay", 5000));
+			const AUTO(save_delay, Main_config::get_snapshot().mysql_save_delay);
 			// 有紧急操作时无视写入延迟，这个逻辑不在这里处理。
 			const AUTO(due_time, saturated_add(now, save_delay));
 
 			const Mutex::Unique_lock lock(m_mutex);
 			POSEIDON_THROW_UNLESS(atomic_load(m_running, memory_order_consume), Exception, Rcnts::view("MySQL thread is being shut down"));
-			Operation_queue_element elem = { STD_MOVE(operation), due_time };
+			Operation_queue_element elem = { STD_MOVE(operation), due_time, 0, false };
 			m_queue.push_back(STD_MOVE(elem));
 			if(combinable_object){
 				const AUTO(old_write_stamp, combinable_object->get_combined_write_stamp());
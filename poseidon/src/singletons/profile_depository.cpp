@@ -7,6 +7,8 @@
 #include "../mutex.hpp"
 #include "../log.hpp"
 #include "../profiler.hpp"
+#include "../atomic.hpp"
+#include "../time.hpp"
 
 namespace Poseidon {
 
@@ -20,6 +22,10 @@ namespace {
 		unsigned long long samples;
 		double total;
 		double exclusive;
+
+		boost::container::vector<boost::uint64_t> latency_counts; // 为空表示当前窗口内没有数据。
+		unsigned long long latency_samples;
+		double latency_max;
 	};
 	struct Profile_key_comparator {
 		bool operator()(const Profile_key &lhs, const Profile_key &rhs) const NOEXCEPT {
@@ -33,15 +39,61 @@ namespace {
 	typedef boost::container::flat_map<Profile_key, Profile_counters, Profile_key_comparator> Profile_map;
 
 	bool g_enabled = false;
+	unsigned long g_sample_interval = 1;
+	volatile unsigned long g_generation = 0;
+	volatile unsigned long g_latency_generation = 0;
 
 	Mutex g_mutex;
 	Profile_map g_profile;
+	double g_latency_window_start = 0;
+
+	double get_latency_bucket_upper_bound(std::size_t index){
+		// 这是 `get_latency_bucket()` 的逆运算，结果是该桶所能容纳的微秒数的上界（不含）。
+		CONSTEXPR const unsigned sub_bits = Profile_depository::latency_sub_bucket_bits;
+		if(index < (2u << sub_bits)){
+			return static_cast<double>(index + 1);
+		}
+		const unsigned shift = static_cast<unsigned>(index >> sub_bits) - 1;
+		const boost::uint64_t mantissa = (index & ((1u << sub_bits) - 1)) | (1u << sub_bits);
+		return static_cast<double>((mantissa + 1) << shift);
+	}
+	double get_latency_percentile(const Profile_counters &counters, double fraction){
+		// 取第 ceil(fraction * samples) 个样本所在的桶。
+		const AUTO(rank, static_cast<unsigned long long>(std::ceil(static_cast<double>(counters.latency_samples) * fraction)));
+		unsigned long long seen = 0;
+		for(std::size_t i = 0; i < counters.latency_counts.size(); ++i){
+			seen += counters.latency_counts[i];
+			if((seen != 0) && (seen >= rank)){
+				return std::min(get_latency_bucket_upper_bound(i) / 1000, counters.latency_max);
+			}
+		}
+		return counters.latency_max;
+	}
+	void add_latency_counts(Profile_counters &counters, const boost::uint32_t *counts, unsigned long long samples, double max){
+		if(counters.latency_counts.empty()){
+			counters.latency_counts.resize(Profile_depository::latency_bucket_count);
+		}
+		for(std::size_t i = 0; i < Profile_depository::latency_bucket_count; ++i){
+			counters.latency_counts[i] += counts[i];
+		}
+		counters.latency_samples += samples;
+		counters.latency_max = std::max(counters.latency_max, max);
+	}
 }
 
 void Profile_depository::start(){
 	POSEIDON_LOG(Logger::special_major | Logger::level_info, "Starting profile depository...");
 
 	g_enabled = Main_config::get<bool>("profiler_enabled", false);
+	const AUTO(sample_interval, Main_config::get<unsigned long>("profiler_sample_interval", 1));
+	if(sample_interval == 0){
+		POSEIDON_LOG_FATAL("You shall not set `profiler_sample_interval` in `main.conf` to zero.");
+		std::terminate();
+	}
+	g_sample_interval = sample_interval;
+
+	const Mutex::Unique_lock lock(g_mutex);
+	g_latency_window_start = get_hi_res_mono_clock();
 }
 void Profile_depository::stop(){
 	POSEIDON_LOG(Logger::special_major | Logger::level_info, "Stopping profile depository...");
@@ -53,21 +105,78 @@ void Profile_depository::stop(){
 bool Profile_depository::is_enabled() NOEXCEPT {
 	return g_enabled;
 }
+unsigned long Profile_depository::get_sample_interval() NOEXCEPT {
+	return g_sample_interval;
+}
+unsigned long Profile_depository::get_generation() NOEXCEPT {
+	return atomic_load(g_generation, memory_order_relaxed);
+}
+unsigned long Profile_depository::get_latency_generation() NOEXCEPT {
+	return atomic_load(g_latency_generation, memory_order_relaxed);
+}
 
-void Profile_depository::accumulate(const char *file, unsigned long line, const char *func, bool new_sample, double total, double exclusive) NOEXCEPT
+void Profile_depository::accumulate(const char *file, unsigned long line, const char *func, unsigned long long samples, double total, double exclusive) NOEXCEPT
 try {
 	const Mutex::Unique_lock lock(g_mutex);
 	const Profile_key key = { file, line, func };
 	AUTO_REF(counters, g_profile[key]);
-	counters.samples += new_sample;
+	counters.samples += samples;
 	counters.total += total;
 	counters.exclusive += exclusive;
 } catch(...){
 	//
 }
 
+std::size_t Profile_depository::get_latency_bucket(double latency) NOEXCEPT {
+	// 小于 32 微秒的值每微秒一个桶，更大的值每个数量级分为 16 个桶。
+	CONSTEXPR const unsigned sub_bits = latency_sub_bucket_bits;
+	if(!(latency >= 0)){
+		return 0;
+	}
+	const double usecs = latency * 1000;
+	if(usecs >= static_cast<double>(1ull << latency_max_magnitude)){
+		return latency_bucket_count - 1;
+	}
+	const AUTO(value, static_cast<boost::uint64_t>(usecs));
+	if(value < (2u << sub_bits)){
+		return static_cast<std::size_t>(value);
+	}
+	const unsigned magnitude = 63 - static_cast<unsigned>(__builtin_clzll(value));
+	const unsigned shift = magnitude - sub_bits;
+	return (static_cast<std::size_t>(shift) << sub_bits) + static_cast<std::size_t>(value >> shift);
+}
+void Profile_depository::accumulate_latency(const char *file, unsigned long line, const char *func, double latency, unsigned long long samples) NOEXCEPT
+try {
+	const Mutex::Unique_lock lock(g_mutex);
+	const Profile_key key = { file, line, func };
+	AUTO_REF(counters, g_profile[key]);
+	if(counters.latency_counts.empty()){
+		counters.latency_counts.resize(latency_bucket_count);
+	}
+	counters.latency_counts[get_latency_bucket(latency)] += samples;
+	counters.latency_samples += samples;
+	counters.latency_max = std::max(counters.latency_max, latency);
+} catch(...){
+	//
+}
+void Profile_depository::accumulate_latency(const char *file, unsigned long line, const char *func, const boost::uint32_t *counts, double max) NOEXCEPT
+try {
+	unsigned long long samples = 0;
+	for(std::size_t i = 0; i < latency_bucket_count; ++i){
+		samples += counts[i];
+	}
+	if(samples == 0){
+		return;
+	}
+	const Mutex::Unique_lock lock(g_mutex);
+	const Profile_key key = { file, line, func };
+	add_latency_counts(g_profile[key], counts, samples, max);
+} catch(...){
+	//
+}
+
 void Profile_depository::snapshot(boost::container::vector<Profile_depository::Snapshot_element> &ret){
-	Profiler::accumulate_all_in_thread();
+	Profiler::accumulate_all_threads();
 
 	const Mutex::Unique_lock lock(g_mutex);
 	ret.reserve(ret.size() + g_profile.size());
@@ -79,12 +188,41 @@ void Profile_depository::snapshot(boost::container::vector<Profile_depository::S
 		elem.samples = it->second.samples;
 		elem.total = it->second.total;
 		elem.exclusive = it->second.exclusive;
+		elem.latency_samples = it->second.latency_samples;
+		if(elem.latency_samples != 0){
+			elem.latency_p50 = get_latency_percentile(it->second, 0.5);
+			elem.latency_p90 = get_latency_percentile(it->second, 0.9);
+			elem.latency_p99 = get_latency_percentile(it->second, 0.99);
+			elem.latency_p999 = get_latency_percentile(it->second, 0.999);
+			elem.latency_max = it->second.latency_max;
+		}
 		ret.push_back(STD_MOVE(elem));
 	}
 }
 void Profile_depository::clear() NOEXCEPT {
 	const Mutex::Unique_lock lock(g_mutex);
+	atomic_add(g_generation, 1, memory_order_relaxed);
 	g_profile.clear();
+	g_latency_window_start = get_hi_res_mono_clock();
+}
+
+void Profile_depository::reset_latency_window() NOEXCEPT {
+	// 当前线程尚未合并的延迟计入旧的窗口。其他线程尚未合并的延迟会被它们自己丢弃，不会算到新的窗口里。
+	Profiler::accumulate_all_in_thread();
+
+	const Mutex::Unique_lock lock(g_mutex);
+	atomic_add(g_latency_generation, 1, memory_order_relaxed);
+	for(AUTO(it, g_profile.begin()); it != g_profile.end(); ++it){
+		AUTO_REF(counters, it->second);
+		counters.latency_counts.clear();
+		counters.latency_samples = 0;
+		counters.latency_max = 0;
+	}
+	g_latency_window_start = get_hi_res_mono_clock();
+}
+double Profile_depository::get_latency_window_start() NOEXCEPT {
+	const Mutex::Unique_lock lock(g_mutex);
+	return g_latency_window_start;
 }
 
 }
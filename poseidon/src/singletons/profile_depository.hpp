@@ -6,6 +6,8 @@
 
 #include "../cxx_ver.hpp"
 #include <boost/container/vector.hpp>
+#include <boost/cstdint.hpp>
+#include <cstddef>
 
 namespace Poseidon {
 
@@ -18,6 +20,22 @@ public:
 		unsigned long long samples; // 采样数。
 		double total; // 控制流进入函数，直到退出函数（正常返回或异常被抛出），经历的总毫秒数。
 		double exclusive; // ms_total 扣除执行点位于其他 profiler 之中的毫秒数。
+
+		// 以下数据只统计当前的延迟窗口，即上一次 `reset_latency_window()` 之后完成的调用。
+		// 百分位数取自对数线性直方图，误差不超过 1/16，单位为毫秒。
+		unsigned long long latency_samples;
+		double latency_p50;
+		double latency_p90;
+		double latency_p99;
+		double latency_p999;
+		double latency_max;
+	};
+
+	// 延迟直方图的桶数。每个数量级（二进制）分为 16 个桶，以微秒计，超过 2^40 微秒（约 12 天）的按最后一个桶计。
+	enum {
+		latency_sub_bucket_bits = 4,
+		latency_max_magnitude = 40,
+		latency_bucket_count = (latency_max_magnitude - latency_sub_bucket_bits + 1) << latency_sub_bucket_bits
 	};
 
 private:
@@ -28,10 +46,27 @@ public:
 	static void stop();
 
 	static bool is_enabled() NOEXCEPT;
-	static void accumulate(const char *file, unsigned long line, const char *func, bool new_sample, double total, double exclusive) NOEXCEPT;
+	// 平均每这么多次进入作用域计时一次，计数按这个倍数放大。为 1 表示每次都计时。
+	static unsigned long get_sample_interval() NOEXCEPT;
+	// 每次 `clear()` 都会使它递增。
+	static unsigned long get_generation() NOEXCEPT;
+	// 每次 `reset_latency_window()` 都会使它递增。
+	static unsigned long get_latency_generation() NOEXCEPT;
+	static void accumulate(const char *file, unsigned long line, const char *func, unsigned long long samples, double total, double exclusive) NOEXCEPT;
+
+	// `latency` 是单次调用从进入到退出经历的毫秒数，`samples` 是它代表的采样数。
+	static std::size_t get_latency_bucket(double latency) NOEXCEPT;
+	static void accumulate_latency(const char *file, unsigned long line, const char *func, double latency, unsigned long long samples) NOEXCEPT;
+	// `counts` 指向 `latency_bucket_count` 个计数。
+	static void accumulate_latency(const char *file, unsigned long line, const char *func, const boost::uint32_t *counts, double max) NOEXCEPT;
 
 	static void snapshot(boost::container::vector<Snapshot_element> &ret);
 	static void clear() NOEXCEPT;
+
+	// 清空所有延迟直方图，开始一个新的窗口；其他计数不受影响。
+	static void reset_latency_window() NOEXCEPT;
+	// 当前窗口开始的时刻，参考 `get_hi_res_mono_clock()`。
+	static double get_latency_window_start() NOEXCEPT;
 };
 
 }
@@ -279,7 +279,7 @@ namespace {
 				boost::shared_ptr<Simple_http_client> client;
 
 				const bool should_check_redirect = can_be_redirected(request);
-				const AUTO(max_redirect_count, Main_config::get<std::size_t>("simple_http_client_max_redirect_count", 10));
+				const AUTO(max_redirect_count, Main_config::get_snapshot().simple_http_client_max_redirect_count);
 				std::size_t retry_count_remaining = checked_add<std::size_t>(max_redirect_count, 1);
 				do {
 					const AUTO(verb, request.request_headers.verb);
@@ -343,7 +343,7 @@ Simple_http_response Simple_http_client_daemon::perform(Simple_http_request requ
 	boost::shared_ptr<Simple_http_client> client;
 
 	const bool should_check_redirect = can_be_redirected(request);
-	const AUTO(max_redirect_count, Main_config::get<std::size_t>("simple_http_client_max_redirect_count", 10));
+	const AUTO(max_redirect_count, Main_config::get_snapshot().simple_http_client_max_redirect_count);
 	std::size_t retry_count_remaining = checked_add<std::size_t>(max_redirect_count, 1);
 	do {
 		const AUTO(verb, request.request_headers.verb);
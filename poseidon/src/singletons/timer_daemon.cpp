@@ -3,6 +3,7 @@
 
 #include "../precompiled.hpp"
 #include "timer_daemon.hpp"
+#include "main_config.hpp"
 #include "job_dispatcher.hpp"
 #include "../thread.hpp"
 #include "../log.hpp"
@@ -19,8 +20,33 @@ namespace Poseidon {
 
 typedef Timer_daemon::Timer_callback Timer_callback;
 
-class Timer : NONCOPYABLE {
+namespace {
+	enum Wheel_location {
+		wheel_location_none      = -1,
+		wheel_location_due       = -2, // 已经到期，等待触发。
+		wheel_location_overflow  = -3, // 超出最高层的范围。
+		// 非负值表示 `level * wheel_slots + slot`。
+	};
+
+	// 时间轮中的链表节点，所有成员都受 `g_mutex` 保护。
+	struct Timer_link {
+		Timer_link *next;
+		Timer_link **pprev;
+		int where;
+		boost::uint64_t expiry;
+	};
+
+	Mutex g_mutex;
+	Condition_variable g_new_timer;
+	// 计时器线程会睡眠到这个时刻。在此之后到期的计时器不必唤醒它。线程醒着时为零。
+	boost::uint64_t g_sleep_until;
+
+	void unlink_timer(Timer_link *link) NOEXCEPT;
+}
+
+class Timer : NONCOPYABLE, public Timer_link {
 private:
+	boost::weak_ptr<Timer> m_weak_self;
 	boost::uint64_t m_period;
 	unsigned long m_stamp;
 	Timer_callback m_callback;
@@ -28,15 +54,28 @@ private:
 
 public:
 	Timer(boost::uint64_t period, Timer_callback callback, bool low_level)
-		: m_period(period), m_stamp(0), m_callback(STD_MOVE_IDN(callback)), m_low_level(low_level)
+		: Timer_link(), m_weak_self(), m_period(period), m_stamp(0), m_callback(STD_MOVE_IDN(callback)), m_low_level(low_level)
 	{
-		//
+		where = wheel_location_none;
+	}
+	~Timer(){
+		const Mutex::Unique_lock lock(g_mutex);
+		unlink_timer(this);
 	}
 
 public:
+	// 在时间轮中只保存裸指针，取出时需要用它来判断计时器是否正在被析构。
+	const boost::weak_ptr<Timer> & get_weak_self() const {
+		return m_weak_self;
+	}
+	void set_weak_self(const boost::shared_ptr<Timer> &self){
+		m_weak_self = self;
+	}
+
 	boost::uint64_t get_period() const {
 		return m_period;
 	}
+	// 二叉堆中旧的元素不会被删除，用它来识别。
 	unsigned long get_stamp() const {
 		return m_stamp;
 	}
@@ -47,10 +86,12 @@ public:
 		return m_low_level;
 	}
 
-	unsigned long set_period(boost::uint64_t period){
+	void set_period(boost::uint64_t period){
 		if(period != Timer_daemon::period_intact){
 			m_period = period;
 		}
+	}
+	unsigned long renew_stamp(){
 		return ++m_stamp;
 	}
 };
@@ -90,6 +131,172 @@ namespace {
 		}
 	};
 
+	// 分层时间轮。每层有 64 个槽，第 n 层的一个槽覆盖 64^n 毫秒。
+	// 插入和删除都是 O(1) 的。高层的计时器只在时间走到它所在的槽时才降到低层（惰性级联）。
+	enum {
+		wheel_bits    = 6,
+		wheel_levels  = 6,
+		wheel_slots   = 1u << wheel_bits,
+		wheel_mask    = wheel_slots - 1,
+	};
+
+	Timer_link *g_wheel[wheel_levels][wheel_slots];
+	boost::uint64_t g_wheel_masks[wheel_levels]; // 每一位表示对应的槽是否非空。
+	Timer_link *g_overflow;
+	// 到期的计时器按先后顺序排列，从尾部追加，从头部取出。
+	Timer_link *g_due;
+	Timer_link **g_due_tail = &g_due;
+	// 到期时间不晚于这个值的计时器都已经被移入 `g_due`。
+	boost::uint64_t g_wheel_time;
+
+	void push_link(Timer_link **head, Timer_link *link, int where) NOEXCEPT {
+		link->next = *head;
+		if(link->next){
+			link->next->pprev = &(link->next);
+		}
+		link->pprev = head;
+		*head = link;
+		link->where = where;
+	}
+	void append_due_link(Timer_link *link) NOEXCEPT {
+		link->next = NULLPTR;
+		link->pprev = g_due_tail;
+		*g_due_tail = link;
+		g_due_tail = &(link->next);
+		link->where = wheel_location_due;
+	}
+	void unlink_timer(Timer_link *link) NOEXCEPT {
+		if(link->where == wheel_location_none){
+			return;
+		}
+		if(g_due_tail == &(link->next)){
+			g_due_tail = link->pprev;
+		}
+		*(link->pprev) = link->next;
+		if(link->next){
+			link->next->pprev = link->pprev;
+		}
+		if(link->where >= 0){
+			const unsigned level = static_cast<unsigned>(link->where) / wheel_slots;
+			const unsigned slot = static_cast<unsigned>(link->where) % wheel_slots;
+			if(!g_wheel[level][slot]){
+				g_wheel_masks[level] &= ~(1ull << slot);
+			}
+		}
+		link->where = wheel_location_none;
+	}
+
+	bool is_wheel_empty() NOEXCEPT {
+		for(unsigned level = 0; level < wheel_levels; ++level){
+			if(g_wheel_masks[level] != 0){
+				return false;
+			}
+		}
+		return !g_overflow && !g_due;
+	}
+
+	void insert_timer(Timer_link *link, boost::uint64_t expiry) NOEXCEPT {
+		link->expiry = expiry;
+		if(expiry <= g_wheel_time){
+			append_due_link(link);
+			return;
+		}
+		// 放在与当前时间的高位全部相同的最低一层上，这样在级联之前一定不会错过。
+		for(unsigned level = 0; level < wheel_levels; ++level){
+			const unsigned shift = (level + 1) * wheel_bits;
+			if((expiry >> shift) != (g_wheel_time >> shift)){
+				continue;
+			}
+			const unsigned slot = (expiry >> (level * wheel_bits)) & wheel_mask;
+			push_link(&(g_wheel[level][slot]), link, static_cast<int>(level * wheel_slots + slot));
+			g_wheel_masks[level] |= 1ull << slot;
+			return;
+		}
+		push_link(&g_overflow, link, wheel_location_overflow);
+	}
+	void reinsert_list(Timer_link **head) NOEXCEPT {
+		AUTO(link, *head);
+		while(link){
+			const AUTO(next, link->next);
+			unlink_timer(link);
+			insert_timer(link, link->expiry);
+			link = next;
+		}
+	}
+
+	void tick_wheel() NOEXCEPT {
+		const AUTO(now, ++g_wheel_time);
+		if((now & ((1ull << (wheel_levels * wheel_bits)) - 1)) == 0){
+			reinsert_list(&g_overflow);
+		}
+		for(unsigned level = wheel_levels - 1; level != 0; --level){
+			const unsigned shift = level * wheel_bits;
+			if((now & ((1ull << shift) - 1)) != 0){
+				continue;
+			}
+			reinsert_list(&(g_wheel[level][(now >> shift) & wheel_mask]));
+		}
+		reinsert_list(&(g_wheel[0][now & wheel_mask]));
+	}
+	// 一次最多推进到有计时器到期为止，这样先到期的计时器先触发。
+	void advance_wheel(boost::uint64_t now) NOEXCEPT {
+		while(!g_due && (g_wheel_time < now)){
+			if(is_wheel_empty()){
+				g_wheel_time = now;
+				break;
+			}
+			// 第零层在当前块中剩余的槽都是空的，直接跳到块的末尾。
+			const unsigned slot = g_wheel_time & wheel_mask;
+			if((slot != wheel_mask) && ((g_wheel_masks[0] >> (slot + 1)) == 0)){
+				g_wheel_time = std::min<boost::uint64_t>(g_wheel_time | wheel_mask, now);
+				continue;
+			}
+			tick_wheel();
+		}
+	}
+	void clear_wheel() NOEXCEPT {
+		for(unsigned level = 0; level < wheel_levels; ++level){
+			for(unsigned slot = 0; slot < wheel_slots; ++slot){
+				while(g_wheel[level][slot]){
+					unlink_timer(g_wheel[level][slot]);
+				}
+			}
+		}
+		while(g_overflow){
+			unlink_timer(g_overflow);
+		}
+		while(g_due){
+			unlink_timer(g_due);
+		}
+	}
+	// 返回下一个计时器到期时间的下界。
+	boost::uint64_t get_wheel_next_expiry() NOEXCEPT {
+		if(g_due){
+			return 0;
+		}
+		boost::uint64_t next = -1ull;
+		if(g_overflow){
+			const unsigned shift = wheel_levels * wheel_bits;
+			next = ((g_wheel_time >> shift) + 1) << shift;
+		}
+		// 第 n 层上的计时器一定在当前槽之后的某个槽中，该槽的起点就是它们的下界。
+		for(unsigned level = 0; level < wheel_levels; ++level){
+			const unsigned shift = level * wheel_bits;
+			const unsigned slot = (g_wheel_time >> shift) & wheel_mask;
+			if(slot == wheel_mask){
+				continue;
+			}
+			const AUTO(later, g_wheel_masks[level] >> (slot + 1) << (slot + 1));
+			if(later == 0){
+				continue;
+			}
+			const AUTO(block, g_wheel_time >> shift >> wheel_bits << wheel_bits);
+			next = std::min(next, (block | static_cast<unsigned>(__builtin_ctzll(later))) << shift);
+		}
+		return next;
+	}
+
+	// 二叉堆。与时间轮相比，每次重置计时器都会留下一个旧的元素，直到它到达堆顶时才被丢弃。
 	struct Timer_queue_element {
 		boost::weak_ptr<Timer> timer;
 		boost::uint64_t next;
@@ -100,12 +307,66 @@ namespace {
 		return lhs.next > rhs.next;
 	}
 
+	boost::container::vector<Timer_queue_element> g_heap;
+
+	bool g_use_heap;
+
 	volatile bool g_running = false;
 	Thread g_thread;
 
-	Mutex g_mutex;
-	Condition_variable g_new_timer;
-	boost::container::vector<Timer_queue_element> g_timers;
+	// 调用者必须持有 `g_mutex`。
+	bool pop_due_timer_from_wheel(boost::shared_ptr<Timer> &timer, boost::uint64_t &period, boost::uint64_t now){
+		for(;;){
+			advance_wheel(now);
+			if(!g_due){
+				return false;
+			}
+			const AUTO(link, g_due);
+			unlink_timer(link);
+			// 如果计时器正在被析构，这里会得到空指针。
+			timer = static_cast<Timer *>(link)->get_weak_self().lock();
+			if(!timer){
+				continue;
+			}
+			period = timer->get_period();
+			if(period != 0){
+				insert_timer(link, saturated_add(link->expiry, period));
+			}
+			return true;
+		}
+	}
+	// 调用者必须持有 `g_mutex`。
+	// 丢弃一个旧的元素时，如果计时器还活着，它被移入 `timer` 并返回 `true`，但是 `period` 不会被设置。
+	// 这可能是计时器的最后一个引用，调用者必须在解锁之后才能释放它，因为 `~Timer()` 会锁定 `g_mutex`。
+	bool pop_due_timer_from_heap(boost::shared_ptr<Timer> &timer, boost::uint64_t &period, bool &stale, boost::uint64_t now){
+		for(;;){
+			if(g_heap.empty()){
+				return false;
+			}
+			if(now < g_heap.front().next){
+				return false;
+			}
+			std::pop_heap(g_heap.begin(), g_heap.end());
+			timer = g_heap.back().timer.lock();
+			if(!timer){
+				g_heap.pop_back();
+				continue;
+			}
+			if(timer->get_stamp() != g_heap.back().stamp){
+				g_heap.pop_back();
+				stale = true;
+				return true;
+			}
+			period = timer->get_period();
+			if(period == 0){
+				g_heap.pop_back();
+			} else {
+				g_heap.back().next = saturated_add(g_heap.back().next, period);
+				std::push_heap(g_heap.begin(), g_heap.end());
+			}
+			return true;
+		}
+	}
 
 	bool pump_one_element() NOEXCEPT {
 		POSEIDON_PROFILE_ME;
@@ -114,28 +375,17 @@ namespace {
 
 		boost::shared_ptr<Timer> timer;
 		boost::uint64_t period;
+		bool stale = false;
 		{
 			const Mutex::Unique_lock lock(g_mutex);
-		_pick_next:
-			if(g_timers.empty()){
+			const bool due = g_use_heap ? pop_due_timer_from_heap(timer, period, stale, now)
+			                            : pop_due_timer_from_wheel(timer, period, now);
+			if(!due){
 				return false;
 			}
-			if(now < g_timers.front().next){
-				return false;
-			}
-			std::pop_heap(g_timers.begin(), g_timers.end());
-			timer = g_timers.back().timer.lock();
-			if(!timer || (timer->get_stamp() != g_timers.back().stamp)){
-				g_timers.pop_back();
-				goto _pick_next;
-			}
-			period = timer->get_period();
-			if(period == 0){
-				g_timers.pop_back();
-			} else {
-				g_timers.back().next = saturated_add(g_timers.back().next, period);
-				std::push_heap(g_timers.begin(), g_timers.end());
-			}
+		}
+		if(stale){
+			return true;
 		}
 
 		try {
@@ -154,23 +404,48 @@ namespace {
 		return true;
 	}
 
+	// 调用者必须持有 `g_mutex`。
+	void schedule_timer(Timer *timer, boost::uint64_t first){
+		if(g_use_heap){
+			Timer_queue_element elem = { timer->get_weak_self(), first, timer->renew_stamp() };
+			g_heap.push_back(STD_MOVE(elem));
+			std::push_heap(g_heap.begin(), g_heap.end());
+		} else {
+			unlink_timer(timer);
+			if(is_wheel_empty()){
+				// 时间轮为空时不必从很久以前一格一格地推进。
+				g_wheel_time = std::max(g_wheel_time, get_fast_mono_clock());
+			}
+			insert_timer(timer, first);
+		}
+		// 计时器线程醒着时会在睡眠之前重新计算到期时间，所以只有比它预定醒来更早的计时器才需要唤醒它。
+		if(first < g_sleep_until){
+			g_new_timer.signal();
+		}
+	}
+
 	void thread_proc(){
 		POSEIDON_PROFILE_ME;
 		POSEIDON_LOG(Logger::special_major | Logger::level_info, "Timer daemon started.");
 
-		unsigned timeout = 0;
 		for(;;){
-			bool busy;
-			do {
-				busy = pump_one_element();
-				timeout = std::min(timeout * 2u + 1u, !busy * 100u);
-			} while(busy);
+			while(pump_one_element()){
+				//
+			}
 
 			Mutex::Unique_lock lock(g_mutex);
 			if(!atomic_load(g_running, memory_order_consume)){
 				break;
 			}
-			g_new_timer.timed_wait(lock, timeout);
+			const AUTO(now, get_fast_mono_clock());
+			boost::uint64_t next = g_use_heap ? (g_heap.empty() ? -1ull : g_heap.front().next) : get_wheel_next_expiry();
+			next = std::min(next, saturated_add<boost::uint64_t>(now, 100));
+			if(next <= now){
+				continue;
+			}
+			g_sleep_until = next;
+			g_new_timer.timed_wait(lock, next - now);
+			g_sleep_until = 0;
 		}
 
 		POSEIDON_LOG(Logger::special_major | Logger::level_info, "Timer daemon stopped.");
@@ -184,6 +459,9 @@ void Timer_daemon::start(){
 	}
 	POSEIDON_LOG(Logger::special_major | Logger::level_info, "Starting timer daemon...");
 
+	g_use_heap = Main_config::get<bool>("timer_daemon_use_heap", false);
+	POSEIDON_LOG_INFO("Timer daemon backend: ", g_use_heap ? "binary heap" : "timing wheel");
+
 	Thread(&thread_proc, Rcnts::view("  T "), Rcnts::view("Timer")).swap(g_thread);
 }
 void Timer_daemon::stop(){
@@ -197,19 +475,18 @@ void Timer_daemon::stop(){
 	}
 
 	const Mutex::Unique_lock lock(g_mutex);
-	g_timers.clear();
+	clear_wheel();
+	g_heap.clear();
 }
 
 boost::shared_ptr<Timer> Timer_daemon::register_absolute_timer(boost::uint64_t first, boost::uint64_t period, Timer_callback callback){
 	POSEIDON_PROFILE_ME;
 
 	AUTO(timer, boost::make_shared<Timer>(period, STD_MOVE_IDN(callback), false));
+	timer->set_weak_self(timer);
 	{
 		const Mutex::Unique_lock lock(g_mutex);
-		Timer_queue_element elem = { timer, first, timer->get_stamp() };
-		g_timers.push_back(STD_MOVE(elem));
-		std::push_heap(g_timers.begin(), g_timers.end());
-		g_new_timer.signal();
+		schedule_timer(timer.get(), first);
 	}
 	POSEIDON_LOG_DEBUG("Created a timer which will be triggered ", saturated_sub(first, get_fast_mono_clock()), " microsecond(s) later and has a period of ", timer->get_period(), " microsecond(s).");
 	return timer;
@@ -240,12 +517,10 @@ boost::shared_ptr<Timer> Timer_daemon::register_low_level_absolute_timer(boost::
 	POSEIDON_PROFILE_ME;
 
 	AUTO(timer, boost::make_shared<Timer>(period, STD_MOVE_IDN(callback), true));
+	timer->set_weak_self(timer);
 	{
 		const Mutex::Unique_lock lock(g_mutex);
-		Timer_queue_element elem = { timer, first, timer->get_stamp() };
-		g_timers.push_back(STD_MOVE(elem));
-		std::push_heap(g_timers.begin(), g_timers.end());
-		g_new_timer.signal();
+		schedule_timer(timer.get(), first);
 	}
 	POSEIDON_LOG_DEBUG("Created a low level timer which will be triggered ", saturated_sub(first, get_fast_mono_clock()), " microsecond(s) later and has a period of ", timer->get_period(), " microsecond(s).");
 	return timer;
@@ -259,11 +534,8 @@ void Timer_daemon::set_absolute_time(const boost::shared_ptr<Timer> &timer, boos
 	POSEIDON_PROFILE_ME;
 
 	const Mutex::Unique_lock lock(g_mutex);
-	g_timers.emplace_back(); // This may throw std::bad_alloc.
-	Timer_queue_element elem = { timer, first, timer->set_period(period) }; // This throws no exception.
-	g_timers.back() = STD_MOVE_IDN(elem); // This does not throw an exception, either.
-	std::push_heap(g_timers.begin(), g_timers.end());
-	g_new_timer.signal();
+	timer->set_period(period);
+	schedule_timer(timer.get(), first);
 }
 void Timer_daemon::set_time(const boost::shared_ptr<Timer> &timer, boost::uint64_t delta_first, boost::uint64_t period){
 	const AUTO(now, get_fast_mono_clock());
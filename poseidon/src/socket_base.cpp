@@ -44,7 +44,7 @@ Socket_base::Delayed_shutdown_guard::~Delayed_shutdown_guard(){
 Socket_base::Socket_base(Move<Unique_file> socket)
 	: m_socket(STD_MOVE(socket)), m_creation_time(get_utc_time())
 	, m_shutdown_read(false), m_shutdown_write(false), m_really_shutdown_write(false)
-	, m_throttled(false), m_timed_out(false), m_delayed_shutdown_guard_count(0)
+	, m_throttled(false), m_timed_out(false), m_delayed_shutdown_guard_count(0), m_epoll_handle(0)
 {
 	//
 }
@@ -172,6 +172,13 @@ bool Socket_base::did_time_out() const NOEXCEPT {
 	return atomic_load(m_timed_out, memory_order_acquire);
 }
 
+boost::uint64_t Socket_base::get_epoll_handle() const volatile NOEXCEPT {
+	return atomic_load(m_epoll_handle, memory_order_acquire);
+}
+void Socket_base::set_epoll_handle(boost::uint64_t handle) NOEXCEPT {
+	atomic_store(m_epoll_handle, handle, memory_order_release);
+}
+
 const Ip_port & Socket_base::get_remote_info() const NOEXCEPT
 try {
 	POSEIDON_PROFILE_ME;
@@ -230,5 +237,8 @@ int Socket_base::poll_write(Mutex::Unique_lock &/*write_lock*/, unsigned char */
 void Socket_base::on_close(int /*err_code*/){
 	//
 }
+void Socket_base::on_sweep(boost::uint64_t /*now*/){
+	//
+}
 
 }
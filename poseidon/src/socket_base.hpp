@@ -32,6 +32,7 @@ private:
 	volatile bool m_throttled;
 	volatile bool m_timed_out;
 	volatile std::size_t m_delayed_shutdown_guard_count;
+	volatile boost::uint64_t m_epoll_handle;
 
 	mutable Mutex m_info_mutex;
 	mutable boost::optional<Ip_port> m_remote_info;
@@ -72,6 +73,10 @@ public:
 
 	bool did_time_out() const NOEXCEPT;
 
+	// 仅供 Epoll_daemon 使用。零表示不在 epoll 中。
+	boost::uint64_t get_epoll_handle() const volatile NOEXCEPT;
+	void set_epoll_handle(boost::uint64_t handle) NOEXCEPT;
+
 	const Ip_port & get_remote_info() const NOEXCEPT;
 	const Ip_port & get_local_info() const NOEXCEPT;
 	bool is_using_ipv6() const NOEXCEPT;
@@ -80,6 +85,8 @@ public:
 	virtual int poll_read_and_process(unsigned char *hint_buffer, std::size_t hint_capacity, bool readable);
 	virtual int poll_write(Mutex::Unique_lock &write_lock, unsigned char *hint_buffer, std::size_t hint_capacity, bool writable);
 	virtual void on_close(int err_code);
+	// 由 epoll 线程周期性地调用，每个周期对每个套接字调用一次。
+	virtual void on_sweep(boost::uint64_t now);
 };
 
 class Socket_base::Delayed_shutdown_guard : NONCOPYABLE {
@@ -4,7 +4,10 @@
 #include "precompiled.hpp"
 #include "stream_buffer.hpp"
 #include "checked_arithmetic.hpp"
+#include "atomic.hpp"
+#include "singletons/main_config.hpp"
 #include <boost/type_traits/common_type.hpp>
+#include <pthread.h>
 
 namespace Poseidon {
 
@@ -16,22 +19,273 @@ namespace {
 		t = STD_MOVE(u);
 		return v;
 	}
+
+	// 少于这么多字节的数据直接复制，不值得共享。
+	CONSTEXPR const std::size_t g_min_shared_size = 256;
 }
 
+namespace {
+	// 块内存池。
+	// 数据区容量在 1KiB 到 64KiB 之间的块按 2 的幂分级，另有一级专门存放没有数据区、只引用共享数据的块。
+	// 每个线程为每一级保留一个空闲链表，链表过长时把一半成批归还给全局仓库，用尽时再从全局仓库成批取回，
+	// 两者都落空才调用 `::operator new`。更大的块不进入内存池。
+	CONSTEXPR const unsigned g_pool_min_capacity_bits = 10;
+	CONSTEXPR const unsigned g_pool_class_count = 8;
+
+	struct Free_block {
+		Free_block *next;
+	};
+
+	// 这些对象都只做零初始化或常量初始化，保证在静态对象析构期间依然可用。
+	struct Pool_depot {
+		::pthread_mutex_t mutex;
+		Free_block *head;
+		std::size_t count;
+	};
+	Pool_depot g_depots[g_pool_class_count] = {
+#define POSEIDON_POOL_DEPOT_INIT_   { PTHREAD_MUTEX_INITIALIZER, NULLPTR, 0 }
+		POSEIDON_POOL_DEPOT_INIT_, POSEIDON_POOL_DEPOT_INIT_, POSEIDON_POOL_DEPOT_INIT_, POSEIDON_POOL_DEPOT_INIT_,
+		POSEIDON_POOL_DEPOT_INIT_, POSEIDON_POOL_DEPOT_INIT_, POSEIDON_POOL_DEPOT_INIT_, POSEIDON_POOL_DEPOT_INIT_,
+#undef POSEIDON_POOL_DEPOT_INIT_
+	};
+
+	// 最后一项统计不进入内存池的块。
+	struct Pool_counters {
+		volatile boost::uint64_t thread_cache_hits;
+		volatile boost::uint64_t depot_hits;
+		volatile boost::uint64_t heap_allocations;
+		volatile boost::uint64_t heap_deallocations;
+	};
+	Pool_counters g_counters[g_pool_class_count + 1];
+
+	// 以字节计的上限，每一级单独计算。零表示关闭缓存。
+	volatile std::size_t g_thread_cache_size = 262144;
+	volatile std::size_t g_depot_size = 4194304;
+
+	struct Thread_cache {
+		bool registered;
+		Free_block *heads[g_pool_class_count];
+		std::size_t counts[g_pool_class_count];
+		// 命中计数攒够一批再计入全局计数器，避免每次分配都写同一个缓存行。
+		boost::uint64_t pending_hits[g_pool_class_count];
+	};
+	__thread Thread_cache t_cache;
+
+	CONSTEXPR const boost::uint64_t g_pending_hits_flush_threshold = 256;
+
+	// 第零级没有数据区，计算上限时按每块 64 字节计。
+	inline unsigned get_class_bits(unsigned index) NOEXCEPT {
+		return (index == 0) ? 6 : (g_pool_min_capacity_bits - 1 + index);
+	}
+	inline std::size_t get_class_capacity(unsigned index) NOEXCEPT {
+		return (index == 0) ? 0 : (static_cast<std::size_t>(1) << get_class_bits(index));
+	}
+	inline std::size_t get_class_limit(volatile std::size_t &size, unsigned index) NOEXCEPT {
+		return atomic_load(size, memory_order_relaxed) >> get_class_bits(index);
+	}
+
+	void flush_pending_hits(Thread_cache &cache, unsigned index) NOEXCEPT {
+		const AUTO(hits, exchange(cache.pending_hits[index], 0));
+		if(hits != 0){
+			atomic_add(g_counters[index].thread_cache_hits, hits, memory_order_relaxed);
+		}
+	}
+
+	// 把 `head` 开始的 `count` 个块放进全局仓库，放不下的释放掉。
+	void return_blocks_to_depot(unsigned index, Free_block *head, std::size_t count) NOEXCEPT {
+		const AUTO(limit, get_class_limit(g_depot_size, index));
+		AUTO_REF(depot, g_depots[index]);
+		int err_code = ::pthread_mutex_lock(&(depot.mutex));
+		(void)err_code;
+		assert(err_code == 0);
+		while(head && (depot.count < limit)){
+			const AUTO(next, head->next);
+			head->next = depot.head;
+			depot.head = head;
+			depot.count += 1;
+			head = next;
+			count -= 1;
+		}
+		err_code = ::pthread_mutex_unlock(&(depot.mutex));
+		assert(err_code == 0);
+		if(count != 0){
+			atomic_add(g_counters[index].heap_deallocations, count, memory_order_relaxed);
+		}
+		while(head){
+			const AUTO(next, head->next);
+			::operator delete(head);
+			head = next;
+		}
+	}
+
+	::pthread_key_t g_thread_cache_key;
+	::pthread_once_t g_thread_cache_key_once = PTHREAD_ONCE_INIT;
+
+	void thread_cache_destructor(void *param) NOEXCEPT {
+		AUTO_REF(cache, *static_cast<Thread_cache *>(param));
+		for(unsigned index = 0; index < g_pool_class_count; ++index){
+			flush_pending_hits(cache, index);
+			return_blocks_to_depot(index, exchange(cache.heads[index], NULLPTR), exchange(cache.counts[index], 0));
+		}
+		cache.registered = false;
+	}
+	void create_thread_cache_key() NOEXCEPT {
+		int err_code = ::pthread_key_create(&g_thread_cache_key, &thread_cache_destructor);
+		if(err_code != 0){
+			std::terminate();
+		}
+	}
+	// 线程退出时把缓存的块交还给全局仓库。必须在第一次向线程缓存中放入块之前调用，失败时不得缓存任何块。
+	bool register_thread_cache(Thread_cache &cache) NOEXCEPT {
+		if(cache.registered){
+			return true;
+		}
+		::pthread_once(&g_thread_cache_key_once, &create_thread_cache_key);
+		if(::pthread_setspecific(g_thread_cache_key, &cache) != 0){
+			return false;
+		}
+		cache.registered = true;
+		return true;
+	}
+
+	// 容量不含块头。
+	void * pool_allocate(std::size_t *capacity, std::size_t min_capacity, std::size_t header_size){
+		if(min_capacity > get_class_capacity(g_pool_class_count - 1)){
+			atomic_add(g_counters[g_pool_class_count].heap_allocations, 1, memory_order_relaxed);
+			*capacity = min_capacity | 1024;
+			return ::operator new(checked_add(header_size, *capacity));
+		}
+		unsigned index = 0;
+		while(get_class_capacity(index) < min_capacity){
+			++index;
+		}
+		*capacity = get_class_capacity(index);
+
+		AUTO_REF(cache, t_cache);
+		Free_block *block = cache.heads[index];
+		if(block){
+			cache.heads[index] = block->next;
+			cache.counts[index] -= 1;
+			if(++cache.pending_hits[index] >= g_pending_hits_flush_threshold){
+				flush_pending_hits(cache, index);
+			}
+			return block;
+		}
+		// 线程缓存用尽，从全局仓库取回至多半个线程缓存的块。
+		const AUTO(batch, get_class_limit(g_thread_cache_size, index) / 2 + 1);
+		AUTO_REF(depot, g_depots[index]);
+		int err_code = ::pthread_mutex_lock(&(depot.mutex));
+		(void)err_code;
+		assert(err_code == 0);
+		block = depot.head;
+		std::size_t count = 0;
+		if(block){
+			Free_block *last = block;
+			count = 1;
+			while(last->next && (count < batch)){
+				last = last->next;
+				++count;
+			}
+			depot.head = last->next;
+			depot.count -= count;
+			last->next = NULLPTR;
+		}
+		err_code = ::pthread_mutex_unlock(&(depot.mutex));
+		assert(err_code == 0);
+		if(block){
+			atomic_add(g_counters[index].depot_hits, 1, memory_order_relaxed);
+			if(!register_thread_cache(cache)){
+				return_blocks_to_depot(index, exchange(block->next, NULLPTR), count - 1);
+				return block;
+			}
+			cache.heads[index] = block->next;
+			cache.counts[index] = count - 1;
+			return block;
+		}
+		atomic_add(g_counters[index].heap_allocations, 1, memory_order_relaxed);
+		return ::operator new(header_size + *capacity);
+	}
+	void pool_deallocate(void *ptr, std::size_t capacity) NOEXCEPT {
+		if(capacity > get_class_capacity(g_pool_class_count - 1)){
+			atomic_add(g_counters[g_pool_class_count].heap_deallocations, 1, memory_order_relaxed);
+			::operator delete(ptr);
+			return;
+		}
+		unsigned index = 0;
+		while(get_class_capacity(index) < capacity){
+			++index;
+		}
+		const AUTO(limit, get_class_limit(g_thread_cache_size, index));
+		if(limit == 0){
+			return_blocks_to_depot(index, static_cast<Free_block *>(ptr), 1);
+			return;
+		}
+
+		AUTO_REF(cache, t_cache);
+		if(!register_thread_cache(cache)){
+			return_blocks_to_depot(index, static_cast<Free_block *>(ptr), 1);
+			return;
+		}
+		const AUTO(block, static_cast<Free_block *>(ptr));
+		block->next = cache.heads[index];
+		cache.heads[index] = block;
+		cache.counts[index] += 1;
+		if(cache.counts[index] <= limit){
+			return;
+		}
+		// 线程缓存已满，把一半归还给全局仓库。
+		std::size_t count = cache.counts[index] - limit / 2;
+		Free_block *last = block;
+		for(std::size_t i = 1; i < count; ++i){
+			last = last->next;
+		}
+		cache.heads[index] = last->next;
+		cache.counts[index] -= count;
+		last->next = NULLPTR;
+		flush_pending_hits(cache, index);
+		return_blocks_to_depot(index, block, count);
+	}
+}
+
+// 数据区可以被多个块共享，此时数据区只读，`begin` 和 `end` 则由每个块各自维护。
+// 数据区属于创建它的块，后者在所有引用都被销毁之后才会被释放。
 struct Stream_buffer::Chunk_header {
 	static Chunk_header * create(std::size_t min_capacity, Chunk_header *prev, Chunk_header *next, bool backward){
-		const std::size_t capacity = min_capacity | 1024;
+		std::size_t capacity;
+		const AUTO(chunk, static_cast<Chunk_header *>(pool_allocate(&capacity, std::max<std::size_t>(min_capacity, 1), sizeof(Chunk_header))));
 		const std::size_t origin = backward ? capacity : 0;
-		const AUTO(chunk, static_cast<Chunk_header *>(::operator new(checked_add(sizeof(Chunk_header), capacity))));
 		chunk->capacity = capacity;
 		chunk->prev = prev;
 		chunk->next = next;
 		chunk->begin = origin;
 		chunk->end = origin;
+		chunk->owner = chunk;
+		chunk->ref_count = 1;
+		chunk->data = chunk->storage;
+		return chunk;
+	}
+	static Chunk_header * create_reference(const Chunk_header *src, std::size_t begin, std::size_t end, Chunk_header *prev, Chunk_header *next){
+		std::size_t capacity;
+		const AUTO(chunk, static_cast<Chunk_header *>(pool_allocate(&capacity, 0, sizeof(Chunk_header))));
+		chunk->capacity = src->capacity;
+		chunk->prev = prev;
+		chunk->next = next;
+		chunk->begin = begin;
+		chunk->end = end;
+		chunk->owner = src->owner;
+		chunk->ref_count = 0;
+		chunk->data = src->data;
+		atomic_add(chunk->owner->ref_count, 1, memory_order_relaxed);
 		return chunk;
 	}
 	static void destroy(Chunk_header *chunk) NOEXCEPT {
-		::operator delete(chunk);
+		const AUTO(owner, chunk->owner);
+		if(owner != chunk){
+			pool_deallocate(chunk, 0);
+		}
+		if(atomic_sub(owner->ref_count, 1, memory_order_acq_rel) == 0){
+			pool_deallocate(owner, owner->capacity);
+		}
 	}
 
 	std::size_t capacity;
@@ -40,9 +294,51 @@ struct Stream_buffer::Chunk_header {
 
 	std::size_t begin;
 	std::size_t end;
-	__extension__ unsigned char data[];
+
+	Chunk_header *owner;
+	volatile std::size_t ref_count; // 只有 owner 的这个字段有意义。
+	unsigned char *data;
+	__extension__ unsigned char storage[];
+
+	// 共享的数据区不可写。
+	bool is_shared() const NOEXCEPT {
+		return atomic_load(owner->ref_count, memory_order_acquire) != 1;
+	}
 };
 
+void Stream_buffer::initialize_pool_from_config(){
+	const AUTO(thread_cache_size, Main_config::get<std::size_t>("stream_buffer_pool_thread_cache_size", 262144));
+	const AUTO(depot_size, Main_config::get<std::size_t>("stream_buffer_pool_depot_size", 4194304));
+	atomic_store(g_thread_cache_size, thread_cache_size, memory_order_relaxed);
+	atomic_store(g_depot_size, depot_size, memory_order_relaxed);
+}
+void Stream_buffer::snapshot_pool(boost::container::vector<Stream_buffer::Pool_snapshot_element> &ret){
+	ret.reserve(ret.size() + g_pool_class_count + 1);
+	for(unsigned index = 0; index <= g_pool_class_count; ++index){
+		Pool_snapshot_element elem = { };
+		if(index == g_pool_class_count){
+			elem.chunk_capacity = get_class_capacity(g_pool_class_count - 1);
+			elem.oversized = true;
+		} else {
+			elem.chunk_capacity = get_class_capacity(index);
+			flush_pending_hits(t_cache, index);
+			AUTO_REF(depot, g_depots[index]);
+			int err_code = ::pthread_mutex_lock(&(depot.mutex));
+			(void)err_code;
+			assert(err_code == 0);
+			elem.depot_count = depot.count;
+			err_code = ::pthread_mutex_unlock(&(depot.mutex));
+			assert(err_code == 0);
+		}
+		const AUTO_REF(counters, g_counters[index]);
+		elem.thread_cache_hits = atomic_load(counters.thread_cache_hits, memory_order_relaxed);
+		elem.depot_hits = atomic_load(counters.depot_hits, memory_order_relaxed);
+		elem.heap_allocations = atomic_load(counters.heap_allocations, memory_order_relaxed);
+		elem.heap_deallocations = atomic_load(counters.heap_deallocations, memory_order_relaxed);
+		ret.push_back(elem);
+	}
+}
+
 Stream_buffer::Stream_buffer(const void *data, std::size_t count)
 	: m_first(NULLPTR), m_last(NULLPTR), m_size(0)
 {
@@ -144,6 +440,9 @@ bool Stream_buffer::discard() NOEXCEPT {
 void Stream_buffer::put(int data){
 	AUTO(chunk, m_last);
 	AUTO(prev, chunk);
+	if(chunk && chunk->is_shared()){
+		chunk = NULLPTR;
+	}
 	if(chunk && (chunk->capacity == chunk->end)){
 		const std::size_t avail = chunk->end - chunk->begin;
 		if(chunk->capacity > avail){
@@ -198,6 +497,9 @@ int Stream_buffer::unput() NOEXCEPT {
 void Stream_buffer::unget(int data){
 	AUTO(chunk, m_first);
 	AUTO(next, chunk);
+	if(chunk && chunk->is_shared()){
+		chunk = NULLPTR;
+	}
 	if(chunk && (chunk->begin == 0)){
 		const std::size_t avail = chunk->end - chunk->begin;
 		if(chunk->capacity > avail){
@@ -297,6 +599,9 @@ std::size_t Stream_buffer::discard(std::size_t count) NOEXCEPT {
 void Stream_buffer::put(int data, std::size_t count){
 	AUTO(chunk, m_last);
 	AUTO(prev, chunk);
+	if(chunk && chunk->is_shared()){
+		chunk = NULLPTR;
+	}
 	if(chunk && (chunk->capacity - chunk->end < count)){
 		const std::size_t avail = chunk->end - chunk->begin;
 		if(chunk->capacity - avail >= count){
@@ -320,6 +625,9 @@ void Stream_buffer::put(int data, std::size_t count){
 void Stream_buffer::put(const void *data, std::size_t count){
 	AUTO(chunk, m_last);
 	AUTO(prev, chunk);
+	if(chunk && chunk->is_shared()){
+		chunk = NULLPTR;
+	}
 	if(chunk && (chunk->capacity - chunk->end < count)){
 		const std::size_t avail = chunk->end - chunk->begin;
 		if(chunk->capacity - avail >= count){
@@ -341,31 +649,26 @@ void Stream_buffer::put(const void *data, std::size_t count){
 	m_size += count;
 }
 void Stream_buffer::put(const Stream_buffer &data){
-	const AUTO(count, data.size());
-	AUTO(chunk, m_last);
-	AUTO(prev, chunk);
-	if(chunk && (chunk->capacity - chunk->end < count)){
-		const std::size_t avail = chunk->end - chunk->begin;
-		if(chunk->capacity - avail >= count){
-			std::memmove(chunk->data, chunk->data + chunk->begin, avail);
-			chunk->begin = 0;
-			chunk->end = avail;
-		} else {
-			chunk = NULLPTR;
-		}
-	}
-	if(!chunk){
-		const AUTO(next, Chunk_header::create(count, prev, NULLPTR, false));
-		(prev ? prev->next : m_first) = next;
-		chunk = next;
-		m_last = next;
+	if(&data == this){
+		const Stream_buffer copy(data);
+		put(copy);
+		return;
 	}
 	for(AUTO(src, data.m_first); src; src = src->next){
 		const std::size_t avail = src->end - src->begin;
-		std::memcpy(chunk->data + chunk->end, src->data + src->begin, avail);
-		chunk->end += avail;
+		if(avail == 0){
+			continue;
+		}
+		if(avail < g_min_shared_size){
+			put(src->data + src->begin, avail);
+			continue;
+		}
+		const AUTO(prev, m_last);
+		const AUTO(chunk, Chunk_header::create_reference(src, src->begin, src->end, prev, NULLPTR));
+		(prev ? prev->next : m_first) = chunk;
+		m_last = chunk;
+		m_size += avail;
 	}
-	m_size += count;
 }
 
 void * Stream_buffer::squash(){
@@ -373,13 +676,62 @@ void * Stream_buffer::squash(){
 	if(!chunk){
 		return NULLPTR;
 	}
-	if(chunk != m_last){
-		Stream_buffer(*this).swap(*this);
-		chunk = m_first;
+	if((chunk != m_last) || chunk->is_shared()){
+		// 复制构造函数会共享数据，这里必须真正复制一份。
+		Stream_buffer temp;
+		chunk = Chunk_header::create(m_size, NULLPTR, NULLPTR, false);
+		temp.m_first = chunk;
+		temp.m_last = chunk;
+		temp.m_size = m_size;
+		for(AUTO(src, m_first); src; src = src->next){
+			const std::size_t avail = src->end - src->begin;
+			std::memcpy(chunk->data + chunk->end, src->data + src->begin, avail);
+			chunk->end += avail;
+		}
+		temp.swap(*this);
 	}
 	return chunk->data + chunk->begin;
 }
 
+void * Stream_buffer::reserve(std::size_t *capacity, std::size_t min_count){
+	AUTO(chunk, m_last);
+	AUTO(prev, chunk);
+	if(chunk && (chunk->begin == chunk->end)){
+		// 空的块可以从头开始使用。如果还是不够大或者数据区是共享的就换掉它。
+		chunk->begin = 0;
+		chunk->end = 0;
+		if((chunk->capacity < min_count) || chunk->is_shared()){
+			prev = chunk->prev;
+			(prev ? prev->next : m_first) = NULLPTR;
+			m_last = prev;
+			Chunk_header::destroy(chunk);
+			chunk = NULLPTR;
+		}
+	}
+	if(chunk && ((chunk->capacity - chunk->end < min_count) || chunk->is_shared())){
+		// 不要挪动已有的数据，这样返回的空间总是紧接在已有数据之后。
+		chunk = NULLPTR;
+	}
+	if(!chunk){
+		const AUTO(next, Chunk_header::create(min_count, prev, NULLPTR, false));
+		(prev ? prev->next : m_first) = next;
+		chunk = next;
+		m_last = next;
+	}
+	if(capacity){
+		*capacity = chunk->capacity - chunk->end;
+	}
+	return chunk->data + chunk->end;
+}
+void Stream_buffer::commit(std::size_t count) NOEXCEPT {
+	const AUTO(chunk, m_last);
+	assert(chunk);
+	assert(count <= chunk->capacity - chunk->end);
+
+	chunk->end += count;
+	m_size += count;
+}
+
 Stream_buffer Stream_buffer::cut_off(std::size_t count){
 	std::size_t total = 0;
 	AUTO(chunk, m_first);
@@ -393,9 +745,13 @@ Stream_buffer Stream_buffer::cut_off(std::size_t count){
 			if(avail > remaining){
 				const AUTO(prev, chunk->prev);
 				const AUTO(next, chunk);
-				chunk = Chunk_header::create(remaining, prev, next, false);
-				std::memcpy(chunk->data, next->data + next->begin, remaining);
-				chunk->end = remaining;
+				if(remaining < g_min_shared_size){
+					chunk = Chunk_header::create(remaining, prev, next, false);
+					std::memcpy(chunk->data, next->data + next->begin, remaining);
+					chunk->end = remaining;
+				} else {
+					chunk = Chunk_header::create_reference(next, next->begin, next->begin + remaining, prev, next);
+				}
 				next->begin += remaining;
 				(prev ? prev->next : m_first) = chunk;
 				next->prev = chunk;
@@ -447,8 +803,21 @@ bool Stream_buffer::enumerate_chunk(const void **data, std::size_t *count, Strea
 	}
 	return true;
 }
-bool Stream_buffer::enumerate_chunk(void **data, std::size_t *count, Stream_buffer::Enumeration_cookie &cookie) NOEXCEPT {
-	const AUTO(chunk, cookie.m_prev ? cookie.m_prev->next : m_first);
+bool Stream_buffer::enumerate_chunk(void **data, std::size_t *count, Stream_buffer::Enumeration_cookie &cookie){
+	AUTO(chunk, cookie.m_prev ? cookie.m_prev->next : m_first);
+	if(chunk && chunk->is_shared()){
+		// 调用者可能会修改数据，因此先复制一份。
+		const std::size_t avail = chunk->end - chunk->begin;
+		const AUTO(prev, chunk->prev);
+		const AUTO(next, chunk->next);
+		const AUTO(copy, Chunk_header::create(avail, prev, next, false));
+		std::memcpy(copy->data, chunk->data + chunk->begin, avail);
+		copy->end = avail;
+		(prev ? prev->next : m_first) = copy;
+		(next ? next->prev : m_last) = copy;
+		Chunk_header::destroy(chunk);
+		chunk = copy;
+	}
 	cookie.m_prev = chunk;
 	if(!chunk){
 		return false;
@@ -11,6 +11,7 @@
 #include <iosfwd>
 #include <cstring>
 #include <cstddef>
+#include <boost/container/vector.hpp>
 
 namespace Poseidon {
 
@@ -23,6 +24,22 @@ public:
 	class Read_iterator;
 	class Write_iterator;
 
+	struct Pool_snapshot_element {
+		std::size_t chunk_capacity; // 数据区容量。零表示只引用共享数据的块。
+		bool oversized; // 为 true 时统计的是数据区超过 chunk_capacity、不进入内存池的块。
+		unsigned long long thread_cache_hits; // 由线程缓存满足的分配次数。
+		unsigned long long depot_hits; // 从全局仓库成批取回的次数。
+		unsigned long long heap_allocations; // 调用 `::operator new` 的次数。
+		unsigned long long heap_deallocations; // 调用 `::operator delete` 的次数。
+		std::size_t depot_count; // 全局仓库中当前的空闲块数。
+	};
+
+public:
+	// 从 main.conf 中读取块内存池的参数。
+	static void initialize_pool_from_config();
+	// 计数器是近似值，线程缓存的命中次数攒够一批才会计入。
+	static void snapshot_pool(boost::container::vector<Pool_snapshot_element> &ret);
+
 private:
 	Chunk_header *m_first;
 	Chunk_header *m_last;
@@ -81,6 +98,7 @@ public:
 	std::size_t discard(std::size_t count) NOEXCEPT;
 	void put(int data, std::size_t count);
 	void put(const void *data, std::size_t count);
+	// 较大的块会被共享而不是复制，此后双方都不会再向这些块中写入数据。
 	void put(const Stream_buffer &data);
 	void put(const char *str){
 		put(str, std::strlen(str));
@@ -94,6 +112,11 @@ public:
 
 	void * squash();
 
+	// 在末尾预留至少 min_count 字节的连续可写空间并返回其地址，实际可写的字节数写入 *capacity。
+	// 调用者直接写入之后调用 commit() 把数据计入缓冲区，在此之间不得以其他方式修改缓冲区。
+	void * reserve(std::size_t *capacity, std::size_t min_count);
+	void commit(std::size_t count) NOEXCEPT;
+
 	Stream_buffer cut_off(std::size_t count);
 	void splice(Stream_buffer &rhs) NOEXCEPT;
 #ifdef POSEIDON_CXX11
@@ -103,7 +126,8 @@ public:
 #endif
 
 	bool enumerate_chunk(const void **data, std::size_t *count, Enumeration_cookie &cookie) const NOEXCEPT;
-	bool enumerate_chunk(void **data, std::size_t *count, Enumeration_cookie &cookie) NOEXCEPT;
+	// 共享的块会先被复制一份，因此可能抛出异常。
+	bool enumerate_chunk(void **data, std::size_t *count, Enumeration_cookie &cookie);
 
 	void swap(Stream_buffer &rhs) NOEXCEPT {
 		using std::swap;
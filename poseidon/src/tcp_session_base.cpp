@@ -11,35 +11,19 @@
 #include "profiler.hpp"
 #include "atomic.hpp"
 #include "checked_arithmetic.hpp"
-#include "singletons/timer_daemon.hpp"
 #include "time.hpp"
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 
 namespace Poseidon {
 
-void Tcp_session_base::shutdown_timer_proc(const boost::weak_ptr<Tcp_session_base> &weak, boost::uint64_t now){
-	POSEIDON_PROFILE_ME;
-
-	const AUTO(session, weak.lock());
-	if(!session){
-		return;
-	}
-
-	try {
-		session->on_shutdown_timer(now);
-	} catch(std::exception &e){
-		POSEIDON_LOG_WARNING("std::exception thrown: what = ", e.what());
-		session->force_shutdown();
-	}
-}
-
 Tcp_session_base::Tcp_session_base(Move<Unique_file> socket)
 	: Socket_base(STD_MOVE(socket)), Session_base()
-	, m_connected_notified(false), m_read_hup_notified(false)
-	, m_shutdown_time(-1ull), m_last_use_time(-1ull)
+	, m_connected_notified(false), m_read_hup_notified(false), m_last_recv_size(0)
+	, m_shutdown_time(-1ull), m_last_use_time(-1ull), m_shutdown_checks_enabled(false)
 {
 	//
 }
@@ -51,15 +35,11 @@ void Tcp_session_base::init_ssl(boost::scoped_ptr<Ssl_filter> &ssl_filter){
 	POSEIDON_THROW_ASSERT(!m_ssl_filter);
 	swap(m_ssl_filter, ssl_filter);
 }
-void Tcp_session_base::create_shutdown_timer(){
-	POSEIDON_PROFILE_ME;
-
-	const Mutex::Unique_lock lock(m_shutdown_mutex);
-	if(m_shutdown_timer){
+void Tcp_session_base::enable_shutdown_checks() NOEXCEPT {
+	if(atomic_load(m_shutdown_checks_enabled, memory_order_relaxed)){
 		return;
 	}
-	const AUTO(period, Main_config::get<boost::uint64_t>("tcp_shutdown_timer_period", 15000));
-	m_shutdown_timer = Timer_daemon::register_low_level_timer(period, period, boost::bind(&shutdown_timer_proc, virtual_weak_from_this<Tcp_session_base>(), _2));
+	atomic_store(m_shutdown_checks_enabled, true, memory_order_release);
 }
 
 int Tcp_session_base::poll_read_and_process(unsigned char *hint_buffer, std::size_t hint_capacity, bool /*readable*/){
@@ -67,21 +47,40 @@ int Tcp_session_base::poll_read_and_process(unsigned char *hint_buffer, std::siz
 
 	Stream_buffer data;
 	try {
+		// 预留空间的大小取上一次读取的字节数，多数连接每次收到的数据量相差不大。
+		// 如果预留的空间不够，多余的数据会落到 hint_buffer 中，只有这一部分需要拷贝。
+		std::size_t capacity;
+		const AUTO(tail, m_recv_buffer.reserve(&capacity, std::min(m_last_recv_size, hint_capacity)));
 		::ssize_t result;
 		if(m_ssl_filter){
-			result = m_ssl_filter->recv(hint_buffer, hint_capacity);
+			result = m_ssl_filter->recv(tail, capacity);
 		} else {
-			result = ::recv(get_fd(), hint_buffer, hint_capacity, MSG_NOSIGNAL | MSG_DONTWAIT);
+			::iovec vec[2];
+			vec[0].iov_base = tail;
+			vec[0].iov_len = capacity;
+			vec[1].iov_base = hint_buffer;
+			vec[1].iov_len = hint_capacity;
+			::msghdr msg = { };
+			msg.msg_iov = vec;
+			msg.msg_iovlen = 2;
+			result = ::recvmsg(get_fd(), &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
 		}
 		if(result < 0){
-			return errno;
+			const int err_code = errno;
+			// 边沿触发的每一轮读取都以 EAGAIN 结束，不能让空闲连接一直占着预留的块。
+			Stream_buffer().swap(m_recv_buffer);
+			return err_code;
 		}
-		data.put(hint_buffer, static_cast<std::size_t>(result));
+		const AUTO(direct, std::min(static_cast<std::size_t>(result), capacity));
+		m_recv_buffer.commit(direct);
+		m_recv_buffer.put(hint_buffer, static_cast<std::size_t>(result) - direct);
+		m_last_recv_size = static_cast<std::size_t>(result);
+		data.swap(m_recv_buffer);
 		POSEIDON_LOG_TRACE("Read ", result, " byte(s) from ", get_remote_info());
 
 		const AUTO(now, get_fast_mono_clock());
 		atomic_store(m_last_use_time, now, memory_order_release);
-		create_shutdown_timer();
+		enable_shutdown_checks();
 
 		if(data.empty() && !m_read_hup_notified){
 			POSEIDON_LOG(Logger::special_major | Logger::level_debug, "TCP connection read hung up: local = ", get_local_info(), ", remote = ", get_remote_info());
@@ -118,7 +117,28 @@ int Tcp_session_base::poll_write(Mutex::Unique_lock &write_lock, unsigned char *
 		}
 
 		Mutex::Unique_lock lock(m_send_mutex);
-		const std::size_t avail = m_send_buffer.peek(hint_buffer, hint_capacity);
+		boost::array< ::iovec, 64> vec;
+		std::size_t vec_count = 0;
+		std::size_t avail = 0;
+		if(m_ssl_filter){
+			// SSL 一次只能写入一个连续的缓冲区。
+			avail = m_send_buffer.peek(hint_buffer, hint_capacity);
+		} else {
+			// 直接把发送缓冲区中的各个块交给内核，不再拷贝到 hint_buffer 中。
+			// 解锁之后其他线程只会向缓冲区末尾追加新的块，而块只在这个线程中被释放，因此这些指针始终有效。
+			Stream_buffer::Enumeration_cookie cookie;
+			const void *chunk_data;
+			std::size_t chunk_size;
+			while((vec_count < vec.size()) && m_send_buffer.enumerate_chunk(&chunk_data, &chunk_size, cookie)){
+				if(chunk_size == 0){
+					continue;
+				}
+				vec[vec_count].iov_base = const_cast<void *>(chunk_data);
+				vec[vec_count].iov_len = chunk_size;
+				++vec_count;
+				avail += chunk_size;
+			}
+		}
 		if(avail == 0){
 _check_shutdown:
 			if(should_really_shutdown_write()){
@@ -136,7 +156,10 @@ _check_shutdown:
 		if(m_ssl_filter){
 			result = m_ssl_filter->send(hint_buffer, avail);
 		} else {
-			result = ::send(get_fd(), hint_buffer, avail, MSG_NOSIGNAL | MSG_DONTWAIT);
+			::msghdr msg = { };
+			msg.msg_iov = vec.data();
+			msg.msg_iovlen = vec_count;
+			result = ::sendmsg(get_fd(), &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
 		}
 		if(result < 0){
 			return errno;
@@ -145,7 +168,7 @@ _check_shutdown:
 
 		const AUTO(now, get_fast_mono_clock());
 		atomic_store(m_last_use_time, now, memory_order_release);
-		create_shutdown_timer();
+		enable_shutdown_checks();
 
 		lock.lock();
 		m_send_buffer.discard(static_cast<std::size_t>(result));
@@ -165,6 +188,20 @@ _check_shutdown:
 	return 0;
 }
 
+void Tcp_session_base::on_sweep(boost::uint64_t now){
+	POSEIDON_PROFILE_ME;
+
+	if(!atomic_load(m_shutdown_checks_enabled, memory_order_consume)){
+		return;
+	}
+	try {
+		on_shutdown_timer(now);
+	} catch(std::exception &e){
+		POSEIDON_LOG_WARNING("std::exception thrown: what = ", e.what());
+		force_shutdown();
+	}
+}
+
 void Tcp_session_base::on_shutdown_timer(boost::uint64_t now){
 	POSEIDON_PROFILE_ME;
 
@@ -186,7 +223,7 @@ force_time_out:
 	}
 
 	const AUTO(last_use_time, atomic_load(m_last_use_time, memory_order_consume));
-	const AUTO(tcp_response_timeout, Main_config::get<boost::uint64_t>("tcp_response_timeout", 30000));
+	const AUTO(tcp_response_timeout, Main_config::get_snapshot().tcp_response_timeout);
 	if(saturated_sub(now, last_use_time) > tcp_response_timeout){
 		POSEIDON_LOG(Logger::special_major | Logger::level_debug, "The connection seems dead: remote = ", get_remote_info());
 		goto force_time_out;
@@ -231,7 +268,7 @@ void Tcp_session_base::set_timeout(boost::uint64_t timeout){
 
 	const AUTO(now, get_fast_mono_clock());
 	atomic_store(m_shutdown_time, saturated_add(now, timeout), memory_order_release);
-	create_shutdown_timer();
+	enable_shutdown_checks();
 }
 
 bool Tcp_session_base::send(Stream_buffer buffer){
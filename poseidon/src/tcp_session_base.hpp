@@ -15,28 +15,28 @@ namespace Poseidon {
 class Tcp_server_base;
 class Tcp_client_base;
 class Ssl_filter;
-class Timer;
 
 class Tcp_session_base : public Socket_base, public Session_base {
 	friend Tcp_server_base;
 	friend Tcp_client_base;
 
-private:
-	static void shutdown_timer_proc(const boost::weak_ptr<Tcp_session_base> &weak, boost::uint64_t now);
-
 private:
 	boost::scoped_ptr<Ssl_filter> m_ssl_filter;
 
 	bool m_connected_notified;
 	bool m_read_hup_notified;
 
+	// 只在 epoll 线程中访问。接收时直接写入这里预留的空间，然后整块交给 on_receive()。
+	Stream_buffer m_recv_buffer;
+	std::size_t m_last_recv_size;
+
 	mutable Mutex m_send_mutex;
 	Stream_buffer m_send_buffer;
 
 	volatile boost::uint64_t m_shutdown_time;
 	volatile boost::uint64_t m_last_use_time;
-	mutable Mutex m_shutdown_mutex;
-	boost::shared_ptr<Timer> m_shutdown_timer;
+	// 在第一次收发数据或设置超时之前，不检测超时。
+	volatile bool m_shutdown_checks_enabled;
 
 public:
 	explicit Tcp_session_base(Move<Unique_file> socket);
@@ -44,7 +44,7 @@ public:
 
 private:
 	void init_ssl(boost::scoped_ptr<Ssl_filter> &ssl_filter);
-	void create_shutdown_timer();
+	void enable_shutdown_checks() NOEXCEPT;
 
 protected:
 	// 注意，只能在 epoll 线程中调用这些函数。
@@ -55,8 +55,9 @@ protected:
 	void on_read_hup() OVERRIDE = 0;
 	void on_close(int err_code) OVERRIDE = 0; // 参数就是 errno。
 	void on_receive(Stream_buffer data) OVERRIDE = 0;
+	void on_sweep(boost::uint64_t now) OVERRIDE;
 
-	// 注意，只能在 timer 线程中调用这些函数。
+	// 注意，只能在 epoll 线程中调用这些函数。
 	virtual void on_shutdown_timer(boost::uint64_t now);
 
 public:
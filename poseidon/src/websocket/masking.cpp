@@ -0,0 +1,108 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "../precompiled.hpp"
+#include "masking.hpp"
+#include "../endian.hpp"
+#if defined(__x86_64__) || defined(__i386__)
+#  include <immintrin.h>
+#  define POSEIDON_WEBSOCKET_MASKING_X86_   1
+#endif
+
+namespace Poseidon {
+namespace Websocket {
+
+namespace {
+	typedef boost::uint32_t (*Mask_proc)(unsigned char *data, std::size_t size, boost::uint32_t mask);
+
+	boost::uint32_t mask_scalar(unsigned char *data, std::size_t size, boost::uint32_t mask){
+		unsigned char *ptr = data;
+		std::size_t rem = size;
+		// 按 8 字节一组处理不会改变掩码的相位。掩码的最低字节作用于第一个字节，因此按小端序存放。
+		boost::uint64_t mask64;
+		store_le(mask64, mask | static_cast<boost::uint64_t>(mask) << 32);
+		while(rem >= 8){
+			boost::uint64_t word;
+			std::memcpy(&word, ptr, 8);
+			word ^= mask64;
+			std::memcpy(ptr, &word, 8);
+			ptr += 8;
+			rem -= 8;
+		}
+		while(rem != 0){
+			*ptr ^= static_cast<unsigned char>(mask);
+			mask = (mask << 24) | (mask >> 8);
+			ptr += 1;
+			rem -= 1;
+		}
+		return mask;
+	}
+
+#ifdef POSEIDON_WEBSOCKET_MASKING_X86_
+	__attribute__((__target__("sse2")))
+	boost::uint32_t mask_sse2(unsigned char *data, std::size_t size, boost::uint32_t mask){
+		unsigned char *ptr = data;
+		std::size_t rem = size;
+		const __m128i xmask = _mm_set1_epi32(static_cast<int>(mask));
+		while(rem >= 16){
+			__m128i word = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr));
+			word = _mm_xor_si128(word, xmask);
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(ptr), word);
+			ptr += 16;
+			rem -= 16;
+		}
+		return mask_scalar(ptr, rem, mask);
+	}
+
+	__attribute__((__target__("avx2")))
+	boost::uint32_t mask_avx2(unsigned char *data, std::size_t size, boost::uint32_t mask){
+		unsigned char *ptr = data;
+		std::size_t rem = size;
+		const __m256i ymask = _mm256_set1_epi32(static_cast<int>(mask));
+		while(rem >= 32){
+			__m256i word = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(ptr));
+			word = _mm256_xor_si256(word, ymask);
+			_mm256_storeu_si256(reinterpret_cast<__m256i *>(ptr), word);
+			ptr += 32;
+			rem -= 32;
+		}
+		return mask_sse2(ptr, rem, mask);
+	}
+#endif
+
+	Mask_proc select_mask_proc() NOEXCEPT {
+#ifdef POSEIDON_WEBSOCKET_MASKING_X86_
+		__builtin_cpu_init();
+		if(__builtin_cpu_supports("avx2")){
+			return &mask_avx2;
+		}
+		if(__builtin_cpu_supports("sse2")){
+			return &mask_sse2;
+		}
+#endif
+		return &mask_scalar;
+	}
+}
+
+boost::uint32_t apply_mask(void *data, std::size_t size, boost::uint32_t mask) NOEXCEPT {
+	if(mask == 0){
+		return mask;
+	}
+	static const Mask_proc s_proc = select_mask_proc();
+	return (*s_proc)(static_cast<unsigned char *>(data), size, mask);
+}
+boost::uint32_t apply_mask(Stream_buffer &buffer, boost::uint32_t mask){
+	if(mask == 0){
+		return mask;
+	}
+	void *data;
+	std::size_t size;
+	Stream_buffer::Enumeration_cookie cookie;
+	while(buffer.enumerate_chunk(&data, &size, cookie)){
+		mask = apply_mask(data, size, mask);
+	}
+	return mask;
+}
+
+}
+}
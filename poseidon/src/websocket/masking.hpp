@@ -0,0 +1,24 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_WEBSOCKET_MASKING_HPP_
+#define POSEIDON_WEBSOCKET_MASKING_HPP_
+
+#include "../cxx_ver.hpp"
+#include "../stream_buffer.hpp"
+#include <boost/cstdint.hpp>
+#include <cstddef>
+
+namespace Poseidon {
+namespace Websocket {
+
+// 掩码按小端序存放，第一个字节与 `mask` 的最低字节异或，此后每个字节循环右移 8 位。
+// 返回处理完所有数据之后的掩码，可以用于紧随其后的数据。
+extern boost::uint32_t apply_mask(void *data, std::size_t size, boost::uint32_t mask) NOEXCEPT;
+// 逐块原地处理，共享的块会先被复制一份。
+extern boost::uint32_t apply_mask(Stream_buffer &buffer, boost::uint32_t mask);
+
+}
+}
+
+#endif
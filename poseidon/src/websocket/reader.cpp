@@ -4,6 +4,7 @@
 #include "../precompiled.hpp"
 #include "reader.hpp"
 #include "exception.hpp"
+#include "masking.hpp"
 #include "../log.hpp"
 #include "../random.hpp"
 #include "../endian.hpp"
@@ -136,11 +137,8 @@ bool Reader::put_encoded_data(Stream_buffer encoded){
 		case state_data_frame:
 			temp64 = std::min<boost::uint64_t>(m_queue.size(), m_frame_size - m_frame_offset);
 			if(temp64 > 0){
-				Stream_buffer payload;
-				for(std::size_t i = 0; i < temp64; ++i){
-					payload.put(m_queue.get() ^ (int)m_mask);
-					m_mask = (m_mask << 24) | (m_mask >> 8);
-				}
+				Stream_buffer payload = m_queue.cut_off(static_cast<std::size_t>(temp64));
+				m_mask = apply_mask(payload, m_mask);
 				on_data_message_payload(m_whole_offset, STD_MOVE(payload));
 			}
 			m_frame_offset += temp64;
@@ -165,11 +163,8 @@ bool Reader::put_encoded_data(Stream_buffer encoded){
 
 		case state_control_frame:
 			{
-				Stream_buffer payload;
-				for(std::size_t i = 0; i < m_frame_size; ++i){
-					payload.put(m_queue.get() ^ (int)m_mask);
-					m_mask = (m_mask << 24) | (m_mask >> 8);
-				}
+				Stream_buffer payload = m_queue.cut_off(static_cast<std::size_t>(m_frame_size));
+				m_mask = apply_mask(payload, m_mask);
 				has_next_request = on_control_message(m_opcode, STD_MOVE(payload));
 			}
 			m_frame_offset = m_frame_size;
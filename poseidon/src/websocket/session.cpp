@@ -115,7 +115,7 @@ protected:
 		POSEIDON_LOG_DEBUG("Dispatching data message: opcode = ", m_opcode, ", payload_size = ", m_payload.size());
 		session->on_sync_data_message(m_opcode, STD_MOVE(m_payload));
 
-		const AUTO(keep_alive_timeout, Main_config::get<boost::uint64_t>("websocket_keep_alive_timeout", 30000));
+		const AUTO(keep_alive_timeout, Main_config::get_snapshot().websocket_keep_alive_timeout);
 		session->set_timeout(keep_alive_timeout);
 	}
 };
@@ -140,14 +140,14 @@ protected:
 		POSEIDON_LOG_DEBUG("Dispatching control message: opcode = ", m_opcode, ", payload_size = ", m_payload.size());
 		session->on_sync_control_message(m_opcode, STD_MOVE(m_payload));
 
-		const AUTO(keep_alive_timeout, Main_config::get<boost::uint64_t>("websocket_keep_alive_timeout", 30000));
+		const AUTO(keep_alive_timeout, Main_config::get_snapshot().websocket_keep_alive_timeout);
 		session->set_timeout(keep_alive_timeout);
 	}
 };
 
 Session::Session(const boost::shared_ptr<Http::Low_level_session> &parent)
 	: Low_level_session(parent)
-	, m_max_request_length(Main_config::get<boost::uint64_t>("websocket_max_request_length", 16384))
+	, m_max_request_length(Main_config::get_snapshot().websocket_max_request_length)
 	, m_size_total(0), m_opcode(opcode_invalid)
 {
 	//
@@ -4,6 +4,7 @@
 #include "../precompiled.hpp"
 #include "writer.hpp"
 #include "opcodes.hpp"
+#include "masking.hpp"
 #include "../log.hpp"
 #include "../profiler.hpp"
 #include "../endian.hpp"
@@ -44,20 +45,11 @@ long Writer::put_message(int opcode, bool masked, Stream_buffer payload){
 		frame.put(&temp64, 8);
 	}
 	if(masked){
-		boost::uint32_t mask = random_uint32() | 0x80808080;
+		const boost::uint32_t mask = random_uint32() | 0x80808080;
 		frame.put(&mask, 4);
-		for(;;){
-			int mb = payload.get();
-			if(mb == -1){
-				break;
-			}
-			mb ^= (int)mask;
-			frame.put(mb);
-			mask = (mask << 24) | (mask >> 8);
-		}
-	} else {
-		frame.splice(payload);
+		apply_mask(payload, mask);
 	}
+	frame.splice(payload);
 	return on_encoded_data_avail(STD_MOVE(frame));
 }
 long Writer::put_close_message(Status_code status_code, bool masked, Stream_buffer addition){
@@ -0,0 +1,186 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+// 这个文件被置于公有领域（public domain）。
+
+// 把 `log_binary_file` 写出的二进制日志还原为文本，格式与不带颜色的文本日志相同。
+// 文件格式见 `poseidon/src/singletons/log_daemon.hpp`。
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <boost/cstdint.hpp>
+
+namespace {
+
+const char g_magic[8] = { 'P', 'S', 'D', 'N', 'B', 'L', 'G', '1' };
+const std::size_t g_header_size = 16;
+const char *const g_level_names[6] = { "FATAL", "ERROR", "WARN ", "INFO ", "DEBUG", "TRACE" };
+
+struct Site {
+	unsigned long line;
+	std::string file;
+};
+
+template<typename T>
+bool read_field(T &val, const char *&rptr, const char *end){
+	if(static_cast<std::size_t>(end - rptr) < sizeof(val)){
+		return false;
+	}
+	std::memcpy(&val, rptr, sizeof(val));
+	rptr += sizeof(val);
+	return true;
+}
+
+void format_time(std::ostream &os, boost::uint64_t ms){
+	// 文件中保存的已经是本地时间。
+	const std::time_t sec = static_cast<std::time_t>(ms / 1000);
+	std::tm desc;
+	::gmtime_r(&sec, &desc);
+	char str[64];
+	std::sprintf(str, "%04u-%02u-%02u %02u:%02u:%02u.%03u",
+		1900u + desc.tm_year, 1u + desc.tm_mon, (unsigned)desc.tm_mday, (unsigned)desc.tm_hour, (unsigned)desc.tm_min, (unsigned)desc.tm_sec, (unsigned)(ms % 1000));
+	os <<str;
+}
+
+bool decode_arguments(std::ostream &os, const char *rptr, const char *end){
+	while(rptr != end){
+		const char type = *(rptr++);
+		switch(type){
+		case 'b': {
+			boost::uint8_t val;
+			if(!read_field(val, rptr, end)){
+				return false;
+			}
+			os <<(val ? "true" : "false");
+			break; }
+		case 'c': {
+			char val;
+			if(!read_field(val, rptr, end)){
+				return false;
+			}
+			os <<val;
+			break; }
+		case 'i': {
+			boost::int64_t val;
+			if(!read_field(val, rptr, end)){
+				return false;
+			}
+			os <<val;
+			break; }
+		case 'u': {
+			boost::uint64_t val;
+			if(!read_field(val, rptr, end)){
+				return false;
+			}
+			os <<val;
+			break; }
+		case 'p': {
+			boost::uint64_t val;
+			if(!read_field(val, rptr, end)){
+				return false;
+			}
+			os <<reinterpret_cast<const void *>(static_cast<std::size_t>(val));
+			break; }
+		case 's': {
+			boost::uint32_t len;
+			if(!read_field(len, rptr, end) || (static_cast<std::size_t>(end - rptr) < len)){
+				return false;
+			}
+			os.write(rptr, static_cast<std::streamsize>(len));
+			rptr += len;
+			break; }
+		default:
+			return false;
+		}
+	}
+	return true;
+}
+
+}
+
+int main(int argc, char **argv){
+	if(argc != 2){
+		std::cerr <<"Usage: " <<argv[0] <<" <binary log file>" <<std::endl;
+		return 1;
+	}
+	std::ifstream file(argv[1], std::ios::binary);
+	if(!file){
+		std::cerr <<"Could not open file: " <<argv[1] <<std::endl;
+		return 1;
+	}
+	std::ostringstream oss;
+	oss <<file.rdbuf();
+	const std::string data = oss.str();
+	if((data.size() < g_header_size) || (std::memcmp(data.data(), g_magic, sizeof(g_magic)) != 0)){
+		std::cerr <<"Not a binary log file: " <<argv[1] <<std::endl;
+		return 1;
+	}
+
+	std::map<boost::uint32_t, Site> sites;
+	const char *rptr = data.data() + g_header_size;
+	const char *const end = data.data() + data.size();
+	unsigned long long count = 0;
+	for(;;){
+		boost::uint32_t size;
+		const char *const record = rptr;
+		if(!read_field(size, rptr, end) || (size == 0)){
+			break;
+		}
+		if((size < 5) || (static_cast<std::size_t>(end - record) < size)){
+			std::cerr <<"Record truncated at offset " <<(record - data.data()) <<std::endl;
+			return 1;
+		}
+		const char *const record_end = record + size;
+		const char type = *(rptr++);
+		if(type == 1){
+			boost::uint32_t site_id, line;
+			if(!read_field(site_id, rptr, record_end) || !read_field(line, rptr, record_end)){
+				std::cerr <<"Invalid call site record at offset " <<(record - data.data()) <<std::endl;
+				return 1;
+			}
+			Site &site = sites[site_id];
+			site.line = line;
+			site.file.assign(rptr, record_end);
+		} else if(type == 2){
+			boost::uint32_t site_id, tid;
+			boost::uint8_t level;
+			boost::uint64_t local_time;
+			char tag[4];
+			if(!read_field(site_id, rptr, record_end) || !read_field(level, rptr, record_end) || !read_field(local_time, rptr, record_end) ||
+				!read_field(tid, rptr, record_end) || !read_field(tag, rptr, record_end) || (level >= 6))
+			{
+				std::cerr <<"Invalid log record at offset " <<(record - data.data()) <<std::endl;
+				return 1;
+			}
+			std::ostringstream line;
+			format_time(line, local_time);
+			char str[32];
+			std::sprintf(str, " %.4s %5lu %s ", tag, (unsigned long)tid, g_level_names[level]);
+			line <<str;
+			line <<std::boolalpha;
+			if(!decode_arguments(line, rptr, record_end)){
+				std::cerr <<"Invalid log arguments at offset " <<(record - data.data()) <<std::endl;
+				return 1;
+			}
+			const std::map<boost::uint32_t, Site>::const_iterator it = sites.find(site_id);
+			if(it == sites.end()){
+				line <<" ### <unknown call site " <<site_id <<">";
+			} else {
+				line <<" ### " <<it->second.file <<':' <<it->second.line;
+			}
+			line <<'\n';
+			std::cout <<line.str();
+			++count;
+		}
+		rptr = record_end;
+	}
+	std::cerr <<count <<" line(s) of logs decoded." <<std::endl;
+	return 0;
+}